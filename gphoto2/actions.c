@@ -32,10 +32,13 @@
 #include <libgen.h>
 #include <string.h>
 #include <stdio.h>
+#include <ctype.h>
+#include <errno.h>
 #ifdef HAVE_FCNTL_H
 # include <fcntl.h>
 #endif
 #include <stdlib.h>
+#include <unistd.h>
 
 #include <time.h>
 #ifdef HAVE_SYS_TIME_H
@@ -43,8 +46,16 @@
 #endif
 
 #include "actions.h"
+#include "capstats.h"
+#include "debuglog.h"
 #include "i18n.h"
 #include "main.h"
+#include "metrics.h"
+#include "movie.h"
+#include "preview.h"
+#include "reconnect.h"
+#include "schema.h"
+#include "trace.h"
 #include "version.h"
 
 
@@ -56,6 +67,9 @@
 #ifdef HAVE_AA
 #  include "gphoto2-cmd-capture.h"
 #endif
+#ifdef HAVE_JPEG
+#  include "termview.h"
+#endif
 
 #ifdef HAVE_LIBEXIF
 #  include <libexif/exif-data.h>
@@ -91,7 +105,7 @@ timediff_now (struct timeval *target) {
 int
 delete_all_action (GPParams *p)
 {
-	return gp_camera_folder_delete_all (p->camera, p->folder, p->context);
+	return metered_camera_folder_delete_all (p->camera, p->folder, p->context);
 }
 
 int
@@ -155,8 +169,8 @@ num_files_action (GPParams *p)
 	int count, filecount;
 
 	CR (gp_list_new (&list));
-	CL (gp_camera_folder_list_files (p->camera, p->folder,
-					 list, p->context), list);
+	CL (metered_camera_folder_list_files (p->camera, p->folder,
+					      list, p->context), list);
 	CL (count = gp_list_count (list), list);
 
 	if (p->flags & FLAGS_NEW) {
@@ -168,8 +182,8 @@ num_files_action (GPParams *p)
 			CameraFileInfo info;
 
 			CL (gp_list_get_name (list, i, &name), list);
-			CR (gp_camera_file_get_info (p->camera, p->folder,
-						     name, &info, p->context));
+			CR (metered_camera_file_get_info (p->camera, p->folder,
+							  name, &info, p->context));
 			if (info.file.fields & GP_FILE_INFO_STATUS &&
 			    info.file.status != GP_FILE_STATUS_DOWNLOADED)
 				filecount++;
@@ -198,8 +212,8 @@ list_folders_action (GPParams *p)
 	
 	CR (gp_list_new (&list));
 
-	CL (gp_camera_folder_list_folders (p->camera, p->folder, list,
-					   p->context), list);
+	CL (metered_camera_folder_list_folders (p->camera, p->folder, list,
+						p->context), list);
 	CL (count = gp_list_count (list), list);
 	if (!(p->flags & FLAGS_QUIET))
 		printf(ngettext(
@@ -231,8 +245,8 @@ list_files_action (GPParams *p)
 	int i;
 
 	CR (gp_list_new (&list));
-	CL (gp_camera_folder_list_files (p->camera, p->folder, list,
-					 p->context), list);
+	CL (metered_camera_folder_list_files (p->camera, p->folder, list,
+					      p->context), list);
 	CL (count = gp_list_count (list), list);
 	if (p->flags & FLAGS_NEW) {
 		filecount = 0;
@@ -240,8 +254,8 @@ list_files_action (GPParams *p)
 			CameraFileInfo info;
 
 			CL (gp_list_get_name (list, i, &name), list);
-			CR (gp_camera_file_get_info (p->camera, p->folder,
-						     name, &info, p->context));
+			CR (metered_camera_file_get_info (p->camera, p->folder,
+							  name, &info, p->context));
 			if (info.file.fields & GP_FILE_INFO_STATUS &&
 			    info.file.status != GP_FILE_STATUS_DOWNLOADED)
 				filecount++;
@@ -274,8 +288,8 @@ print_info_action (GPParams *p, const char *folder, const char *filename)
 {
 	CameraFileInfo info;
 
-	CR (gp_camera_file_get_info (p->camera, folder, filename, &info,
-				     p->context));
+	CR (metered_camera_file_get_info (p->camera, folder, filename, &info,
+					  p->context));
 
 	printf (_("Information on file '%s' (folder '%s'):\n"),
 		filename, folder);
@@ -351,8 +365,8 @@ print_file_action (GPParams *p, const char *folder, const char *filename)
 	if (p->flags & FLAGS_NEW) {
 		CameraFileInfo info;
 		
-		CR (gp_camera_file_get_info (p->camera, folder,
-					     filename, &info, p->context));
+		CR (metered_camera_file_get_info (p->camera, folder,
+						  filename, &info, p->context));
 		if (info.file.fields & GP_FILE_INFO_STATUS &&
 		    info.file.status == GP_FILE_STATUS_DOWNLOADED) {
 			x++;
@@ -365,8 +379,8 @@ print_file_action (GPParams *p, const char *folder, const char *filename)
             CameraFileInfo info;
 
             printf ("FILENAME='%s/%s'", folder, filename);
-            if (gp_camera_file_get_info (p->camera, folder, filename,
-                             &info, NULL) == GP_OK) {
+            if (metered_camera_file_get_info (p->camera, folder, filename,
+				  &info, NULL) == GP_OK) {
                 if (info.file.fields & GP_FILE_INFO_PERMISSIONS) {
                     printf(" PERMS=%s%s",
                            (info.file.permissions & GP_FILE_PERM_READ) ? "r" : "-",
@@ -390,8 +404,8 @@ print_file_action (GPParams *p, const char *folder, const char *filename)
             printf ("%s/%s\n", folder, filename);
 	else {
 		CameraFileInfo info;
-		if (gp_camera_file_get_info (p->camera, folder, filename,
-					     &info, NULL) == GP_OK) {
+		if (metered_camera_file_get_info (p->camera, folder, filename,
+						  &info, NULL) == GP_OK) {
 		    printf("#%-5i %-27s", x+1, filename);
 		    if (info.file.fields & GP_FILE_INFO_PERMISSIONS) {
                 printf("%s%s",
@@ -475,14 +489,56 @@ delete_file_action (GPParams *p, const char *folder, const char *filename)
 	if (p->flags & FLAGS_NEW) {
 		CameraFileInfo info;
 		
-		CR (gp_camera_file_get_info (p->camera, folder, filename,
-					     &info, p->context));
+		CR (metered_camera_file_get_info (p->camera, folder, filename,
+						  &info, p->context));
 		if (info.file.fields & GP_FILE_INFO_STATUS &&
 		    info.file.status == GP_FILE_STATUS_DOWNLOADED)
 			return GP_OK;
 	}
-	return gp_camera_file_delete (p->camera, folder, filename,
-				       p->context);
+	return metered_camera_file_delete (p->camera, folder, filename,
+					    p->context);
+}
+
+/* Deletes are issued once this many verified downloads are pending. */
+#define MOVE_BATCH 16
+
+int
+move_queue_add (GPParams *p, const char *folder, const char *filename)
+{
+	if (!p->move_queue)
+		CR (gp_list_new (&p->move_queue));
+	return gp_list_append (p->move_queue, filename, folder);
+}
+
+int
+move_queue_flush (GPParams *p, int all)
+{
+	const char *name, *folder;
+	int i, count, r, ret = GP_OK;
+
+	if (!p->move_queue)
+		return GP_OK;
+	count = gp_list_count (p->move_queue);
+	if (!count || (!all && (count < MOVE_BATCH)))
+		return GP_OK;
+
+	for (i = 0; i < count; i++) {
+		gp_list_get_name (p->move_queue, i, &name);
+		gp_list_get_value (p->move_queue, i, &folder);
+		if (!(p->flags & FLAGS_QUIET))
+			printf (_("Deleting file %s%s%s on the camera\n"), folder,
+				strcmp (folder, "/") ? "/" : "", name);
+		do {
+			r = metered_camera_file_delete (p->camera, folder, name,
+							p->context);
+		} while (r == GP_ERROR_CAMERA_BUSY);
+		if (r < GP_OK) {
+			cli_error_print (_("Could not delete image."));
+			ret = r;
+		}
+	}
+	gp_list_reset (p->move_queue);
+	return ret;
 }
 
 #ifdef HAVE_LIBEXIF
@@ -528,9 +584,10 @@ print_exif_action (GPParams *p, const char *folder, const char *filename)
 	unsigned int i;
 
         CR (gp_file_new (&file));
-        CRU (gp_camera_file_get (p->camera, folder, filename,
-				 GP_FILE_TYPE_EXIF, file, p->context), file);
+        CRU (metered_camera_file_get (p->camera, folder, filename,
+				      GP_FILE_TYPE_EXIF, file, p->context), file);
         CRU (gp_file_get_data_and_size (file, &data, &size), file);
+        metrics_bytes (METRIC_FILE_GET, size);
         ed = exif_data_new_from_data ((unsigned char *)data, size);
         gp_file_unref (file);
         if (!ed) {
@@ -820,6 +877,8 @@ action_camera_set_port (GPParams *params, const char *port)
 	r = gp_camera_set_port_info (params->camera, info);
 	if (r < 0)
 		return r;
+	/* Widgets of the old connection are of no use anymore. */
+	config_cache_invalidate (params);
 	gp_port_info_get_path (info, &path);
 	gp_setting_set ("gphoto2", "port", path);
 	return GP_OK;
@@ -894,6 +953,8 @@ action_camera_set_model (GPParams *p, const char *model)
 	CR (m = gp_abilities_list_lookup_model (gp_params_abilities_list(p), model));
 	CR (gp_abilities_list_get_abilities (gp_params_abilities_list(p), m, &a));
 	CR (gp_camera_set_abilities (p->camera, a));
+	config_cache_invalidate (p);
+	schema_free (p);
 	gp_setting_set ("gphoto2", "model", a.model);
 
 	return GP_OK;
@@ -959,8 +1020,9 @@ print_version_action (GPParams __unused__ *p)
 	return GP_OK;
 }
 
+/* mode is NULL for a plain capture, otherwise the --show-preview mode */
 static int
-_action_camera_capture_preview (GPParams *p, int viewasciiart)
+_action_camera_capture_preview (GPParams *p, int viewasciiart, const char *mode)
 {
 	CameraFile *file;
 	int	r, fd;
@@ -987,11 +1049,21 @@ _action_camera_capture_preview (GPParams *p, int viewasciiart)
 	}
 
 #ifdef HAVE_AA
+	/* The terminal view needs libjpeg, aalib is the fallback. */
+# ifdef HAVE_JPEG
+	if (viewasciiart && mode && !strcmp (mode, "aa"))
+# else
 	if (viewasciiart)
+# endif
 		r = gp_cmd_capture_preview (p->camera, file, p->context);
 	else
 #endif
-		r = gp_camera_capture_preview (p->camera, file, p->context);
+#ifdef HAVE_JPEG
+	if (viewasciiart)
+		r = termview_show (p, mode, file);
+	else
+#endif
+		r = metered_camera_capture_preview (p->camera, file, p->context);
 	fflush(stdout);
 	if (r < 0) {
 		if(!(p->flags & FLAGS_STDOUT))
@@ -1014,12 +1086,12 @@ _action_camera_capture_preview (GPParams *p, int viewasciiart)
 
 int
 action_camera_capture_preview (GPParams *p) {
-	return _action_camera_capture_preview (p, 0);
+	return _action_camera_capture_preview (p, 0, NULL);
 }
 
 int
-action_camera_show_preview (GPParams *p) {
-	return _action_camera_capture_preview (p, 1);
+action_camera_show_preview (GPParams *p, const char *mode) {
+	return _action_camera_capture_preview (p, 1, mode);
 }
 
 enum moviemode { MOVIE_ENDLESS, MOVIE_FRAMES, MOVIE_SECONDS };
@@ -1027,91 +1099,88 @@ enum moviemode { MOVIE_ENDLESS, MOVIE_FRAMES, MOVIE_SECONDS };
 int
 action_camera_capture_movie (GPParams *p, const char *arg)
 {
-	CameraFile	*file;
-	int		r, tries;
-	int		fd;
-	time_t		st;
+	MovieWriter	*writer;
+	PreviewSource	*source;
+	PreviewFrame	*frame;
 	enum moviemode	mm;
-	int		frames,captured_frames=0;
-	char		*xname;
-	struct timeval	starttime;
-	
-	if (p->flags & FLAGS_STDOUT) {
-		fd = dup(fileno(stdout));
-		xname = "stdout";
-	} else {
-		fd = open("movie.mjpg",O_WRONLY|O_CREAT|O_BINARY,0660);
-		if (fd == -1) {
-			cli_error_print(_("Could not open 'movie.mjpg'."));
-			return GP_ERROR;
-		}
-		xname = "movie.mjpg";
-	}
+	int		r, frames = 0, captured_frames = 0;
+	unsigned long	seq = 0, dropped = 0;
+	long		latency, elapsed;
+	double		capture_total = 0, capture_max = 0, latency_total = 0, latency_max = 0;
+	struct timeval	starttime, now;
+
+	CR (movie_writer_new (p, &writer));
 	if (!arg) {
 		mm = MOVIE_ENDLESS;
-		fprintf(stderr,_("Capturing preview frames as movie to '%s'. Press Ctrl-C to abort.\n"), xname);
+		fprintf(stderr,_("Capturing preview frames as movie to '%s'. Press Ctrl-C to abort.\n"), movie_writer_name (writer));
 	} else {
 		if (strchr(arg,'s')) {
 			sscanf (arg, "%ds", &frames);
-			fprintf(stderr,_("Capturing preview frames as movie to '%s' for %d seconds.\n"), xname, frames);
+			fprintf(stderr,_("Capturing preview frames as movie to '%s' for %d seconds.\n"), movie_writer_name (writer), frames);
 			mm = MOVIE_SECONDS;
-			time (&st);
 		} else {
 			sscanf (arg, "%d", &frames);
-			fprintf(stderr,_("Capturing %d preview frames as movie to '%s'.\n"), frames, xname);
+			fprintf(stderr,_("Capturing %d preview frames as movie to '%s'.\n"), frames, movie_writer_name (writer));
 			mm = MOVIE_FRAMES;
 		}
 	}
-	CR (gp_file_new_from_fd (&file, fd));
+	r = preview_source_start (p, &source);
+	if (r != GP_OK) {
+		movie_writer_close (writer);
+		return r;
+	}
 	gettimeofday (&starttime, NULL);
-	tries = 0;
-	while (1) {
-		const char *mime;
-		r = gp_camera_capture_preview (p->camera, file, p->context);
-		if (r < 0) {
-			if (r == GP_ERROR_CAMERA_BUSY) {
-				/* allow 20 busy tries */
-				if (tries++ < 20)
-					continue; /* just continue */
-			}
-			cli_error_print(_("Movie capture error... Exiting."));
-			break;
-		}
-		tries = 0;
-		gp_file_get_mime_type (file, &mime);
-                if (strcmp (mime, GP_MIME_JPEG)) {
-			cli_error_print(_("Movie capture error... Unhandled MIME type '%s'."), mime);
+
+	/*
+	 * The camera is read on the preview thread while we write the
+	 * previous frame. Frames we are too slow for are skipped and
+	 * counted as dropped, the camera never waits for the disk.
+	 */
+	while ((frame = preview_source_next (source, seq))) {
+		dropped += frame->seq - seq - 1;
+		seq = frame->seq;
+		r = movie_writer_put (writer, frame);
+		gettimeofday (&now, NULL);
+		latency = (now.tv_sec - frame->time.tv_sec) * 1000000L +
+			now.tv_usec - frame->time.tv_usec;
+		capture_total += frame->capture_usec;
+		if (frame->capture_usec > capture_max)
+			capture_max = frame->capture_usec;
+		latency_total += latency;
+		if (latency > latency_max)
+			latency_max = latency;
+		preview_frame_unref (source, frame);
+		if (r < 0)
 			break;
-		}
 
 		captured_frames++;
-
-		if (end_next) {
-			printf(_("Movie capture: SIGUSR2 signal received, stopping capture!\n"));
-			end_next = 0;
+		if ((mm == MOVIE_FRAMES) && (captured_frames >= frames))
 			break;
-		}
-
-		if (glob_cancel) {
-			fprintf(stderr, _("Ctrl-C pressed ... Exiting.\n"));
+		if ((mm == MOVIE_SECONDS) && ((-timediff_now (&starttime)) >= frames*1000))
 			break;
-		}
-		if (mm == MOVIE_FRAMES) {
-			if (!frames--)
-				break;
-		}
-		if (mm == MOVIE_SECONDS) {
-			if ((-timediff_now (&starttime)) >= frames*1000)
-				break;
-		}
 	}
-	gp_file_unref (file);
+	elapsed = -timediff_now (&starttime);
+	if (preview_source_halt (source) < 0) {
+		cli_error_print(_("Movie capture error... Exiting."));
+	} else if (end_next) {
+		printf(_("Movie capture: SIGUSR2 signal received, stopping capture!\n"));
+		end_next = 0;
+	} else if (glob_cancel) {
+		fprintf(stderr, _("Ctrl-C pressed ... Exiting.\n"));
+	}
+	preview_source_free (source);
+	if (movie_writer_close (writer) < 0)
+		r = GP_ERROR;
 
 	fprintf(stderr,_("Movie capture finished (%d frames)\n"), captured_frames);
-	return GP_OK;
+	if (captured_frames && elapsed > 0)
+		fprintf(stderr, _("%.1f fps, %lu frames dropped, capture %.1f ms average (%.1f ms max), written %.1f ms after capture (%.1f ms max)\n"),
+			captured_frames * 1000.0 / elapsed, dropped,
+			capture_total / captured_frames / 1000, capture_max / 1000,
+			latency_total / captured_frames / 1000, latency_max / 1000);
+	return (r < 0) ? r : GP_OK;
 }
 
-
 /*
  * arg can be:
  * events as number			e.g.: 1000
@@ -1119,8 +1188,8 @@ action_camera_capture_movie (GPParams *p, const char *arg)
  * seconds as number with suffix s 	e.g.: 50s
  * milliseconds as number with suffix mse.g.: 200ms
  */
-int
-action_camera_wait_event (GPParams *p, enum download_type downloadtype, const char*arg)
+static int
+do_action_camera_wait_event (GPParams *p, enum download_type downloadtype, const char*arg)
 {
 	int ret;
 	struct waitparams wp;
@@ -1129,7 +1198,8 @@ action_camera_wait_event (GPParams *p, enum download_type downloadtype, const ch
 	CameraFilePath	*fn;
 	CameraFilePath last;
 	struct timeval	xtime;
-	int events, frames;
+	double	start;
+	int events, frames, attempt = 0;
 
         end_next = 0;
 
@@ -1178,8 +1248,10 @@ action_camera_wait_event (GPParams *p, enum download_type downloadtype, const ch
 			capture_now = 0;
 			data = malloc(sizeof(CameraFilePath));
 			printf(_("SIGUSR1 signal received, triggering capture!\n"));
-			ret = gp_camera_capture (p->camera, GP_CAPTURE_IMAGE, (CameraFilePath*)data, p->context);
+			capstats_trigger (capstats_begin ());
+			ret = metered_camera_capture (p->camera, GP_CAPTURE_IMAGE, (CameraFilePath*)data, p->context);
 			if (ret == GP_OK) {
+				capstats_captured ((CameraFilePath*)data);
 				event = GP_EVENT_FILE_ADDED;
 				goto afterevent;
 			} else {
@@ -1215,9 +1287,14 @@ action_camera_wait_event (GPParams *p, enum download_type downloadtype, const ch
 		if (exitloop) break;
 
 		data = NULL;
-		ret = gp_camera_wait_for_event (p->camera, leftoverms, &event, &data, p->context);
-		if (ret != GP_OK)
+		ret = metered_camera_wait_for_event (p->camera, leftoverms, &event, &data, p->context);
+		if (ret != GP_OK) {
+			/* Keep waiting with the same counters once the camera is back. */
+			if (reconnect_retry (p, ret, &attempt))
+				continue;
 			return ret;
+		}
+		attempt = 0;
 afterevent:
 		events++;
 		switch (event) {
@@ -1252,6 +1329,7 @@ afterevent:
 			frames++;
 
 			fn = (CameraFilePath*)data;
+			capstats_file (fn);
 
 			if (	(downloadtype == DT_NO_DOWNLOAD)	||
 				(	(p->flags & FLAGS_KEEP_RAW) &&
@@ -1274,7 +1352,11 @@ afterevent:
 					return ret;
 				}
 			}
-			ret = get_file_common (fn->name, GP_FILE_TYPE_NORMAL);
+			start = capstats_begin ();
+			do {
+				ret = get_file_common (fn->name, GP_FILE_TYPE_NORMAL);
+			} while (reconnect_retry (p, ret, &attempt));
+			capstats_stage (CAPSTATS_DOWNLOAD, start);
 			if (ret != GP_OK) {
 				cli_error_print (_("Could not get image."));
 				if(ret == GP_ERROR_FILE_NOT_FOUND) {
@@ -1288,10 +1370,15 @@ afterevent:
 				return ret;
 			}
 
-			if (!(p->flags & FLAGS_KEEP)) {
+			if (p->flags & FLAGS_MOVE) {
+				/* deleted in batches once verified */
+				move_queue_flush (p, 0);
+			} else if (!(p->flags & FLAGS_KEEP)) {
+				start = capstats_begin ();
 				do {
 					ret = delete_file_action (p, p->folder, fn->name);
 				} while (ret == GP_ERROR_CAMERA_BUSY);
+				capstats_stage (CAPSTATS_DELETE, start);
 				if (ret != GP_OK) {
 					cli_error_print ( _("Could not delete image."));
 					/* dont continue in event loop */
@@ -1324,6 +1411,16 @@ afterevent:
 	return GP_OK;
 }
 
+int
+action_camera_wait_event (GPParams *p, enum download_type downloadtype, const char*arg)
+{
+	int ret;
+
+	ret = do_action_camera_wait_event (p, downloadtype, arg);
+	capstats_report ();
+	return ret;
+}
+
 int
 print_storage_info (GPParams *p)
 {
@@ -1465,6 +1562,8 @@ debug_func (GPLogLevel level, const char *domain, const char *str, void *data)
 	long sec, usec;
 	FILE *logfile = (data != NULL)?(FILE *)data:stderr;
 
+	if (!debuglog_wanted (level, domain))
+		return;
 	gettimeofday (&tv,NULL);
 	sec = tv.tv_sec  - glob_tv_zero.tv_sec;
 	usec = tv.tv_usec - glob_tv_zero.tv_usec;
@@ -1494,19 +1593,27 @@ debug_action (GPParams *p, const char *debug_loglevel, const char *debug_logfile
 	else if (debug_loglevel && !strcmp(debug_loglevel, "all"))
 		loglevel = GP_LOG_ALL;
 
-	if (debug_logfile_name != NULL) {
-	  /* FIXME: Handle fopen() error besides using stderr? */
-	  logfile = fopen(debug_logfile_name, "a");
-	}
-	if (logfile == NULL) {
-	  logfile = stderr;
-	}
-	setbuf(logfile, NULL);
-	setbuf(stdout, NULL);
+	/* Register for the most verbose domain, debug_func() filters. */
+	loglevel = debuglog_set_level (loglevel);
+
+	if (debuglog_is_open ()) {
+		/* Buffered and written by a thread of its own. */
+		CR (p->debug_func_id = gp_log_add_func (loglevel, debuglog_log, NULL));
+	} else {
+		if (debug_logfile_name != NULL) {
+		  /* FIXME: Handle fopen() error besides using stderr? */
+		  logfile = fopen(debug_logfile_name, "a");
+		}
+		if (logfile == NULL) {
+		  logfile = stderr;
+		}
+		setbuf(logfile, NULL);
+		setbuf(stdout, NULL);
 
-	gettimeofday (&glob_tv_zero, NULL);
+		gettimeofday (&glob_tv_zero, NULL);
 
-	CR (p->debug_func_id = gp_log_add_func (loglevel, debug_func, (void *) logfile));
+		CR (p->debug_func_id = gp_log_add_func (loglevel, debug_func, (void *) logfile));
+	}
 	gp_log (GP_LOG_DEBUG, "main", _("ALWAYS INCLUDE THE FOLLOWING LINES "
 					"WHEN SENDING DEBUG MESSAGES TO THE "
 					"MAILING LIST:"));
@@ -1591,15 +1698,190 @@ display_widgets (GPParams *p, CameraWidget *widget, char *prefix, int dumpval) {
 }
 
 
+/*
+ * The configuration widgets of this session. Fetching the tree or even
+ * a single entry costs a round trip to the camera, so widgets are kept
+ * until the tree is invalidated: when the camera changes or reconnects,
+ * or when a set fails. Name, label and path of every tree entry, and
+ * the entries fetched on their own, are found through a hash table.
+ */
+enum {
+	INDEX_NAME,
+	INDEX_LABEL,
+	INDEX_PATH,	/* as --list-config shows it, without leading / */
+	INDEX_SINGLE,	/* from gp_camera_get_single_config, owned by us */
+};
+
+typedef struct {
+	int		kind;
+	char		*key;
+	CameraWidget	*widget;
+} ConfigIndexEntry;
+
+struct _GPConfigCache {
+	CameraWidget	 *tree;
+	ConfigIndexEntry *slots;
+	unsigned int	 size, used;
+};
+
+static unsigned int
+_config_hash (int kind, const char *key) {
+	unsigned int h = 2166136261u ^ kind;
+
+	while (*key) {
+		h ^= (unsigned char) *key++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static ConfigIndexEntry *
+_config_slot (GPConfigCache *c, int kind, const char *key) {
+	unsigned int i = _config_hash (kind, key) & (c->size - 1);
+
+	while (c->slots[i].key &&
+	       ((c->slots[i].kind != kind) || strcmp (c->slots[i].key, key)))
+		i = (i + 1) & (c->size - 1);
+	return &c->slots[i];
+}
+
+/* Add key unless it is there already: the first widget of a name wins,
+ * like with gp_widget_get_child_by_name(). */
+static int
+_config_index_add (GPConfigCache *c, int kind, const char *key, CameraWidget *widget) {
+	ConfigIndexEntry *e;
+
+	if (2 * (c->used + 1) > c->size) {
+		ConfigIndexEntry *old = c->slots;
+		unsigned int i, oldsize = c->size;
+
+		c->size = oldsize ? 2 * oldsize : 512;
+		c->slots = calloc (c->size, sizeof (ConfigIndexEntry));
+		if (!c->slots) {
+			c->slots = old;
+			c->size = oldsize;
+			return GP_ERROR_NO_MEMORY;
+		}
+		for (i = 0; i < oldsize; i++)
+			if (old[i].key)
+				*_config_slot (c, old[i].kind, old[i].key) = old[i];
+		free (old);
+	}
+	e = _config_slot (c, kind, key);
+	if (e->key)
+		return GP_OK;
+	e->key = strdup (key);
+	if (!e->key)
+		return GP_ERROR_NO_MEMORY;
+	e->kind = kind;
+	e->widget = widget;
+	c->used++;
+	return GP_OK;
+}
+
+static int
+_config_index_tree (GPConfigCache *c, CameraWidget *widget, const char *prefix) {
+	const char	*name, *label;
+	char		*path;
+	CameraWidget	*child;
+	int		i, n, ret;
+
+	gp_widget_get_name (widget, &name);
+	gp_widget_get_label (widget, &label);
+	path = malloc (strlen (prefix) + 1 + strlen (strlen (name) ? name : label) + 1);
+	if (!path)
+		return GP_ERROR_NO_MEMORY;
+	sprintf (path, "%s%s%s", prefix, *prefix ? "/" : "", strlen (name) ? name : label);
+
+	ret = GP_OK;
+	if (strlen (name))
+		ret = _config_index_add (c, INDEX_NAME, name, widget);
+	if (ret == GP_OK)
+		ret = _config_index_add (c, INDEX_LABEL, label, widget);
+	if (ret == GP_OK)
+		ret = _config_index_add (c, INDEX_PATH, path, widget);
+
+	n = gp_widget_count_children (widget);
+	for (i = 0; (i < n) && (ret == GP_OK); i++)
+		if (gp_widget_get_child (widget, i, &child) == GP_OK)
+			ret = _config_index_tree (c, child, path);
+	free (path);
+	return ret;
+}
+
+void
+config_cache_invalidate (GPParams *p) {
+	GPConfigCache	*c = p->config_cache;
+	unsigned int	i;
+
+	if (!c)
+		return;
+	for (i = 0; i < c->size; i++) {
+		if (c->slots[i].kind == INDEX_SINGLE)
+			gp_widget_free (c->slots[i].widget);
+		free (c->slots[i].key);
+	}
+	free (c->slots);
+	if (c->tree)
+		gp_widget_free (c->tree);
+	memset (c, 0, sizeof (GPConfigCache));
+}
+
+void
+config_cache_free (GPParams *p) {
+	config_cache_invalidate (p);
+	free (p->config_cache);
+	p->config_cache = NULL;
+}
+
+static GPConfigCache *
+_config_cache (GPParams *p) {
+	if (!p->config_cache)
+		p->config_cache = calloc (1, sizeof (GPConfigCache));
+	return p->config_cache;
+}
+
+/* The session copy of the tree, fetched again if fresh is set. */
+static int
+_config_tree (GPParams *p, int fresh, CameraWidget **tree) {
+	GPConfigCache	*c = _config_cache (p);
+	int		ret;
+
+	if (!c)
+		return GP_ERROR_NO_MEMORY;
+	if (fresh || !c->tree) {
+		config_cache_invalidate (p);
+		ret = metered_camera_get_config (p->camera, &c->tree, p->context);
+		if (ret != GP_OK)
+			return ret;
+		/* Without the index lookups just walk the tree. */
+		if (_config_index_tree (c, c->tree, "") != GP_OK)
+			gp_log (GP_LOG_DEBUG, "config", "Could not index the configuration tree.");
+		/* Remember the layout for next time, or for new firmware. */
+		schema_load (p);
+		schema_update (p, c->tree);
+	}
+	*tree = c->tree;
+	return GP_OK;
+}
+
+static CameraWidget *
+_config_index_get (GPParams *p, int kind, const char *key) {
+	GPConfigCache *c = p->config_cache;
+
+	if (!c || !c->size)
+		return NULL;
+	return _config_slot (c, kind, key)->widget;
+}
+
 int
 list_all_config_action (GPParams *p) {
 	CameraWidget *rootconfig;
 	int	ret;
 
-	ret = gp_camera_get_config (p->camera, &rootconfig, p->context);
+	ret = _config_tree (p, 1, &rootconfig);
 	if (ret != GP_OK) return ret;
 	display_widgets (p, rootconfig, "", 1);
-	gp_widget_free (rootconfig);
 	return GP_OK;
 }
 int
@@ -1607,29 +1889,24 @@ list_config_action (GPParams *p) {
 	CameraWidget *rootconfig;
 	int	ret;
 
-	ret = gp_camera_get_config (p->camera, &rootconfig, p->context);
+	/* Only the paths are printed, the cached layout has them. */
+	if (schema_load (p) == GP_OK)
+		return schema_list (p);
+
+	ret = _config_tree (p, 1, &rootconfig);
 	if (ret != GP_OK) return ret;
 	display_widgets (p, rootconfig, "", 0);
-	gp_widget_free (rootconfig);
 	return GP_OK;
 }
 
+/* Look up name, label or /path/to/name below rootconfig. */
 static int
-_find_widget_by_name (GPParams *p, const char *name, CameraWidget **child, CameraWidget **rootconfig) {
+_lookup_widget (CameraWidget *rootconfig, const char *name, CameraWidget **child) {
 	int	ret;
 
-	*rootconfig = NULL;
-	ret = gp_camera_get_single_config (p->camera, name, child, p->context);
-	if (ret == GP_OK) {
-		*rootconfig = *child;
-		return GP_OK;
-	}
-
-	ret = gp_camera_get_config (p->camera, rootconfig, p->context);
-	if (ret != GP_OK) return ret;
-	ret = gp_widget_get_child_by_name (*rootconfig, name, child);
+	ret = gp_widget_get_child_by_name (rootconfig, name, child);
 	if (ret != GP_OK)
-		ret = gp_widget_get_child_by_label (*rootconfig, name, child);
+		ret = gp_widget_get_child_by_label (rootconfig, name, child);
 	if (ret != GP_OK) {
 		char		*part, *s, *newname;
 
@@ -1637,7 +1914,7 @@ _find_widget_by_name (GPParams *p, const char *name, CameraWidget **child, Camer
 		if (!newname)
 			return GP_ERROR_NO_MEMORY;
 
-		*child = *rootconfig;
+		*child = rootconfig;
 		part = newname;
 		while (part[0] == '/')
 			part++;
@@ -1662,14 +1939,167 @@ _find_widget_by_name (GPParams *p, const char *name, CameraWidget **child, Camer
 			while (part[0] == '/')
 				part++;
 		}
-		gp_context_error (p->context, _("%s not found in configuration tree."), newname);
 		free (newname);
-		gp_widget_free (*rootconfig);
 		return GP_ERROR;
 	}
 	return GP_OK;
 }
 
+/* Look up name in the session tree, without complaining if it is not there. */
+static int
+_lookup_config (GPParams *p, const char *name, CameraWidget **child) {
+	const char *path = name;
+
+	if (!p->config_cache || !p->config_cache->tree)
+		return GP_ERROR;
+	while (*path == '/')
+		path++;
+	*child = _config_index_get (p, INDEX_NAME, name);
+	if (!*child)
+		*child = _config_index_get (p, INDEX_LABEL, name);
+	if (!*child)
+		*child = _config_index_get (p, INDEX_PATH, path);
+	if (*child)
+		return GP_OK;
+	/* Paths made of labels, or no index. */
+	return _lookup_widget (p->config_cache->tree, name, child);
+}
+
+static int
+_find_widget_in_tree (GPParams *p, const char *name, CameraWidget **child) {
+	int	ret;
+
+	ret = _lookup_config (p, name, child);
+	if (ret != GP_OK)
+		gp_context_error (p->context, _("%s not found in configuration tree."), name);
+	return ret;
+}
+
+/*
+ * Find name in the session widgets. rootconfig is what has to be sent
+ * to the camera after a change: child itself if it came on its own,
+ * otherwise the tree. Both stay owned by the session cache.
+ *
+ * With fresh set, the value is fetched from the camera again, which
+ * get_config_action() wants and set_config_action() does not need.
+ */
+static int
+_do_find_widget_by_name (GPParams *p, const char *name, int fresh, CameraWidget **child, CameraWidget **rootconfig) {
+	const char	*realname = name;
+	CameraWidget	*widget;
+	int		ret;
+
+	if (!fresh) {
+		*child = _config_index_get (p, INDEX_SINGLE, name);
+		if (*child) {
+			*rootconfig = *child;
+			return GP_OK;
+		}
+		if (_lookup_config (p, name, child) == GP_OK) {
+			*rootconfig = p->config_cache->tree;
+			return GP_OK;
+		}
+	}
+
+	ret = metered_camera_get_single_config (p->camera, name, &widget, p->context);
+	/* A label or path: the cached layout knows the name to ask for. */
+	if ((ret != GP_OK) && (schema_load (p) == GP_OK) &&
+	    (schema_lookup (p, name, &realname, NULL) == GP_OK) &&
+	    strcmp (realname, name))
+		ret = metered_camera_get_single_config (p->camera, realname, &widget, p->context);
+	if (ret == GP_OK) {
+		GPConfigCache	 *c = _config_cache (p);
+		ConfigIndexEntry *e;
+
+		if (!c) {
+			gp_widget_free (widget);
+			return GP_ERROR_NO_MEMORY;
+		}
+		/* Replace an older copy of the same entry. */
+		if (c->size && (e = _config_slot (c, INDEX_SINGLE, name))->key) {
+			gp_widget_free (e->widget);
+			e->widget = widget;
+		} else if (_config_index_add (c, INDEX_SINGLE, name, widget) != GP_OK) {
+			gp_widget_free (widget);
+			return GP_ERROR_NO_MEMORY;
+		}
+		*child = *rootconfig = widget;
+		return GP_OK;
+	}
+
+	ret = _config_tree (p, 1, rootconfig);
+	if (ret != GP_OK)
+		return ret;
+	return _find_widget_in_tree (p, name, child);
+}
+
+/* Cache hits show up as short spans without a camera call below. */
+static int
+_find_widget_by_name (GPParams *p, const char *name, int fresh, CameraWidget **child, CameraWidget **rootconfig) {
+	double	start = trace_begin ();
+	int	ret;
+
+	ret = _do_find_widget_by_name (p, name, fresh, child, rootconfig);
+	trace_end ("config", "find_widget", start, name);
+	return ret;
+}
+
+/*
+ * Drivers only apply the widgets marked changed. Clear the marks of the
+ * session tree, whose values may be out of date, before marking what is
+ * sent next.
+ */
+static void
+_config_unmark (CameraWidget *widget) {
+	CameraWidget	*child;
+	int		i, n;
+
+	gp_widget_set_changed (widget, 0);
+	n = gp_widget_count_children (widget);
+	for (i = 0; i < n; i++)
+		if (gp_widget_get_child (widget, i, &child) == GP_OK)
+			_config_unmark (child);
+}
+
+/*
+ * Send child of the session tree on its own, or for drivers that only
+ * take whole trees, the tree with nothing but child marked changed.
+ */
+static int
+_send_config_child (GPParams *p, CameraWidget *child, CameraWidget *rootconfig) {
+	const char	*realname;
+	int		ret;
+
+	gp_widget_get_name (child, &realname);
+	if (strlen (realname)) {
+		ret = metered_camera_set_single_config (p->camera, realname, child, p->context);
+		if (ret != GP_ERROR_NOT_SUPPORTED)
+			return ret;
+	}
+	_config_unmark (rootconfig);
+	gp_widget_set_changed (child, 1);
+	return metered_camera_set_config (p->camera, rootconfig, p->context);
+}
+
+/* Send what _find_widget_by_name() found after it was changed. */
+static int
+_send_config (GPParams *p, const char *name, const char *value,
+	      CameraWidget *child, CameraWidget *rootconfig) {
+	const char	*realname;
+	int		ret;
+
+	/* The cached value may be out of date, make sure it is sent. */
+	gp_widget_set_changed (child, 1);
+	if (child == rootconfig) {
+		gp_widget_get_name (child, &realname);
+		ret = metered_camera_set_single_config (p->camera, realname, child, p->context);
+	} else
+		ret = _send_config_child (p, child, rootconfig);
+	if (ret != GP_OK)
+		gp_context_error (p->context, _("Failed to set new configuration value %s for configuration entry %s."), value, name);
+	return ret;
+}
+
 /* From the strftime(3) man page:
  * BUGS
  *     Some buggy versions of gcc complain about the use of %c: warning:
@@ -1808,39 +2238,47 @@ get_config_action (GPParams *p, const char *name) {
 	CameraWidget *rootconfig,*child;
 	int	ret;
 
-	ret = _find_widget_by_name (p, name, &child, &rootconfig);
+	ret = _find_widget_by_name (p, name, 1, &child, &rootconfig);
 	if (ret != GP_OK)
 		return ret;
-	ret = print_widget (p, name, child);
-	gp_widget_free (rootconfig);
-	return ret;
+	return print_widget (p, name, child);
 }
 
-int
-set_config_action (GPParams *p, const char *name, const char *value) {
-	CameraWidget *rootconfig,*child;
+/* 0 or 1 for the usual spellings of off and on, 2 for anything else. */
+static int
+_parse_toggle (const char *value) {
+	if (	!strcasecmp (value, "off")	|| !strcasecmp (value, "no")	||
+		!strcasecmp (value, "false")	|| !strcmp (value, "0")		||
+		!strcasecmp (value, _("off"))	|| !strcasecmp (value, _("no"))	||
+		!strcasecmp (value, _("false"))
+	)
+		return 0;
+	if (	!strcasecmp (value, "on")	|| !strcasecmp (value, "yes")	||
+		!strcasecmp (value, "true")	|| !strcmp (value, "1")		||
+		!strcasecmp (value, _("on"))	|| !strcasecmp (value, _("yes"))	||
+		!strcasecmp (value, _("true"))
+	)
+		return 1;
+	return 2;
+}
+
+/* Parse value according to the widget type and store it in child.
+ * Nothing is sent to the camera yet. */
+static int
+_apply_config_value (GPParams *p, const char *name, CameraWidget *child, const char *value) {
 	int	ret, ro;
 	CameraWidgetType	type;
 
-	ret = _find_widget_by_name (p, name, &child, &rootconfig);
-	if (ret != GP_OK)
-		return ret;
-
 	ret = gp_widget_get_readonly (child, &ro);
-	if (ret != GP_OK) {
-		gp_widget_free (rootconfig);
+	if (ret != GP_OK)
 		return ret;
-	}
 	if (ro == 1) {
 		gp_context_error (p->context, _("Property %s is read only."), name);
-		gp_widget_free (rootconfig);
 		return GP_ERROR;
 	}
 	ret = gp_widget_get_type (child, &type);
-	if (ret != GP_OK) {
-		gp_widget_free (rootconfig);
+	if (ret != GP_OK)
 		return ret;
-	}
 
 	switch (type) {
 	case GP_WIDGET_TEXT: {		/* char *		*/
@@ -1873,19 +2311,7 @@ set_config_action (GPParams *p, const char *name, const char *value) {
 	case GP_WIDGET_TOGGLE: {	/* int		*/
 		int	t;
 
-		t = 2;
-		if (	!strcasecmp (value, "off")	|| !strcasecmp (value, "no")	||
-			!strcasecmp (value, "false")	|| !strcmp (value, "0")		||
-			!strcasecmp (value, _("off"))	|| !strcasecmp (value, _("no"))	||
-			!strcasecmp (value, _("false"))
-		)
-			t = 0;
-		if (	!strcasecmp (value, "on")	|| !strcasecmp (value, "yes")	||
-			!strcasecmp (value, "true")	|| !strcmp (value, "1")		||
-			!strcasecmp (value, _("on"))	|| !strcasecmp (value, _("yes"))	||
-			!strcasecmp (value, _("true"))
-		)
-			t = 1;
+		t = _parse_toggle (value);
 		/*fprintf (stderr," value %s, t %d\n", value, t);*/
 		if (t == 2) {
 			gp_context_error (p->context, _("The passed value %s is not a valid toggle value."), value);
@@ -1985,15 +2411,552 @@ set_config_action (GPParams *p, const char *name, const char *value) {
 		ret = GP_ERROR_BAD_PARAMETERS;
 		break;
 	}
-	if (ret == GP_OK) {
-		if (child == rootconfig)
-			ret = gp_camera_set_single_config (p->camera, name, child, p->context);
-		else
-			ret = gp_camera_set_config (p->camera, rootconfig, p->context);
-		if (ret != GP_OK)
-			gp_context_error (p->context, _("Failed to set new configuration value %s for configuration entry %s."), value, name);
+	return ret;
+}
+
+/*
+ * Reject values that cannot be right for the widget type before talking
+ * to the camera. Ranges and choices depend on the camera mode, so those
+ * are still left to _apply_config_value() on the live widget.
+ */
+static int
+_check_config_value (GPParams *p, const char *name, const char *value) {
+	CameraWidgetType	type;
+	float			f;
+
+	if ((schema_load (p) != GP_OK) ||
+	    (schema_lookup (p, name, NULL, &type) != GP_OK))
+		return GP_OK;
+	switch (type) {
+	case GP_WIDGET_TOGGLE:
+		if (_parse_toggle (value) == 2) {
+			gp_context_error (p->context, _("The passed value %s is not a valid toggle value."), value);
+			return GP_ERROR_BAD_PARAMETERS;
+		}
+		break;
+	case GP_WIDGET_RANGE:
+		if (sscanf (value, "%f", &f) != 1) {
+			gp_context_error (p->context, _("The passed value %s is not a floating point value."), value);
+			return GP_ERROR_BAD_PARAMETERS;
+		}
+		break;
+	default:
+		break;
+	}
+	return GP_OK;
+}
+
+int
+set_config_action (GPParams *p, const char *name, const char *value) {
+	CameraWidget *rootconfig,*child;
+	int	ret;
+
+	ret = _check_config_value (p, name, value);
+	if (ret != GP_OK)
+		return ret;
+	ret = _find_widget_by_name (p, name, 0, &child, &rootconfig);
+	if (ret != GP_OK)
+		return ret;
+
+	ret = _apply_config_value (p, name, child, value);
+	if (ret == GP_OK)
+		ret = _send_config (p, name, value, child, rootconfig);
+	if (ret != GP_OK)
+		config_cache_invalidate (p);
+	return ret;
+}
+
+int
+config_cache_widget (GPParams *p, const char *name, CameraWidget **widget) {
+	CameraWidget *rootconfig;
+
+	return _find_widget_by_name (p, name, 0, widget, &rootconfig);
+}
+
+/*
+ * The current value of widget in the form _apply_config_value() takes.
+ * Returns GP_ERROR_NOT_SUPPORTED for widgets without a value that can
+ * be restored later: sections, buttons and the camera clock.
+ */
+static int
+_widget_value_string (CameraWidget *widget, char *buf, size_t size) {
+	CameraWidgetType	type;
+	int			ret;
+
+	ret = gp_widget_get_type (widget, &type);
+	if (ret != GP_OK)
+		return ret;
+	switch (type) {
+	case GP_WIDGET_TEXT:
+	case GP_WIDGET_MENU:
+	case GP_WIDGET_RADIO: {
+		char *txt = NULL;
+
+		ret = gp_widget_get_value (widget, &txt);
+		if (ret == GP_OK)
+			snprintf (buf, size, "%s", txt ? txt : "");
+		break;
+	}
+	case GP_WIDGET_RANGE: {
+		float f;
+
+		ret = gp_widget_get_value (widget, &f);
+		if (ret == GP_OK)
+			snprintf (buf, size, "%.9g", f);	/* enough to give the same float back */
+		break;
+	}
+	case GP_WIDGET_TOGGLE: {
+		int t;
+
+		ret = gp_widget_get_value (widget, &t);
+		if (ret == GP_OK)
+			snprintf (buf, size, "%d", t);
+		break;
+	}
+	default:
+		ret = GP_ERROR_NOT_SUPPORTED;
+		break;
+	}
+	return ret;
+}
+
+/*
+ * Apply all name/value pairs of settings against the session tree, then
+ * send the changed widgets on their own, or those the driver can't take
+ * alone with one gp_camera_set_config(). If any value is invalid, nothing
+ * is sent.
+ *
+ * With diff set (--load-config), entries that are unknown to this
+ * camera, read-only or already at the saved value are skipped instead
+ * of being treated as errors.
+ */
+static int
+_set_config_batch (GPParams *p, CameraList *settings, int diff) {
+	CameraWidget	*rootconfig, *child, **sent;
+	const char	*name, *value;
+	char		cur[1024];
+	int		i, count, ret, ro, whole = 0;
+	int		changed = 0, same = 0, readonly = 0, unknown = 0;
+
+	count = gp_list_count (settings);
+	if (count <= 0)
+		return count;
+	/* The diff needs the current values. */
+	ret = _config_tree (p, diff, &rootconfig);
+	if (ret != GP_OK)
+		return ret;
+	sent = calloc (count, sizeof (*sent));
+	if (!sent)
+		return GP_ERROR_NO_MEMORY;
+	_config_unmark (rootconfig);
+	for (i = 0; i < count; i++) {
+		gp_list_get_name (settings, i, &name);
+		gp_list_get_value (settings, i, &value);
+		if (diff) {
+			if (_lookup_config (p, name, &child) != GP_OK) {
+				gp_log (GP_LOG_DEBUG, "load-config", "%s not found, skipping", name);
+				unknown++;
+				continue;
+			}
+			if ((gp_widget_get_readonly (child, &ro) == GP_OK) && ro) {
+				readonly++;
+				continue;
+			}
+			if ((_widget_value_string (child, cur, sizeof (cur)) == GP_OK) &&
+			    !strcmp (cur, value)) {
+				same++;
+				continue;
+			}
+			ret = GP_OK;
+		} else
+			ret = _find_widget_in_tree (p, name, &child);
+		if (ret == GP_OK)
+			ret = _apply_config_value (p, name, child, value);
+		if (ret != GP_OK) {
+			config_cache_invalidate (p);
+			free (sent);
+			return ret;
+		}
+		/* A cached value may be out of date, make sure it is sent. */
+		gp_widget_set_changed (child, 1);
+		sent[changed++] = child;
+	}
+	ret = GP_OK;
+	for (i = 0; (i < changed) && (ret == GP_OK); i++) {
+		gp_widget_get_name (sent[i], &name);
+		ret = GP_ERROR_NOT_SUPPORTED;
+		if (strlen (name))
+			ret = metered_camera_set_single_config (p->camera, name, sent[i], p->context);
+		if (ret == GP_ERROR_NOT_SUPPORTED) {
+			gp_widget_set_changed (sent[i], 1);
+			whole = 1;
+			ret = GP_OK;
+		} else
+			gp_widget_set_changed (sent[i], 0);
 	}
-	gp_widget_free (rootconfig);
+	free (sent);
+	/* Only the marked widgets, the rest of the tree may be stale. */
+	if ((ret == GP_OK) && whole)
+		ret = metered_camera_set_config (p->camera, rootconfig, p->context);
+	if (ret != GP_OK) {
+		gp_context_error (p->context, _("Failed to set %d configuration values."), changed);
+		config_cache_invalidate (p);
+	} else if (diff && !(p->flags & FLAGS_QUIET))
+		printf (_("Changed %d settings, %d already matched, skipped %d read-only and %d unknown.\n"),
+			changed, same, readonly, unknown);
+	return ret;
+}
+
+/*
+ * Split "name=value" and add it to settings. The value is trimmed unless
+ * verbatim is set, for files from --save-config where spaces are part of
+ * the value.
+ */
+static int
+_add_setting (GPParams *p, CameraList *settings, char *assign, int verbatim) {
+	char	*value, *end;
+
+	while (isspace ((unsigned char) *assign))
+		assign++;
+	value = strchr (assign, '=');
+	if (!value) {
+		gp_context_error (p->context, _("Expected NAME=VALUE, got '%s'."), assign);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	for (end = value; (end > assign) && isspace ((unsigned char) end[-1]); end--)
+		;
+	*end = '\0';
+	value++;
+	if (verbatim)
+		return gp_list_append (settings, assign, value);
+	/* "iso = 100" as well as "iso=100" */
+	for (; isspace ((unsigned char) *value); value++)
+		;
+	for (end = value + strlen (value); (end > value) && isspace ((unsigned char) end[-1]); end--)
+		;
+	*end = '\0';
+	return gp_list_append (settings, assign, value);
+}
+
+int
+set_config_list_action (GPParams *p, const char *list) {
+	CameraList	*settings;
+	char		*buf, *assign, *comma;
+	int		ret = GP_OK;
+
+	buf = strdup (list);
+	if (!buf)
+		return GP_ERROR_NO_MEMORY;
+	ret = gp_list_new (&settings);
+	if (ret != GP_OK) {
+		free (buf);
+		return ret;
+	}
+	for (assign = buf; assign && (ret == GP_OK); assign = comma) {
+		comma = strchr (assign, ',');
+		if (comma)
+			*comma++ = '\0';
+		if (*assign)
+			ret = _add_setting (p, settings, assign, 0);
+	}
+	if (ret == GP_OK)
+		ret = _set_config_batch (p, settings, 0);
+	gp_list_free (settings);
+	free (buf);
+	return ret;
+}
+
+/* One NAME=VALUE per line, empty lines and lines starting with # are skipped. */
+static int
+_read_settings_file (GPParams *p, const char *filename, CameraList *settings, int verbatim) {
+	FILE		*f;
+	char		buf[4096];
+	int		ret = GP_OK, len;
+
+	f = fopen (filename, "r");
+	if (!f) {
+		gp_context_error (p->context, _("Could not open '%s': %s"), filename, strerror (errno));
+		return GP_ERROR_FILE_NOT_FOUND;
+	}
+	while ((ret == GP_OK) && fgets (buf, sizeof (buf), f)) {
+		len = strlen (buf);
+		while (len && ((buf[len - 1] == '\n') || (buf[len - 1] == '\r')))
+			buf[--len] = '\0';
+		if (!buf[strspn (buf, " \t")] || (buf[strspn (buf, " \t")] == '#'))
+			continue;
+		ret = _add_setting (p, settings, buf, verbatim);
+	}
+	fclose (f);
+	return ret;
+}
+
+int
+set_config_file_action (GPParams *p, const char *filename) {
+	CameraList	*settings;
+	int		ret;
+
+	ret = gp_list_new (&settings);
+	if (ret != GP_OK)
+		return ret;
+	ret = _read_settings_file (p, filename, settings, 0);
+	if (ret == GP_OK)
+		ret = _set_config_batch (p, settings, 0);
+	gp_list_free (settings);
+	return ret;
+}
+
+int
+load_config_action (GPParams *p, const char *filename) {
+	CameraList	*settings;
+	int		ret;
+
+	ret = gp_list_new (&settings);
+	if (ret != GP_OK)
+		return ret;
+	ret = _read_settings_file (p, filename, settings, 1);
+	if (ret == GP_OK)
+		ret = _set_config_batch (p, settings, 1);
+	gp_list_free (settings);
+	return ret;
+}
+
+/* Write path=value lines, with paths as shown by --list-config. */
+static void
+_save_widgets (FILE *f, CameraWidget *widget, const char *prefix) {
+	const char	*name, *label;
+	char		*newprefix, value[1024];
+	CameraWidget	*child;
+	int		i, n;
+
+	gp_widget_get_name (widget, &name);
+	gp_widget_get_label (widget, &label);
+	newprefix = malloc (strlen (prefix) + 1 + strlen (strlen (name) ? name : label) + 1);
+	if (!newprefix)
+		return;
+	sprintf (newprefix, "%s/%s", prefix, strlen (name) ? name : label);
+
+	if ((_widget_value_string (widget, value, sizeof (value)) == GP_OK) &&
+	    !strchr (value, '\n'))
+		fprintf (f, "%s=%s\n", newprefix, value);
+
+	n = gp_widget_count_children (widget);
+	for (i = 0; i < n; i++)
+		if (gp_widget_get_child (widget, i, &child) == GP_OK)
+			_save_widgets (f, child, newprefix);
+	free (newprefix);
+}
+
+int
+save_config_action (GPParams *p, const char *filename) {
+	CameraWidget	*rootconfig;
+	CameraAbilities	a;
+	FILE		*f;
+	int		ret;
+
+	ret = _config_tree (p, 1, &rootconfig);
+	if (ret != GP_OK)
+		return ret;
+	f = fopen (filename, "w");
+	if (!f) {
+		gp_context_error (p->context, _("Could not open '%s': %s"), filename, strerror (errno));
+		return GP_ERROR_OS_FAILURE;
+	}
+	if (gp_camera_get_abilities (p->camera, &a) == GP_OK)
+		fprintf (f, "# %s\n", a.model);
+	_save_widgets (f, rootconfig, "");
+	if (ferror (f) | fclose (f)) {
+		gp_context_error (p->context, _("Could not write '%s': %s"), filename, strerror (errno));
+		return GP_ERROR_OS_FAILURE;
+	}
+	return GP_OK;
+}
+
+/* Print several comma separated entries from a single fetch of the tree. */
+int
+get_config_list_action (GPParams *p, const char *names) {
+	CameraWidget	*rootconfig, *child;
+	char		*buf, *name, *comma;
+	int		ret;
+
+	buf = strdup (names);
+	if (!buf)
+		return GP_ERROR_NO_MEMORY;
+	ret = _config_tree (p, 1, &rootconfig);
+	if (ret != GP_OK) {
+		free (buf);
+		return ret;
+	}
+	for (name = buf; name && (ret == GP_OK); name = comma) {
+		comma = strchr (name, ',');
+		if (comma)
+			*comma++ = '\0';
+		if (!*name)
+			continue;
+		ret = _find_widget_in_tree (p, name, &child);
+		if (ret == GP_OK)
+			ret = print_widget (p, name, child);
+	}
+	free (buf);
+	return ret;
+}
+
+/* Like _widget_value_string(), but the camera clock is a value too. */
+static int
+_watch_string (CameraWidget *widget, char *buf, size_t size) {
+	CameraWidgetType	type;
+	int			ret, t;
+
+	ret = _widget_value_string (widget, buf, size);
+	if ((ret == GP_ERROR_NOT_SUPPORTED) &&
+	    (gp_widget_get_type (widget, &type) == GP_OK) &&
+	    (type == GP_WIDGET_DATE)) {
+		ret = gp_widget_get_value (widget, &t);
+		if (ret == GP_OK)
+			snprintf (buf, size, "%d", t);
+	}
+	return ret;
+}
+
+/*
+ * Read the current value of name. *single remembers whether the driver
+ * can fetch it on its own (-1 if not known yet), *tree whether the tree
+ * has already been fetched in this round.
+ */
+static int
+_watch_value (GPParams *p, const char *name, int *single, int *tree, char *buf, size_t size) {
+	CameraWidget	*widget;
+	int		ret;
+
+	if (*single) {
+		ret = metered_camera_get_single_config (p->camera, name, &widget, p->context);
+		if (ret == GP_OK) {
+			*single = 1;
+			ret = _watch_string (widget, buf, size);
+			gp_widget_free (widget);
+			return ret;
+		}
+		if (*single == 1)
+			return ret;
+		*single = 0;
+	}
+	ret = _config_tree (p, !*tree, &widget);
+	if (ret != GP_OK)
+		return ret;
+	*tree = 1;
+	/* Reported once by the caller, not every round. */
+	ret = _lookup_config (p, name, &widget);
+	if (ret != GP_OK)
+		return ret;
+	return _watch_string (widget, buf, size);
+}
+
+/*
+ * --watch-config: print "time name=value" for each entry at the start
+ * and whenever it changes, every interval milliseconds. Camera events
+ * often announce a changed property, so they start the next round early.
+ * An entry that can't be read, for example because the camera mode
+ * hides it, is reported once and tried again every round.
+ * Runs until Ctrl-C or SIGUSR2.
+ */
+int
+watch_config_action (GPParams *p, const char *names, int interval) {
+	CameraEventType	type;
+	struct timeval	next, now;
+	struct tm	*tm;
+	char		*buf, **name, **last, value[1024], stamp[32];
+	void		*data;
+	int		*single, *failed, count = 1, i, r, tree, left, ret = GP_OK, attempt = 0;
+
+	buf = strdup (names);
+	if (!buf)
+		return GP_ERROR_NO_MEMORY;
+	for (i = 0; buf[i]; i++)
+		if (buf[i] == ',')
+			count++;
+	name = calloc (count, sizeof (char *));
+	last = calloc (count, sizeof (char *));
+	single = malloc (count * sizeof (int));
+	failed = calloc (count, sizeof (int));
+	if (!name || !last || !single || !failed) {
+		free (buf); free (name); free (last); free (single); free (failed);
+		return GP_ERROR_NO_MEMORY;
+	}
+	for (count = 0, name[0] = strtok (buf, ","); name[count]; name[count] = strtok (NULL, ","))
+		single[count++] = -1;
+
+	end_next = 0;
+	while (!glob_cancel && !end_next) {
+		gettimeofday (&next, NULL);
+		next.tv_sec += interval / 1000;
+		next.tv_usec += (interval % 1000) * 1000;
+		if (next.tv_usec >= 1000000) {
+			next.tv_sec++;
+			next.tv_usec -= 1000000;
+		}
+
+		for (i = 0, tree = 0; (i < count) && (ret == GP_OK); i++) {
+			r = _watch_value (p, name[i], &single[i], &tree, value, sizeof (value));
+			/* Only a lost connection stops the round. */
+			if ((r != GP_OK) && reconnect_is_io_error (r)) {
+				ret = r;
+				break;
+			}
+			if (r != GP_OK) {
+				if (!failed[i])
+					gp_context_error (p->context, _("Could not read %s: %s"),
+							  name[i], gp_result_as_string (r));
+				failed[i] = 1;
+				/* Print it again once it is back. */
+				free (last[i]);
+				last[i] = NULL;
+				continue;
+			}
+			failed[i] = 0;
+			if (last[i] && !strcmp (last[i], value))
+				continue;
+			gettimeofday (&now, NULL);
+			tm = localtime (&now.tv_sec);
+			strftime (stamp, sizeof (stamp), "%Y-%m-%dT%H:%M:%S", tm);
+			/* parsed by scripts, no i18n */
+			printf ("%s.%03d %s=%s\n", stamp, (int) (now.tv_usec / 1000), name[i], value);
+			free (last[i]);
+			last[i] = strdup (value);
+		}
+		fflush (stdout);
+
+		/* Wait for the next round, or for the camera to tell us something. */
+		while ((ret == GP_OK) && !glob_cancel && !end_next) {
+			gettimeofday (&now, NULL);
+			left = (next.tv_sec - now.tv_sec) * 1000 + (next.tv_usec - now.tv_usec) / 1000;
+			if (left <= 0)
+				break;
+			data = NULL;
+			ret = metered_camera_wait_for_event (p->camera, left, &type, &data, p->context);
+			if (ret == GP_ERROR_NOT_SUPPORTED) {
+				usleep (left * 1000);
+				ret = GP_OK;
+				break;
+			}
+			free (data);
+			if ((ret != GP_OK) || (type != GP_EVENT_TIMEOUT))
+				break;
+		}
+		if (ret != GP_OK) {
+			if (!reconnect_retry (p, ret, &attempt))
+				break;
+			ret = GP_OK;
+			continue;
+		}
+		attempt = 0;
+	}
+
+	for (i = 0; i < count; i++)
+		free (last[i]);
+	free (last);
+	free (single);
+	free (failed);
+	free (name);
+	free (buf);
 	return ret;
 }
 
@@ -2004,20 +2967,16 @@ set_config_index_action (GPParams *p, const char *name, const char *value) {
 	const char *label;
 	CameraWidgetType	type;
 
-	ret = _find_widget_by_name (p, name, &child, &rootconfig);
+	ret = _find_widget_by_name (p, name, 0, &child, &rootconfig);
 	if (ret != GP_OK)
 		return ret;
 
 	ret = gp_widget_get_type (child, &type);
-	if (ret != GP_OK) {
-		gp_widget_free (rootconfig);
+	if (ret != GP_OK)
 		return ret;
-	}
 	ret = gp_widget_get_label (child, &label);
-	if (ret != GP_OK) {
-		gp_widget_free (rootconfig);
+	if (ret != GP_OK)
 		return ret;
-	}
 
 	switch (type) {
 	case GP_WIDGET_MENU:
@@ -2056,15 +3015,10 @@ set_config_index_action (GPParams *p, const char *name, const char *value) {
 		ret = GP_ERROR_BAD_PARAMETERS;
 		break;
 	}
-	if (ret == GP_OK) {
-		if (child == rootconfig)
-			ret = gp_camera_set_single_config (p->camera, name, child, p->context);
-		else
-			ret = gp_camera_set_config (p->camera, rootconfig, p->context);
-		if (ret != GP_OK)
-			gp_context_error (p->context, _("Failed to set new configuration value %s for configuration entry %s."), value, name);
-	}
-	gp_widget_free (rootconfig);
+	if (ret == GP_OK)
+		ret = _send_config (p, name, value, child, rootconfig);
+	if (ret != GP_OK)
+		config_cache_invalidate (p);
 	return ret;
 }
 
@@ -2075,15 +3029,13 @@ set_config_value_action (GPParams *p, const char *name, const char *value) {
 	int	ret;
 	CameraWidgetType	type;
 
-	ret = _find_widget_by_name (p, name, &child, &rootconfig);
+	ret = _find_widget_by_name (p, name, 0, &child, &rootconfig);
 	if (ret != GP_OK)
 		return ret;
 
 	ret = gp_widget_get_type (child, &type);
-	if (ret != GP_OK) {
-		gp_widget_free (rootconfig);
+	if (ret != GP_OK)
 		return ret;
-	}
 
 	switch (type) {
 	case GP_WIDGET_TEXT: {		/* char *		*/
@@ -2116,19 +3068,7 @@ set_config_value_action (GPParams *p, const char *name, const char *value) {
 	case GP_WIDGET_TOGGLE: {	/* int		*/
 		int	t;
 
-		t = 2;
-		if (	!strcasecmp (value, "off")	|| !strcasecmp (value, "no")	||
-			!strcasecmp (value, "false")	|| !strcmp (value, "0")		||
-			!strcasecmp (value, _("off"))	|| !strcasecmp (value, _("no"))	||
-			!strcasecmp (value, _("false"))
-		)
-			t = 0;
-		if (	!strcasecmp (value, "on")	|| !strcasecmp (value, "yes")	||
-			!strcasecmp (value, "true")	|| !strcmp (value, "1")		||
-			!strcasecmp (value, _("on"))	|| !strcasecmp (value, _("yes"))	||
-			!strcasecmp (value, _("true"))
-		)
-			t = 1;
+		t = _parse_toggle (value);
 		/*fprintf (stderr," value %s, t %d\n", value, t);*/
 		if (t == 2) {
 			gp_context_error (p->context, _("The passed value %s is not a valid toggle value."), value);
@@ -2201,15 +3141,10 @@ set_config_value_action (GPParams *p, const char *name, const char *value) {
 		ret = GP_ERROR_BAD_PARAMETERS;
 		break;
 	}
-	if (ret == GP_OK) {
-		if (child == rootconfig)
-			ret = gp_camera_set_single_config (p->camera, name, child, p->context);
-		else
-			ret = gp_camera_set_config (p->camera, rootconfig, p->context);
-		if (ret != GP_OK)
-			gp_context_error (p->context, _("Failed to set new configuration value %s for configuration entry %s."), value, name);
-	}
-	gp_widget_free (rootconfig);
+	if (ret == GP_OK)
+		ret = _send_config (p, name, value, child, rootconfig);
+	if (ret != GP_OK)
+		config_cache_invalidate (p);
 	return ret;
 }
 
@@ -58,6 +58,10 @@ int save_exif_action      (GPParams *, const char *folder, const char *filename)
 int save_meta_action      (GPParams *, const char *folder, const char *filename);
 int delete_file_action    (GPParams *, const char *folder, const char *filename);
 
+/* --move: delete verified downloads in batches */
+int move_queue_add        (GPParams *, const char *folder, const char *filename);
+int move_queue_flush      (GPParams *, int all);
+
 /* Folder actions */
 typedef int FolderAction  (GPParams *);
 int delete_all_action     (GPParams *);
@@ -78,7 +82,7 @@ int action_camera_upload_file     (GPParams *, const char *folder,
 int action_camera_upload_metadata (GPParams *, const char *folder,
 				   const char *path);
 int action_camera_capture_preview (GPParams *);
-int action_camera_show_preview    (GPParams *);
+int action_camera_show_preview    (GPParams *, const char *mode);
 int action_camera_capture_movie   (GPParams *, const char *arg);
 int action_camera_wait_event      (GPParams *, enum download_type dt, const char*args);
 
@@ -98,8 +102,20 @@ int get_config_action      (GPParams *, const char *name);
 int set_config_action      (GPParams *, const char *name, const char *value);
 int set_config_index_action      (GPParams *, const char *name, const char *value);
 int set_config_value_action      (GPParams *, const char *name, const char *value);
+int set_config_list_action       (GPParams *, const char *list);
+int set_config_file_action       (GPParams *, const char *filename);
+int get_config_list_action       (GPParams *, const char *names);
+int save_config_action           (GPParams *, const char *filename);
+int load_config_action           (GPParams *, const char *filename);
+int watch_config_action          (GPParams *, const char *names, int interval);
 int print_storage_info     (GPParams *);
 
+/* Forget the configuration widgets kept for this session */
+void config_cache_invalidate (GPParams *);
+void config_cache_free       (GPParams *);
+/* The session copy of a widget, valid until the next config action */
+int  config_cache_widget     (GPParams *, const char *name, CameraWidget **widget);
+
 void _get_portinfo_list	(GPParams *p);
 
 #endif /* !defined(GPHOTO2_ACTIONS_H) */
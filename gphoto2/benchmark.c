@@ -0,0 +1,359 @@
+/* benchmark.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "benchmark.h"
+#include "globals.h"
+#include "i18n.h"
+#include "main.h"
+#include "metrics.h"
+#include "reconnect.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+#include <gphoto2/gphoto2-port-log.h>
+
+#define CR(result) {int r = (result); if (r < 0) return (r);}
+
+#define BENCHMARK_FRAMES	100
+#define BENCHMARK_BUSY_TRIES	20	/* in a row, as for the live view */
+
+typedef struct {
+	double		camera, local;	/* seconds */
+	unsigned long	size;
+} BenchmarkFrame;
+
+/* What is reported of a distribution. */
+typedef struct {
+	double	min, p50, p90, p95, p99, max, mean;
+} BenchmarkSummary;
+
+typedef struct {
+	BenchmarkFrame		first;
+	BenchmarkFrame		*frame;	/* after the first */
+	size_t			frames, alloc;
+	double			seconds;
+	unsigned int		busy, errors;
+	BenchmarkSummary	total, camera, local, size;
+} Benchmark;
+
+static double
+benchmark_now (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+int
+benchmark_set_json (GPParams *p, const char *filename)
+{
+	free (p->benchmark_json);
+	p->benchmark_json = strdup (filename);
+	return p->benchmark_json ? GP_OK : GP_ERROR_NO_MEMORY;
+}
+
+/* One frame: the camera call, and what we do with its result. */
+static int
+benchmark_frame (GPParams *p, BenchmarkFrame *frame)
+{
+	CameraFile	*file;
+	const char	*data;
+	double		start, called;
+	int		r;
+
+	start = benchmark_now ();
+	CR (gp_file_new (&file));
+	called = benchmark_now ();
+	r = metered_camera_capture_preview (p->camera, file, p->context);
+	frame->camera = benchmark_now () - called;
+	if (r == GP_OK)
+		r = gp_file_get_data_and_size (file, &data, &frame->size);
+	if (r == GP_OK)
+		metrics_bytes (METRIC_CAPTURE_PREVIEW, frame->size);
+	gp_file_unref (file);
+	frame->local = benchmark_now () - start - frame->camera;
+	return r;
+}
+
+static int
+benchmark_add (Benchmark *b, const BenchmarkFrame *frame)
+{
+	BenchmarkFrame *f;
+
+	if (b->frames == b->alloc) {
+		size_t n = b->alloc ? 2 * b->alloc : 256;
+
+		f = realloc (b->frame, n * sizeof (BenchmarkFrame));
+		if (!f)
+			return GP_ERROR_NO_MEMORY;
+		b->frame = f;
+		b->alloc = n;
+	}
+	b->frame[b->frames++] = *frame;
+	return GP_OK;
+}
+
+static int
+benchmark_cmp (const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+/* Nearest rank of sorted values. */
+static double
+benchmark_rank (const double *v, size_t n, double q)
+{
+	size_t rank = (size_t) (q * n + 0.999999);
+
+	return v[(rank < 1) ? 0 : rank - 1];
+}
+
+static void
+benchmark_summarize (double *v, size_t n, BenchmarkSummary *s)
+{
+	double	sum = 0.;
+	size_t	i;
+
+	memset (s, 0, sizeof (*s));
+	if (!n)
+		return;
+	qsort (v, n, sizeof (double), benchmark_cmp);
+	for (i = 0; i < n; i++)
+		sum += v[i];
+	s->min  = v[0];
+	s->p50  = benchmark_rank (v, n, .5);
+	s->p90  = benchmark_rank (v, n, .9);
+	s->p95  = benchmark_rank (v, n, .95);
+	s->p99  = benchmark_rank (v, n, .99);
+	s->max  = v[n - 1];
+	s->mean = sum / n;
+}
+
+static int
+benchmark_summarize_all (Benchmark *b)
+{
+	double	*v;
+	size_t	i;
+
+	v = malloc ((b->frames + 1) * sizeof (double));
+	if (!v)
+		return GP_ERROR_NO_MEMORY;
+	for (i = 0; i < b->frames; i++)
+		v[i] = b->frame[i].camera + b->frame[i].local;
+	benchmark_summarize (v, b->frames, &b->total);
+	for (i = 0; i < b->frames; i++)
+		v[i] = b->frame[i].camera;
+	benchmark_summarize (v, b->frames, &b->camera);
+	for (i = 0; i < b->frames; i++)
+		v[i] = b->frame[i].local;
+	benchmark_summarize (v, b->frames, &b->local);
+	for (i = 0; i < b->frames; i++)
+		v[i] = b->frame[i].size;
+	benchmark_summarize (v, b->frames, &b->size);
+	free (v);
+	return GP_OK;
+}
+
+static double
+benchmark_fps (const Benchmark *b)
+{
+	return (b->seconds > 0.) ? b->frames / b->seconds : 0.;
+}
+
+static double
+benchmark_camera_share (const Benchmark *b)
+{
+	double all = b->total.mean;
+
+	return (all > 0.) ? b->camera.mean / all : 0.;
+}
+
+static void
+benchmark_print_row (const char *name, const BenchmarkSummary *s, double unit)
+{
+	printf ("  %-10s %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f %8.2f\n", name,
+		s->min * unit, s->p50 * unit, s->p90 * unit, s->p95 * unit,
+		s->p99 * unit, s->max * unit, s->mean * unit);
+}
+
+static void
+benchmark_print (const Benchmark *b)
+{
+	printf (_("Preview benchmark: %lu frames in %.2f s, %.2f fps, first frame %.1f ms\n"),
+		(unsigned long) b->frames, b->seconds, benchmark_fps (b),
+		(b->first.camera + b->first.local) * 1e3);
+	if (!b->frames)
+		return;
+	printf ("  %-10s %8s %8s %8s %8s %8s %8s %8s\n", "", "min", "p50",
+		"p90", "p95", "p99", "max", "mean");
+	benchmark_print_row ("frame ms", &b->total, 1e3);
+	benchmark_print_row ("camera ms", &b->camera, 1e3);
+	benchmark_print_row ("local ms", &b->local, 1e3);
+	benchmark_print_row ("size KiB", &b->size, 1. / 1024);
+	printf (_("Camera call %.1f%% of the time, local handling %.1f%%, %u busy retries, %u errors.\n"),
+		benchmark_camera_share (b) * 100,
+		(1. - benchmark_camera_share (b)) * 100, b->busy, b->errors);
+}
+
+static void
+benchmark_json_summary (FILE *f, const char *name, const BenchmarkSummary *s,
+			const char *sep)
+{
+	fprintf (f, "  \"%s\": {\"min\": %.6f, \"p50\": %.6f, \"p90\": %.6f, "
+		 "\"p95\": %.6f, \"p99\": %.6f, \"max\": %.6f, \"mean\": %.6f}%s\n",
+		 name, s->min, s->p50, s->p90, s->p95, s->p99, s->max, s->mean,
+		 sep);
+}
+
+static int
+benchmark_write_json (const Benchmark *b, const char *filename)
+{
+	FILE	*f;
+
+	if (!strcmp (filename, "-"))
+		f = stdout;
+	else if (!(f = fopen (filename, "w"))) {
+		cli_error_print (_("Could not open benchmark file '%s': %s"),
+				 filename, strerror (errno));
+		return GP_ERROR_FILE_NOT_FOUND;
+	}
+	fprintf (f, "{\n  \"frames\": %lu,\n  \"seconds\": %.6f,\n"
+		 "  \"fps\": %.3f,\n  \"busy\": %u,\n  \"errors\": %u,\n"
+		 "  \"camera_share\": %.4f,\n"
+		 "  \"first_frame\": {\"camera\": %.6f, \"local\": %.6f, \"size\": %lu},\n",
+		 (unsigned long) b->frames, b->seconds, benchmark_fps (b),
+		 b->busy, b->errors, benchmark_camera_share (b),
+		 b->first.camera, b->first.local, b->first.size);
+	benchmark_json_summary (f, "frame", &b->total, ",");
+	benchmark_json_summary (f, "camera", &b->camera, ",");
+	benchmark_json_summary (f, "local", &b->local, ",");
+	benchmark_json_summary (f, "size", &b->size, "");
+	fprintf (f, "}\n");
+	if (f == stdout)
+		return (fflush (f) == EOF) ? GP_ERROR_OS_FAILURE : GP_OK;
+	if (ferror (f) | fclose (f)) {
+		cli_error_print (_("Could not write benchmark file '%s'."), filename);
+		return GP_ERROR_OS_FAILURE;
+	}
+	return GP_OK;
+}
+
+int
+benchmark_preview (GPParams *p, const char *arg)
+{
+	Benchmark	b;
+	BenchmarkFrame	frame;
+	double		start = 0., seconds = 0.;
+	int		r = GP_OK, count = BENCHMARK_FRAMES, busy = 0, attempt = 0;
+
+	if (arg && strchr (arg, 's')) {
+		if ((sscanf (arg, "%lfs", &seconds) != 1) || (seconds <= 0.)) {
+			cli_error_print (_("Invalid benchmark duration '%s'."), arg);
+			return GP_ERROR_BAD_PARAMETERS;
+		}
+		count = 0;
+	} else if (arg && ((sscanf (arg, "%d", &count) != 1) || (count < 1))) {
+		cli_error_print (_("Invalid benchmark frame count '%s'."), arg);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	memset (&b, 0, sizeof (b));
+	if (!(p->flags & FLAGS_QUIET)) {
+		if (count)
+			fprintf (stderr, _("Benchmarking %d preview frames.\n"), count);
+		else
+			fprintf (stderr, _("Benchmarking preview frames for %g seconds.\n"), seconds);
+	}
+
+	/* The first frame starts the clock. */
+	while (!glob_cancel && !end_next) {
+		memset (&frame, 0, sizeof (frame));
+		r = benchmark_frame (p, &frame);
+		if (r == GP_OK) {
+			busy = attempt = 0;
+			if (!start) {
+				b.first = frame;
+				start = benchmark_now ();
+				continue;
+			}
+			r = benchmark_add (&b, &frame);
+			if (r != GP_OK)
+				break;
+			b.seconds = benchmark_now () - start;
+			if (count && (b.frames >= (size_t) count))
+				break;
+			if (!count && (b.seconds >= seconds))
+				break;
+			continue;
+		}
+		if ((r == GP_ERROR_CAMERA_BUSY) && (busy++ < BENCHMARK_BUSY_TRIES)) {
+			b.busy++;
+			continue;
+		}
+		b.errors++;
+		if (!reconnect_retry (p, r, &attempt))
+			break;
+	}
+	if (r != GP_OK)
+		cli_error_print (_("Could not capture preview."));
+	else if (end_next) {
+		end_next = 0;
+		fprintf (stderr, _("SIGUSR2 signal received, stopping benchmark!\n"));
+	}
+
+	if (start) {
+		if (benchmark_summarize_all (&b) != GP_OK)
+			r = GP_ERROR_NO_MEMORY;
+		else {
+			if (!p->benchmark_json || strcmp (p->benchmark_json, "-"))
+				benchmark_print (&b);
+			if (p->benchmark_json &&
+			    (benchmark_write_json (&b, p->benchmark_json) != GP_OK) &&
+			    (r == GP_OK))
+				r = GP_ERROR_OS_FAILURE;
+		}
+	}
+	free (b.frame);
+	return r;
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
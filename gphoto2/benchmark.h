@@ -0,0 +1,53 @@
+/* benchmark.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_BENCHMARK_H
+#define GPHOTO2_BENCHMARK_H
+
+#include <gp-params.h>
+
+/*
+ * --benchmark-preview[=COUNT or SECONDSs] captures preview frames back
+ * to back on the calling thread, 100 frames by default, and reports the
+ * frame rate, the min, percentiles, max and mean of the time per frame,
+ * of its camera call and of the local handling around it (the
+ * CameraFile and its data), and of the frame sizes.
+ *
+ * The first frame often switches on the live view and takes much
+ * longer, so it is reported on its own and not counted. Busy cameras
+ * are retried and counted, like reconnects with --reconnect.
+ *
+ * --benchmark-json FILE writes the results as JSON as well, "-" for
+ * standard output instead of the table.
+ */
+
+/* --benchmark-json FILE */
+int benchmark_set_json (GPParams *p, const char *filename);
+
+/* --benchmark-preview */
+int benchmark_preview  (GPParams *p, const char *arg);
+
+#endif /* !defined(GPHOTO2_BENCHMARK_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,320 @@
+/* capstats.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "capstats.h"
+#include "i18n.h"
+#include "main.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+#include <gphoto2/gphoto2-port-log.h>
+
+static const char *const capstats_names[CAPSTATS_COUNT] = {
+	"capture", "added", "download", "delete", "hook"
+};
+
+/* The file whose stages are being timed, -1 for those not (yet) seen. */
+typedef struct {
+	int		open;
+	int		frame;
+	CameraFilePath	path;
+	double		stage[CAPSTATS_COUNT];
+} CapStatsFile;
+
+/* Only the main thread captures, so there is no lock. */
+static struct {
+	int		enabled;
+	FILE		*csv;
+	int		frame, files;
+	int		counted;	/* the frame has a file */
+	double		trigger;	/* 0 if the frame was not triggered */
+	double		captured;	/* 0 until the capture call returned */
+	double		capture;	/* its stage, -1 once given to a file */
+	CameraFilePath	named;		/* the file the capture call named */
+	CapStatsFile	cur;
+	double		*value[CAPSTATS_COUNT];
+	size_t		count[CAPSTATS_COUNT], alloc[CAPSTATS_COUNT];
+} capstats;
+
+static double
+capstats_now (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+static void
+capstats_add (CapStatsStage stage, double value)
+{
+	double *v;
+
+	if (capstats.count[stage] == capstats.alloc[stage]) {
+		size_t n = capstats.alloc[stage] ? 2 * capstats.alloc[stage] : 64;
+
+		v = realloc (capstats.value[stage], n * sizeof (double));
+		if (!v)
+			return;
+		capstats.value[stage] = v;
+		capstats.alloc[stage] = n;
+	}
+	capstats.value[stage][capstats.count[stage]++] = value;
+}
+
+/* A CSV field, quoted because file names may contain anything. */
+static void
+capstats_csv_name (FILE *f, const CameraFilePath *path)
+{
+	const char *s;
+
+	fputc ('"', f);
+	for (s = path->folder; *s; s++) {
+		if (*s == '"')
+			fputc ('"', f);
+		fputc (*s, f);
+	}
+	if (strcmp (path->folder, "/"))
+		fputc ('/', f);
+	for (s = path->name; *s; s++) {
+		if (*s == '"')
+			fputc ('"', f);
+		fputc (*s, f);
+	}
+	fputc ('"', f);
+}
+
+/* The current file is done, counts its stages. */
+static void
+capstats_close (void)
+{
+	CapStatsFile	*cur = &capstats.cur;
+	double		total = 0.;
+	int		i;
+
+	if (!cur->open)
+		return;
+	cur->open = 0;
+	for (i = 0; i < CAPSTATS_COUNT; i++)
+		if (cur->stage[i] >= 0.) {
+			capstats_add (i, cur->stage[i]);
+			total += cur->stage[i];
+		}
+	if (!capstats.csv)
+		return;
+	fprintf (capstats.csv, "%d,", cur->frame);
+	capstats_csv_name (capstats.csv, &cur->path);
+	for (i = 0; i < CAPSTATS_COUNT; i++)
+		if (cur->stage[i] >= 0.)
+			fprintf (capstats.csv, ",%.6f", cur->stage[i]);
+		else
+			fputc (',', capstats.csv);
+	fprintf (capstats.csv, ",%.6f\n", total);
+	fflush (capstats.csv);
+}
+
+static void
+capstats_exit (void)
+{
+	capstats_close ();
+	if (ferror (capstats.csv) | fclose (capstats.csv))
+		fprintf (stderr, _("Could not write the capture stats file.\n"));
+	capstats.csv = NULL;
+}
+
+int
+capstats_enable (const char *csvname)
+{
+	int i;
+
+	capstats.enabled = 1;
+	if (!csvname)
+		return GP_OK;
+	if (capstats.csv) {
+		cli_error_print (_("Only one capture stats file can be written."));
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	capstats.csv = fopen (csvname, "w");
+	if (!capstats.csv) {
+		cli_error_print (_("Could not open capture stats file '%s': %s"),
+				 csvname, strerror (errno));
+		return GP_ERROR_FILE_NOT_FOUND;
+	}
+	fputs ("frame,file", capstats.csv);
+	for (i = 0; i < CAPSTATS_COUNT; i++)
+		fprintf (capstats.csv, ",%s", capstats_names[i]);
+	fputs (",total\n", capstats.csv);
+	atexit (capstats_exit);
+	return GP_OK;
+}
+
+double
+capstats_begin (void)
+{
+	return capstats.enabled ? capstats_now () : 0.;
+}
+
+void
+capstats_trigger (double start)
+{
+	if (!start)
+		return;
+	capstats_close ();
+	capstats.counted = 0;
+	capstats.trigger = start;
+	capstats.captured = 0.;
+	capstats.capture = -1.;
+	memset (&capstats.named, 0, sizeof (capstats.named));
+}
+
+void
+capstats_captured (const CameraFilePath *path)
+{
+	if (!capstats.enabled || !capstats.trigger)
+		return;
+	capstats.captured = capstats_now ();
+	capstats.capture = capstats.captured - capstats.trigger;
+	if (path)
+		capstats.named = *path;
+}
+
+void
+capstats_file (const CameraFilePath *path)
+{
+	CapStatsFile	*cur = &capstats.cur;
+	int		i;
+
+	if (!capstats.enabled)
+		return;
+	capstats_close ();
+	/* Files the camera took on its own are frames of their own, the
+	 * ones after the capture's (RAW+JPEG) belong to its frame. */
+	if (!capstats.captured || !capstats.counted)
+		capstats.frame++;
+	capstats.counted = 1;
+	capstats.files++;
+	cur->open = 1;
+	cur->frame = capstats.frame;
+	cur->path = *path;
+	for (i = 0; i < CAPSTATS_COUNT; i++)
+		cur->stage[i] = -1.;
+	if (!capstats.captured)
+		return;
+	cur->stage[CAPSTATS_CAPTURE] = capstats.capture;
+	capstats.capture = -1.;
+	if (strcmp (path->name, capstats.named.name) ||
+	    strcmp (path->folder, capstats.named.folder))
+		cur->stage[CAPSTATS_ADDED] = capstats_now () - capstats.captured;
+}
+
+void
+capstats_stage (CapStatsStage stage, double start)
+{
+	CapStatsFile	*cur = &capstats.cur;
+	double		d;
+
+	if (!cur->open || !start)
+		return;
+	d = capstats_now () - start;
+	/* The hook runs at the end of the download. */
+	if ((stage == CAPSTATS_DOWNLOAD) && (cur->stage[CAPSTATS_HOOK] > 0.))
+		d -= cur->stage[CAPSTATS_HOOK];
+	if (d < 0.)
+		d = 0.;
+	cur->stage[stage] = (cur->stage[stage] < 0.) ? d : cur->stage[stage] + d;
+}
+
+static int
+capstats_cmp (const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x < y) ? -1 : (x > y);
+}
+
+/* Nearest rank of sorted values. */
+static double
+capstats_percentile (const double *v, size_t n, double q)
+{
+	size_t rank = (size_t) (q * n + 0.999999);
+
+	if (rank < 1)
+		rank = 1;
+	return v[rank - 1];
+}
+
+void
+capstats_report (void)
+{
+	double	*v;
+	size_t	n = 0;
+	int	i;
+
+	if (!capstats.enabled)
+		return;
+	capstats_close ();
+	for (i = 0; i < CAPSTATS_COUNT; i++)
+		n += capstats.count[i];
+	if (n) {
+		printf (_("Capture stats of %d files in %d frames, in seconds:\n"),
+			capstats.files, capstats.frame);
+		printf ("  %-10s %6s %9s %9s %9s %9s\n", "", "count",
+			"p50", "p95", "p99", "max");
+	}
+	for (i = 0; i < CAPSTATS_COUNT; i++) {
+		v = capstats.value[i];
+		n = capstats.count[i];
+		if (n) {
+			qsort (v, n, sizeof (double), capstats_cmp);
+			printf ("  %-10s %6lu %9.3f %9.3f %9.3f %9.3f\n",
+				capstats_names[i], (unsigned long) n,
+				capstats_percentile (v, n, .5),
+				capstats_percentile (v, n, .95),
+				capstats_percentile (v, n, .99), v[n - 1]);
+		}
+		free (v);
+		capstats.value[i] = NULL;
+		capstats.count[i] = capstats.alloc[i] = 0;
+	}
+	capstats.frame = capstats.files = 0;
+	capstats.trigger = capstats.captured = 0.;
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,82 @@
+/* capstats.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_CAPSTATS_H
+#define GPHOTO2_CAPSTATS_H
+
+#include <gphoto2/gphoto2-file.h>
+
+/*
+ * --capture-stats times the stages of every file of --capture-image,
+ * time-lapses and --wait-event, and prints p50, p95, p99 and max of
+ * each stage when the capture ends:
+ *
+ *   capture   from the trigger until gp_camera_capture() returns; in
+ *             bulb mode until the shutter is closed
+ *   added     from then until the camera reports GP_EVENT_FILE_ADDED
+ *   download  getting the file and writing it, without the hook
+ *   delete    deleting it from the camera
+ *   hook      the download hook
+ *
+ * A stage that did not happen for a file is left out: gp_camera_capture()
+ * names its file itself, --keep does not delete, files the camera took
+ * on its own have no trigger and --move deletes in batches later.
+ *
+ * --capture-stats-csv FILE also writes one line per file, as soon as
+ * the next one comes in.
+ */
+
+typedef enum {
+	CAPSTATS_CAPTURE,
+	CAPSTATS_ADDED,
+	CAPSTATS_DOWNLOAD,
+	CAPSTATS_DELETE,
+	CAPSTATS_HOOK,
+	CAPSTATS_COUNT
+} CapStatsStage;
+
+/* --capture-stats, and --capture-stats-csv FILE with a filename */
+int    capstats_enable (const char *csvname);
+
+/* Start of a stage, 0 if the stats are off. */
+double capstats_begin (void);
+
+/* A frame is triggered, start is from capstats_begin() before it. */
+void   capstats_trigger (double start);
+
+/* The capture call returned, with path if it named the file. */
+void   capstats_captured (const CameraFilePath *path);
+
+/* The file comes in; the stages after it are counted for it. */
+void   capstats_file (const CameraFilePath *path);
+
+/* The download, delete or hook stage from start until now. */
+void   capstats_stage (CapStatsStage stage, double start);
+
+/* Prints the percentiles of the capture and starts over. */
+void   capstats_report (void);
+
+#endif /* !defined(GPHOTO2_CAPSTATS_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
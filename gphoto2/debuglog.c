@@ -0,0 +1,576 @@
+/* debuglog.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "debuglog.h"
+#include "i18n.h"
+#include "main.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+/* The loggers only need atomics, the writer is a thread. */
+#if defined (HAVE_PTHREAD) && defined (__ATOMIC_ACQUIRE)
+# define DEBUGLOG_BINARY 1
+# include <fcntl.h>
+# include <poll.h>
+# include <pthread.h>
+#endif
+
+#include <gphoto2/gphoto2-port-log.h>
+
+#ifndef MIN
+#define MIN(x, y) (((x)<(y))?(x):(y))
+#endif
+
+#define DEBUGLOG_MAX_DOMAINS	32
+#define DEBUGLOG_RING		(4 * 1024 * 1024)	/* a power of two */
+#define DEBUGLOG_MAX_TEXT	(64 * 1024)	/* longer messages are cut */
+#define DEBUGLOG_BUFFER		(256 * 1024)	/* written at once */
+#define DEBUGLOG_PERIOD		200		/* ms between writes */
+#define DEBUGLOG_SIZE		(64 * 1024 * 1024)
+#define DEBUGLOG_PAD		0xffff		/* level of the filler at the end of the ring */
+#define DEBUGLOG_ALIGN(n)	(((n) + 7) & ~(size_t) 7)
+
+typedef struct {
+	char		*name;
+	size_t		len;
+	int		prefix;		/* ended in '*' */
+	GPLogLevel	level;
+} DebugLogDomain;
+
+static struct {
+	DebugLogDomain	domain[DEBUGLOG_MAX_DOMAINS];
+	int		domains;
+	GPLogLevel	level;		/* of the other domains */
+	int		other;		/* "*" was given */
+} filter;
+
+static int
+debuglog_level (const char *name, size_t len, GPLogLevel *level)
+{
+	static const struct {
+		const char	*name;
+		GPLogLevel	level;
+	} levels[] = {
+		{"error", GP_LOG_ERROR},
+		{"verbose", GP_LOG_VERBOSE},
+		{"debug", GP_LOG_DEBUG},
+		{"data", GP_LOG_DATA},
+		{"all", GP_LOG_ALL},
+	};
+	unsigned int i;
+
+	for (i = 0; i < sizeof (levels) / sizeof (levels[0]); i++)
+		if ((strlen (levels[i].name) == len) &&
+		    !strncmp (levels[i].name, name, len)) {
+			*level = levels[i].level;
+			return GP_OK;
+		}
+	return GP_ERROR_BAD_PARAMETERS;
+}
+
+int
+debuglog_set_domains (const char *spec)
+{
+	const char	*s = spec, *eq, *end;
+	DebugLogDomain	*d;
+
+	while (*s) {
+		end = strchr (s, ',');
+		if (!end)
+			end = s + strlen (s);
+		eq = memchr (s, '=', end - s);
+		if (!eq || (eq == s) || (filter.domains == DEBUGLOG_MAX_DOMAINS))
+			goto bad;
+		if ((eq - s == 1) && (*s == '*')) {
+			if (debuglog_level (eq + 1, end - eq - 1, &filter.level) != GP_OK)
+				goto bad;
+			filter.other = 1;
+		} else {
+			d = &filter.domain[filter.domains];
+			if (debuglog_level (eq + 1, end - eq - 1, &d->level) != GP_OK)
+				goto bad;
+			d->prefix = (eq[-1] == '*');
+			d->len = eq - s - d->prefix;
+			d->name = malloc (d->len + 1);
+			if (!d->name)
+				return GP_ERROR_NO_MEMORY;
+			memcpy (d->name, s, d->len);
+			d->name[d->len] = '\0';
+			filter.domains++;
+		}
+		s = *end ? end + 1 : end;
+	}
+	return GP_OK;
+
+bad:
+	cli_error_print (_("Invalid debug domains '%s', use e.g. "
+			   "'ptp2=data,libusb1=debug,*=error'."), spec);
+	return GP_ERROR_BAD_PARAMETERS;
+}
+
+GPLogLevel
+debuglog_set_level (GPLogLevel level)
+{
+	int i;
+
+	if (!filter.other)
+		filter.level = level;
+	level = filter.level;
+	for (i = 0; i < filter.domains; i++)
+		if (filter.domain[i].level > level)
+			level = filter.domain[i].level;
+	return level;
+}
+
+int
+debuglog_wanted (GPLogLevel level, const char *domain)
+{
+	DebugLogDomain	*d, *best = NULL;
+	int		i;
+
+	if (!filter.domains)
+		return level <= filter.level;
+	for (i = 0; i < filter.domains; i++) {
+		d = &filter.domain[i];
+		if (strncmp (domain, d->name, d->len))
+			continue;
+		if (!d->prefix && domain[d->len] && (domain[d->len] != '/'))
+			continue;
+		if (!best || (d->len > best->len))
+			best = d;
+	}
+	return level <= (best ? best->level : filter.level);
+}
+
+/* Microseconds on a clock that does not jump with the wall clock. */
+static uint64_t
+debuglog_usec (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+#else
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+#endif
+}
+
+#ifdef DEBUGLOG_BINARY
+
+/*
+ * The loggers reserve space in the ring by moving head on, fill in
+ * their record and set its size last. The writer takes records from
+ * tail on as long as their size is set, zeroes them and moves tail
+ * on. A record that does not fit before the end of the ring is put at
+ * its start, after a filler.
+ */
+static struct {
+	unsigned char	*ring;
+	size_t		head, tail;	/* in bytes since the start */
+	unsigned long	dropped;
+	int		kicked;		/* the writer was woken up */
+	int		wake[2];
+	int		closing;
+	pthread_t	thread;
+
+	/* Only the writer touches these after debuglog_open(). */
+	char		*name;
+	int		fd;		/* -1 after a write error */
+	uint64_t	max, written;
+	uint64_t	start, wall;	/* monotonic and since the epoch */
+	unsigned char	*out;
+	size_t		outlen;
+} binlog;
+
+static void
+debuglog_kick (void)
+{
+	ssize_t r;
+
+	if (__atomic_exchange_n (&binlog.kicked, 1, __ATOMIC_ACQ_REL))
+		return;
+	r = write (binlog.wake[1], "", 1);
+	(void) r; /* A full pipe wakes it up as well. */
+}
+
+void
+debuglog_log (GPLogLevel level, const char *domain, const char *str,
+	      void *data)
+{
+	DebugLogRecord	*r;
+	size_t		dlen, tlen, size, head, tail, pad, pos;
+
+	if (!debuglog_wanted (level, domain) ||
+	    __atomic_load_n (&binlog.closing, __ATOMIC_RELAXED))
+		return;
+	dlen = MIN (strlen (domain), 0xffff);
+	tlen = MIN (strlen (str), DEBUGLOG_MAX_TEXT);
+	size = DEBUGLOG_ALIGN (sizeof (DebugLogRecord) + dlen + tlen);
+
+	head = __atomic_load_n (&binlog.head, __ATOMIC_RELAXED);
+	do {
+		pos = head & (DEBUGLOG_RING - 1);
+		pad = (pos + size > DEBUGLOG_RING) ? DEBUGLOG_RING - pos : 0;
+		tail = __atomic_load_n (&binlog.tail, __ATOMIC_ACQUIRE);
+		if (head + pad + size - tail > DEBUGLOG_RING) {
+			/* Never hold up the caller, it may be a transfer. */
+			__atomic_fetch_add (&binlog.dropped, 1, __ATOMIC_RELAXED);
+			debuglog_kick ();
+			return;
+		}
+	} while (!__atomic_compare_exchange_n (&binlog.head, &head,
+					       head + pad + size, 1,
+					       __ATOMIC_ACQUIRE,
+					       __ATOMIC_RELAXED));
+
+	if (pad) {
+		r = (DebugLogRecord *) (binlog.ring + pos);
+		r->level = DEBUGLOG_PAD;
+		__atomic_store_n (&r->size, pad, __ATOMIC_RELEASE);
+		pos = 0;
+	}
+	r = (DebugLogRecord *) (binlog.ring + pos);
+	r->level = level;
+	r->domain = dlen;
+	r->text = tlen;
+	r->usec = debuglog_usec () - binlog.start;
+	memcpy ((char *) (r + 1), domain, dlen);
+	memcpy ((char *) (r + 1) + dlen, str, tlen);
+	__atomic_store_n (&r->size, size, __ATOMIC_RELEASE);
+
+	if (head + pad + size - tail >= DEBUGLOG_RING / 2)
+		debuglog_kick ();
+}
+
+static void
+debuglog_flush (void)
+{
+	size_t	done = 0;
+	ssize_t	r;
+
+	while ((binlog.fd >= 0) && (done < binlog.outlen)) {
+		r = write (binlog.fd, binlog.out + done, binlog.outlen - done);
+		if ((r < 0) && (errno == EINTR))
+			continue;
+		if (r <= 0) {
+			fprintf (stderr, _("Could not write debug log '%s': %s\n"),
+				 binlog.name, strerror (errno));
+			close (binlog.fd);
+			binlog.fd = -1;
+			break;
+		}
+		done += r;
+	}
+	binlog.written += done;
+	binlog.outlen = 0;
+}
+
+/* FILE becomes FILE.1 and FILE starts over. */
+static int
+debuglog_rotate (void)
+{
+	DebugLogHeader	h;
+	char		*old;
+
+	if (binlog.fd >= 0)
+		close (binlog.fd);
+	old = malloc (strlen (binlog.name) + 3);
+	if (old) {
+		sprintf (old, "%s.1", binlog.name);
+		if (rename (binlog.name, old) && (errno != ENOENT))
+			gp_log (GP_LOG_DEBUG, "debuglog", "Cannot rename '%s'.",
+				binlog.name);
+		free (old);
+	}
+	binlog.fd = open (binlog.name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if (binlog.fd < 0)
+		return GP_ERROR_FILE_NOT_FOUND;
+	fcntl (binlog.fd, F_SETFD, FD_CLOEXEC);
+
+	memset (&h, 0, sizeof (h));
+	memcpy (h.magic, DEBUGLOG_MAGIC, sizeof (h.magic));
+	h.order = DEBUGLOG_ORDER;
+	h.version = DEBUGLOG_VERSION;
+	h.start = binlog.wall;
+	binlog.written = 0;
+	memcpy (binlog.out, &h, sizeof (h));
+	binlog.outlen = sizeof (h);
+	return GP_OK;
+}
+
+static void
+debuglog_out (const void *record, size_t size)
+{
+	if (binlog.written + binlog.outlen + size > binlog.max / 2) {
+		debuglog_flush ();
+		if ((binlog.fd >= 0) && (debuglog_rotate () != GP_OK))
+			fprintf (stderr, _("Could not open debug log '%s': %s\n"),
+				 binlog.name, strerror (errno));
+	}
+	if (binlog.fd < 0)
+		return;
+	if (binlog.outlen + size > DEBUGLOG_BUFFER)
+		debuglog_flush ();
+	memcpy (binlog.out + binlog.outlen, record, size);
+	binlog.outlen += size;
+}
+
+/* Writes out what the loggers finished. */
+static void
+debuglog_drain (void)
+{
+	DebugLogRecord	*r;
+	size_t		tail = binlog.tail, head, size;
+	unsigned long	dropped;
+	char		buf[sizeof (DebugLogRecord) + 64];
+	int		n;
+
+	head = __atomic_load_n (&binlog.head, __ATOMIC_ACQUIRE);
+	while (tail != head) {
+		r = (DebugLogRecord *) (binlog.ring + (tail & (DEBUGLOG_RING - 1)));
+		size = __atomic_load_n (&r->size, __ATOMIC_ACQUIRE);
+		if (!size)
+			break;	/* still being filled in */
+		if (r->level != DEBUGLOG_PAD)
+			debuglog_out (r, size);
+		/* Zero, so a later record is not taken before its time. */
+		memset (r, 0, size);
+		tail += size;
+		__atomic_store_n (&binlog.tail, tail, __ATOMIC_RELEASE);
+	}
+
+	dropped = __atomic_exchange_n (&binlog.dropped, 0, __ATOMIC_RELAXED);
+	if (dropped) {
+		r = (DebugLogRecord *) buf;
+		memset (buf, 0, sizeof (buf));
+		memcpy (buf + sizeof (DebugLogRecord), "debuglog", 8);
+		n = snprintf (buf + sizeof (DebugLogRecord) + 8, 56,
+			      "%lu messages dropped, the disk could not keep up.",
+			      dropped);
+		r->level = GP_LOG_ERROR;
+		r->domain = 8;
+		r->text = MIN (n, 55);
+		r->usec = debuglog_usec () - binlog.start;
+		r->size = DEBUGLOG_ALIGN (sizeof (DebugLogRecord) + 8 + r->text);
+		debuglog_out (r, r->size);
+	}
+	debuglog_flush ();
+}
+
+static void *
+debuglog_thread (void *data)
+{
+	struct pollfd	pfd;
+	char		buf[64];
+	int		closing;
+
+	pfd.fd = binlog.wake[0];
+	pfd.events = POLLIN;
+	do {
+		closing = __atomic_load_n (&binlog.closing, __ATOMIC_ACQUIRE);
+		if (!closing && (poll (&pfd, 1, DEBUGLOG_PERIOD) > 0))
+			while (read (binlog.wake[0], buf, sizeof (buf)) > 0)
+				;
+		__atomic_store_n (&binlog.kicked, 0, __ATOMIC_RELEASE);
+		debuglog_drain ();
+	} while (!closing);
+	return NULL;
+}
+
+/* Loggers that come later drop their messages, nothing is freed: other
+ * threads may still log while the process exits. */
+static void
+debuglog_close (void)
+{
+	ssize_t r;
+
+	__atomic_store_n (&binlog.closing, 1, __ATOMIC_RELEASE);
+	r = write (binlog.wake[1], "", 1);
+	(void) r;
+	pthread_join (binlog.thread, NULL);
+	if (binlog.fd >= 0)
+		close (binlog.fd);
+	binlog.fd = -1;
+}
+
+static int
+debuglog_parse_size (const char *spec, uint64_t *size)
+{
+	char		*end;
+	unsigned long	n;
+
+	n = strtoul (spec, &end, 10);
+	if (n && (!strcmp (end, "M") || !strcmp (end, "G"))) {
+		*size = (uint64_t) n * 1024 * 1024;
+		if (*end == 'G')
+			*size *= 1024;
+		return GP_OK;
+	}
+	cli_error_print (_("Invalid debug log size '%s', use e.g. '64M' or '1G'."),
+			 spec);
+	return GP_ERROR_BAD_PARAMETERS;
+}
+
+int
+debuglog_open (const char *filename, const char *size)
+{
+	struct timeval	tv;
+	int		r;
+
+	binlog.max = DEBUGLOG_SIZE;
+	if (size && (debuglog_parse_size (size, &binlog.max) != GP_OK))
+		return GP_ERROR_BAD_PARAMETERS;
+	binlog.name = strdup (filename);
+	binlog.ring = calloc (1, DEBUGLOG_RING);
+	binlog.out = malloc (DEBUGLOG_BUFFER);
+	if (!binlog.name || !binlog.ring || !binlog.out)
+		return GP_ERROR_NO_MEMORY;
+
+	gettimeofday (&tv, NULL);
+	binlog.wall = (uint64_t) tv.tv_sec * 1000000 + tv.tv_usec;
+	binlog.start = debuglog_usec ();
+	binlog.fd = -1;
+	/* Keeps the log of the last run as FILE.1. */
+	r = debuglog_rotate ();
+	if (r != GP_OK) {
+		cli_error_print (_("Could not open debug log '%s': %s"),
+				 filename, strerror (errno));
+		return r;
+	}
+
+	if (pipe (binlog.wake))
+		return GP_ERROR_OS_FAILURE;
+	fcntl (binlog.wake[0], F_SETFD, FD_CLOEXEC);
+	fcntl (binlog.wake[1], F_SETFD, FD_CLOEXEC);
+	fcntl (binlog.wake[0], F_SETFL, O_NONBLOCK);
+	fcntl (binlog.wake[1], F_SETFL, O_NONBLOCK);
+	if (pthread_create (&binlog.thread, NULL, debuglog_thread, NULL))
+		return GP_ERROR_OS_FAILURE;
+	atexit (debuglog_close);
+	return GP_OK;
+}
+
+int
+debuglog_is_open (void)
+{
+	return binlog.ring != NULL;
+}
+
+#else /* !DEBUGLOG_BINARY */
+
+void
+debuglog_log (GPLogLevel level, const char *domain, const char *str,
+	      void *data)
+{
+}
+
+int
+debuglog_open (const char *filename, const char *size)
+{
+	cli_error_print (_("Binary debug logs are not supported in this build."));
+	return GP_ERROR_NOT_SUPPORTED;
+}
+
+int
+debuglog_is_open (void)
+{
+	return 0;
+}
+
+#endif /* DEBUGLOG_BINARY */
+
+/* In the format of the text log. */
+int
+debuglog_print (const char *filename)
+{
+	DebugLogHeader	h;
+	DebugLogRecord	r;
+	char		*buf;
+	size_t		len;
+	FILE		*f;
+	int		ret = GP_OK;
+
+	f = fopen (filename, "rb");
+	if (!f) {
+		cli_error_print (_("Could not open debug log '%s': %s"),
+				 filename, strerror (errno));
+		return GP_ERROR_FILE_NOT_FOUND;
+	}
+	if ((fread (&h, sizeof (h), 1, f) != 1) ||
+	    memcmp (h.magic, DEBUGLOG_MAGIC, sizeof (h.magic)) ||
+	    (h.version != DEBUGLOG_VERSION)) {
+		cli_error_print (_("'%s' is not a binary debug log of this version."),
+				 filename);
+		fclose (f);
+		return GP_ERROR_CORRUPTED_DATA;
+	}
+	if (h.order != DEBUGLOG_ORDER) {
+		cli_error_print (_("'%s' was written on a machine of another byte order."),
+				 filename);
+		fclose (f);
+		return GP_ERROR_NOT_SUPPORTED;
+	}
+	buf = malloc (DEBUGLOG_ALIGN (0xffff + DEBUGLOG_MAX_TEXT));
+	if (!buf) {
+		fclose (f);
+		return GP_ERROR_NO_MEMORY;
+	}
+
+	/* A crash may have cut the last record short, that is no error. */
+	while (fread (&r, sizeof (r), 1, f) == 1) {
+		/* The size must be the one debuglog_log() gave it, which
+		 * also keeps len within buf. */
+		if ((r.text > DEBUGLOG_MAX_TEXT) ||
+		    (r.size != DEBUGLOG_ALIGN (sizeof (r) + r.domain + r.text))) {
+			cli_error_print (_("'%s' is damaged."), filename);
+			ret = GP_ERROR_CORRUPTED_DATA;
+			break;
+		}
+		len = r.size - sizeof (r);
+		if (fread (buf, 1, len, f) != len)
+			break;
+		printf ("%li.%06li %-28.*s(%i): %.*s\n",
+			(long) (r.usec / 1000000), (long) (r.usec % 1000000),
+			(int) r.domain, buf, r.level, (int) r.text, buf + r.domain);
+	}
+	free (buf);
+	fclose (f);
+	return ret;
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
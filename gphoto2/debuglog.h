@@ -0,0 +1,99 @@
+/* debuglog.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_DEBUGLOG_H
+#define GPHOTO2_DEBUGLOG_H
+
+#include <stdint.h>
+
+#include <gphoto2/gphoto2-port-log.h>
+
+/*
+ * --debug-domains SPEC sets the level per log domain, for the text log
+ * as well as the binary one: "ptp2=data,libusb1=debug,*=error". A name
+ * matches its domain and the domains below it ("ptp2/..."), a name
+ * ending in '*' any domain it starts; the longest match counts. Other
+ * domains get --debug-loglevel.
+ *
+ * --debug-binlog FILE logs in binary instead of text. The messages are
+ * copied into a ring in memory without taking a lock and a thread
+ * writes them out, so the transfers hardly slow down even at the data
+ * level. If the ring fills up faster than the disk takes it, messages
+ * are dropped and counted rather than waited for.
+ *
+ * The file never grows past half of --debug-binlog-size (default 64M):
+ * then it is renamed to FILE.1, replacing the older one, and a new FILE
+ * is started. The last few megabytes before a failure are always at
+ * hand. --debug-binlog-print FILE turns FILE into the usual text.
+ *
+ * A file is a DebugLogHeader followed by records, each a
+ * DebugLogRecord, the domain, the message and padding to 8 bytes, all
+ * in the byte order of the writer.
+ */
+
+#define DEBUGLOG_MAGIC		"GPDBGLOG"
+#define DEBUGLOG_ORDER		0x01020304
+#define DEBUGLOG_VERSION	1
+
+typedef struct {
+	char		magic[8];
+	uint32_t	order;		/* DEBUGLOG_ORDER as written */
+	uint32_t	version;
+	uint64_t	start;		/* microseconds since the epoch */
+} DebugLogHeader;
+
+typedef struct {
+	uint32_t	size;		/* of the whole record */
+	uint16_t	level;		/* GPLogLevel */
+	uint16_t	domain;		/* bytes of the domain */
+	uint32_t	text;		/* bytes of the message */
+	uint32_t	reserved;
+	uint64_t	usec;		/* since the log was started */
+} DebugLogRecord;
+
+/* --debug-domains SPEC */
+int  debuglog_set_domains (const char *spec);
+
+/* The level of the other domains, from debug_action(). Returns the one
+ * to register the log function with. */
+GPLogLevel debuglog_set_level (GPLogLevel level);
+
+/* Nonzero if --debug-domains lets the message through. */
+int  debuglog_wanted (GPLogLevel level, const char *domain);
+
+/* --debug-binlog FILE, size is --debug-binlog-size or NULL. */
+int  debuglog_open (const char *filename, const char *size);
+
+/* Nonzero once the binary log is open, debug_action() then registers
+ * debuglog_log() instead of its text log function. */
+int  debuglog_is_open (void);
+void debuglog_log (GPLogLevel level, const char *domain, const char *str,
+		   void *data);
+
+/* --debug-binlog-print FILE */
+int  debuglog_print (const char *filename);
+
+#endif /* !defined(GPHOTO2_DEBUGLOG_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
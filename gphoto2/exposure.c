@@ -0,0 +1,342 @@
+/* exposure.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "actions.h"
+#include "exposure.h"
+#include "gp-params.h"
+#include "i18n.h"
+#include "main.h"
+#include "metrics.h"
+
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+#ifdef HAVE_JPEG
+# include "luma.h"
+#endif
+
+#include <gphoto2/gphoto2-port-log.h>
+
+/* Middle gray, 18% reflectance in sRGB. */
+#define EXPOSURE_TARGET		118
+
+/* A histogram does not need more pixels than this is wide. */
+#define EXPOSURE_MIN_WIDTH	160
+
+/* Don't touch the exposure for less than a third of a stop, and
+ * smooth out the odd passing car or cloud. */
+#define EXPOSURE_DEADBAND	(1.0 / 3)
+#define EXPOSURE_SMOOTHING	0.6
+
+/* Share of blown out pixels above which we never brighten. */
+#define EXPOSURE_CLIPPED	0.01
+
+struct _GPExposure {
+	double		target;
+	double		error;		/* smoothed, in stops */
+	int		metered;	/* error is valid */
+	long		cost;		/* ms the last metering took */
+	int		disabled;
+#ifdef HAVE_JPEG
+	LumaImage	image;
+#endif
+};
+
+int
+exposure_ramp_set (GPParams *p, const char *target)
+{
+#ifdef HAVE_JPEG
+	char	*end;
+	long	t = EXPOSURE_TARGET;
+
+	if (target) {
+		t = strtol (target, &end, 10);
+		if (*end || (t < 1) || (t > 254)) {
+			cli_error_print (_("Invalid exposure target '%s', use a mean brightness between 1 and 254."),
+					 target);
+			return GP_ERROR_BAD_PARAMETERS;
+		}
+	}
+	if (!p->exposure) {
+		p->exposure = calloc (1, sizeof (GPExposure));
+		if (!p->exposure)
+			return GP_ERROR_NO_MEMORY;
+	}
+	p->exposure->target = t;
+	return GP_OK;
+#else
+	cli_error_print (_("Exposure ramping needs libjpeg, which gphoto2 was built without."));
+	return GP_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+void
+exposure_ramp_free (GPParams *p)
+{
+	if (!p->exposure)
+		return;
+#ifdef HAVE_JPEG
+	luma_image_clear (&p->exposure->image);
+#endif
+	free (p->exposure);
+	p->exposure = NULL;
+}
+
+#ifdef HAVE_JPEG
+
+/*
+ * Four partial histograms, so runs of equal pixels don't make each
+ * increment wait for the one before; the merge is a vector add.
+ */
+static void
+exposure_histogram (const unsigned char *data, size_t n, uint32_t *hist)
+{
+	uint32_t	h[4][256];
+	size_t		i;
+
+	memset (h, 0, sizeof (h));
+	for (i = 0; i + 4 <= n; i += 4) {
+		h[0][data[i]]++;
+		h[1][data[i + 1]]++;
+		h[2][data[i + 2]]++;
+		h[3][data[i + 3]]++;
+	}
+	for (; i < n; i++)
+		h[0][data[i]]++;
+	for (i = 0; i < 256; i++)
+		hist[i] = h[0][i] + h[1][i] + h[2][i] + h[3][i];
+}
+
+/*
+ * "1/250", "0.5", "2.5s" or "30" for shutter speeds, "400" for ISO.
+ * Parsed by hand, strtod would want the locale's decimal point.
+ */
+static int
+exposure_parse (const char *s, double *value)
+{
+	double	v = 0, scale = 1, div = 0;
+
+	if (*s < '0' || *s > '9')
+		return 0;
+	for (; *s >= '0' && *s <= '9'; s++)
+		v = 10 * v + (*s - '0');
+	if (*s == '.' || *s == ',')
+		for (s++; *s >= '0' && *s <= '9'; s++)
+			v += (*s - '0') * (scale /= 10);
+	if (*s == '/') {
+		for (s++; *s >= '0' && *s <= '9'; s++)
+			div = 10 * div + (*s - '0');
+		if (!div)
+			return 0;
+		v /= div;
+	}
+	if (*s == 's')
+		s++;
+	if (*s || (v <= 0))
+		return 0;
+	*value = v;
+	return 1;
+}
+
+/*
+ * Moves widget name one choice up (dir 1) or down (dir -1) in value,
+ * unless that step would overshoot error by more than it corrects.
+ * Choices that are not a number, like "bulb" or "Auto", are skipped.
+ * Sets *stops to the exposure change, or returns
+ * GP_ERROR_FIXED_LIMIT_EXCEEDED when there is no choice left that way.
+ */
+static int
+exposure_move (GPParams *p, const char *name, int dir, double max,
+	       double error, double *stops)
+{
+	CameraWidget	*widget;
+	CameraWidgetType type;
+	const char	*choice;
+	char		*current = NULL, next[64];
+	double		value, cur = 0, best = 0;
+	int		i, n, ret;
+
+	ret = config_cache_widget (p, name, &widget);
+	if (ret != GP_OK)
+		return ret;
+	gp_widget_get_type (widget, &type);
+	if ((type != GP_WIDGET_RADIO) && (type != GP_WIDGET_MENU))
+		return GP_ERROR_NOT_SUPPORTED;
+	gp_widget_get_value (widget, &current);
+	if (!current || !exposure_parse (current, &cur))
+		return GP_ERROR_FIXED_LIMIT_EXCEEDED;
+
+	/* The nearest choice beyond the current one. */
+	n = gp_widget_count_choices (widget);
+	next[0] = '\0';
+	for (i = 0; i < n; i++) {
+		if ((gp_widget_get_choice (widget, i, &choice) != GP_OK) ||
+		    !exposure_parse (choice, &value))
+			continue;
+		if ((dir > 0) ? (value <= cur * 1.01) : (value >= cur * 0.99))
+			continue;
+		if ((dir > 0) && (value > max))
+			continue;
+		if (next[0] && ((dir > 0) ? (value >= best) : (value <= best)))
+			continue;
+		best = value;
+		snprintf (next, sizeof (next), "%s", choice);
+	}
+	if (!next[0])
+		return GP_ERROR_FIXED_LIMIT_EXCEEDED;
+	/* Full stop choices and a third of a stop off: wait. */
+	if (fabs (log2 (best / cur)) > 2 * fabs (error)) {
+		*stops = 0;
+		return GP_OK;
+	}
+	ret = set_config_action (p, name, next);
+	if (ret != GP_OK)
+		return ret;
+	*stops = log2 (best / cur);
+	return GP_OK;
+}
+
+/* The shutter speed and ISO, for the log. */
+static void
+exposure_describe (GPParams *p, char *buf, size_t size)
+{
+	CameraWidget	*widget;
+	char		*shutter = NULL, *iso = NULL;
+
+	if (config_cache_widget (p, "shutterspeed", &widget) == GP_OK)
+		gp_widget_get_value (widget, &shutter);
+	snprintf (buf, size, "%s", shutter ? shutter : "?");
+	if (config_cache_widget (p, "iso", &widget) == GP_OK)
+		gp_widget_get_value (widget, &iso);
+	snprintf (buf + strlen (buf), size - strlen (buf), ", ISO %s",
+		  iso ? iso : "?");
+}
+
+int
+exposure_ramp_step (GPParams *p, long budget, double max_exposure)
+{
+	GPExposure	*e = p->exposure;
+	CameraFile	*file;
+	const char	*data;
+	unsigned long	size;
+	uint32_t	hist[256];
+	struct timeval	start, end;
+	double		mean = 0, clipped, stops, moved = 0;
+	const char	*changed = NULL;
+	char		now[128];
+	size_t		n, i;
+	int		ret;
+
+	if (!e || e->disabled)
+		return GP_OK;
+	if (budget <= e->cost) {
+		gp_log (GP_LOG_DEBUG, "exposure", "Not metering, %ld ms left and metering takes %ld ms.",
+			budget, e->cost);
+		return GP_OK;
+	}
+
+	gettimeofday (&start, NULL);
+	ret = gp_file_new (&file);
+	if (ret != GP_OK)
+		return ret;
+	ret = metered_camera_capture_preview (p->camera, file, p->context);
+	if (ret == GP_OK)
+		ret = gp_file_get_data_and_size (file, &data, &size);
+	if (ret == GP_OK)
+		ret = luma_decode (&e->image, data, size, EXPOSURE_MIN_WIDTH, NULL);
+	gp_file_unref (file);
+	if (ret != GP_OK) {
+		gp_log (GP_LOG_DEBUG, "exposure", "No preview to meter: %s",
+			gp_result_as_string (ret));
+		return GP_OK;
+	}
+
+	n = (size_t) e->image.width * e->image.height;
+	exposure_histogram (e->image.data, n, hist);
+	for (i = 0; i < 256; i++)
+		mean += (double) i * hist[i];
+	mean /= n;
+	clipped = (double) hist[255] / n;
+
+	/* Luma is gamma encoded, roughly 2.2 of it per stop of light. */
+	stops = 2.2 * log2 (e->target / ((mean < 1) ? 1 : mean));
+	if ((clipped > EXPOSURE_CLIPPED) && (stops > 0))
+		stops = 0;
+	e->error = e->metered ? EXPOSURE_SMOOTHING * e->error +
+				(1 - EXPOSURE_SMOOTHING) * stops : stops;
+	e->metered = 1;
+
+	if (e->error >= EXPOSURE_DEADBAND) {
+		changed = "shutterspeed";
+		ret = exposure_move (p, changed, 1, max_exposure, e->error, &moved);
+		if (ret == GP_ERROR_FIXED_LIMIT_EXCEEDED) {
+			changed = "iso";
+			ret = exposure_move (p, changed, 1, 1e9, e->error, &moved);
+		}
+	} else if (e->error <= -EXPOSURE_DEADBAND) {
+		changed = "iso";
+		ret = exposure_move (p, changed, -1, 1e9, e->error, &moved);
+		if (ret == GP_ERROR_FIXED_LIMIT_EXCEEDED) {
+			changed = "shutterspeed";
+			ret = exposure_move (p, changed, -1, 1e9, e->error, &moved);
+		}
+	}
+	if (ret == GP_OK)
+		e->error -= moved;
+	else if (ret != GP_ERROR_FIXED_LIMIT_EXCEEDED) {
+		/* Not in manual mode, or no such setting. */
+		cli_error_print (_("Could not change %s, exposure ramping stopped."), changed);
+		e->disabled = 1;
+	}
+
+	gettimeofday (&end, NULL);
+	e->cost = (end.tv_sec - start.tv_sec) * 1000 + (end.tv_usec - start.tv_usec) / 1000;
+	if (!(p->flags & FLAGS_QUIET)) {
+		exposure_describe (p, now, sizeof (now));
+		printf (_("Exposure: brightness %.0f, %+.1f stops off, %s%s, metering took %ld ms.\n"),
+			mean, e->error + moved, now,
+			moved ? _(" (changed)") : "", e->cost);
+	}
+	return GP_OK;
+}
+
+#else /* !HAVE_JPEG */
+
+int
+exposure_ramp_step (GPParams *p, long budget, double max_exposure)
+{
+	return GP_OK;
+}
+
+#endif /* HAVE_JPEG */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
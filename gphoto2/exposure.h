@@ -0,0 +1,47 @@
+/* exposure.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_EXPOSURE_H
+#define GPHOTO2_EXPOSURE_H
+
+#include <gp-params.h>
+
+/* --exposure-ramp [TARGET], TARGET is the mean luma to keep, 1 to 254 */
+int  exposure_ramp_set  (GPParams *p, const char *target);
+
+/*
+ * Meters a preview frame and moves the shutter speed or the ISO one
+ * step towards the target when the exposure has drifted. Longer shutter
+ * speeds are used before higher ISO, lower ISO before shorter shutter
+ * speeds, and no shutter speed longer than max_exposure seconds.
+ *
+ * Skipped if budget, the milliseconds until the next frame, is less
+ * than metering took last time.
+ */
+int  exposure_ramp_step (GPParams *p, long budget, double max_exposure);
+void exposure_ramp_free (GPParams *p);
+
+#endif /* !defined(GPHOTO2_EXPOSURE_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -23,8 +23,13 @@
 #include "globals.h"
 #include "foreach.h"
 #include "i18n.h"
+#include "journal.h"
 #include "main.h"
+#include "metrics.h"
+#include "progress.h"
 #include "range.h"
+#include "reconnect.h"
+#include "trace.h"
 
 #include <string.h>
 #include <stdio.h>
@@ -49,6 +54,74 @@ static struct {
 	{NULL, NULL}
 };
 
+/* Actions whose completion is recorded in the --journal. */
+static struct {
+	FileAction *action;
+	const char *name;
+} FileActions[] = {
+	{save_file_action, "get"},
+	{save_thumbnail_action, "thumbnail"},
+	{save_raw_action, "raw"},
+	{save_audio_action, "audio"},
+	{save_all_audio_action, "audio"},
+	{save_exif_action, "exif"},
+	{save_meta_action, "metadata"},
+	{NULL, NULL}
+};
+
+/* Downloads count towards the file number in the progress bar. */
+static void
+batch_add (GPParams *p, FileAction action, int count)
+{
+	int i;
+
+	for (i = 0; FileActions[i].name; i++)
+		if (FileActions[i].action == action) {
+			progress_batch_add (p, count);
+			break;
+		}
+}
+
+/*
+ * Run action on one file, reconnecting and retrying on I/O errors,
+ * and skipping files the journal says were already handled.
+ */
+static int
+do_file_action (GPParams *p, FileAction action, const char *folder,
+		const char *filename)
+{
+	const char *kind = NULL;
+	char path[2048];
+	double start = trace_begin ();
+	int i, r, attempt = 0;
+
+	for (i = 0; FileActions[i].name; i++)
+		if (FileActions[i].action == action)
+			break;
+	if (FileActions[i].name)
+		progress_batch_next (p);
+	if (p->journal && FileActions[i].name) {
+		kind = FileActions[i].name;
+		snprintf (path, sizeof (path), "%s%s%s", folder,
+			  strcmp (folder, "/") ? "/" : "", filename);
+		if (journal_has (p, kind, path)) {
+			gp_log (GP_LOG_DEBUG, "foreach", "Journal: skipping "
+				"'%s' of '%s'.", kind, path);
+			return GP_OK;
+		}
+	}
+
+	do {
+		r = action (p, folder, filename);
+	} while (reconnect_retry (p, r, &attempt));
+
+	if ((r == GP_OK) && kind)
+		journal_add (p, kind, path);
+	trace_end ("frontend", FileActions[i].name ? FileActions[i].name : "file",
+		   start, filename);
+	return r;
+}
+
 int
 for_each_folder (GPParams *p, FolderAction action)
 {
@@ -75,8 +148,8 @@ for_each_folder (GPParams *p, FolderAction action)
 
 	CR (gp_list_new (&list));
 	/* Recursion requested. Descend into subfolders. */
-	CL (gp_camera_folder_list_folders (p->camera, p->folder, list,
-					   p->context), list);
+	CL (metered_camera_folder_list_folders (p->camera, p->folder, list,
+						p->context), list);
 	CL (count = gp_list_count (list), list);
 	if (p->flags & FLAGS_REVERSE) {
 		for (i = count - 1; i >= 0; i--) {
@@ -131,34 +204,40 @@ int
 for_each_file (GPParams *p, FileAction action)
 {
 	CameraList *list;
-	int i, count, r;
+	int i, count, r, attempt = 0;
 	const char *name = NULL;
 	char *f = NULL;
 
 	CR (gp_list_new (&list));
 	/* Iterate on all files */
-	CR (gp_camera_folder_list_files (p->camera, p->folder, list,
-					 p->context));
-	CR (count = gp_list_count (list));
+	do {
+		r = metered_camera_folder_list_files (p->camera, p->folder, list,
+						      p->context);
+	} while (reconnect_retry (p, r, &attempt));
+	CL (r, list);
+	CL (count = gp_list_count (list), list);
+	batch_add (p, action, count);
 	if (p->flags & FLAGS_REVERSE) {
 		for (i = count ; i--; ) {
 			if (glob_cancel)
 				break;
 			CL (gp_list_get_name (list, i, &name), list);
-			r = action (p, p->folder, name);
+			r = do_file_action (p, action, p->folder, name);
 			if (r == GP_ERROR_NOT_SUPPORTED) /* can go on */
 				r = GP_OK;
 			CL (r, list);
+			move_queue_flush (p, 0);
 		}
 	} else {
 		for (i = 0; i < count; i++) {
 			if (glob_cancel)
 				break;
 			CL (gp_list_get_name (list, i, &name), list);
-			r = action (p, p->folder, name);
+			r = do_file_action (p, action, p->folder, name);
 			if (r == GP_ERROR_NOT_SUPPORTED) /* can go on */
 				r = GP_OK;
 			CL (r, list);
+			move_queue_flush (p, 0);
 		}
 	}
 
@@ -169,8 +248,8 @@ for_each_file (GPParams *p, FileAction action)
 	}
 
 	/* Recursion requested. Descend into subfolders. */
-	CL (gp_camera_folder_list_folders (p->camera, p->folder,
-					   list, p->context), list);
+	CL (metered_camera_folder_list_folders (p->camera, p->folder,
+						list, p->context), list);
 	CL (count = gp_list_count (list), list);
 	for (i = 0; i < count; i++) {
 		if (glob_cancel)
@@ -214,8 +293,8 @@ get_path_for_id_rec (GPParams *p,
 
 	strncpy (folder, base_folder, MAX_FOLDER_LEN);
 	CR (gp_list_new(&list));
-	CL (gp_camera_folder_list_files (p->camera, base_folder, list,
-					 p->context), list);
+	CL (metered_camera_folder_list_files (p->camera, base_folder, list,
+					      p->context), list);
 	CL (n_files = gp_list_count (list), list);
 	if (id - *base_id < (unsigned int) n_files) {
 
@@ -229,8 +308,8 @@ get_path_for_id_rec (GPParams *p,
 		/* Look for IDs in subfolders */
 		GP_DEBUG ("ID %i is not in folder '%s'.", id, base_folder);
 		*base_id += n_files;
-		CL (gp_camera_folder_list_folders (p->camera, base_folder,
-						   list, p->context), list);
+		CL (metered_camera_folder_list_folders (p->camera, base_folder,
+							list, p->context), list);
 		CL (n_folders = gp_list_count (list), list);
 		for (i = 0; i < (unsigned int)n_folders; i++) {
 			CL (gp_list_get_name (list, i, &name), list);
@@ -287,8 +366,8 @@ get_path_for_id (GPParams *p, const char *base_folder,
 		GP_DEBUG ("No recursion. Taking file %i from folder '%s'.",
 			  id, base_folder);
 		CR (gp_list_new (&list));
-		CL (gp_camera_folder_list_files (p->camera, base_folder,
-						 list, p->context), list);
+		CL (metered_camera_folder_list_files (p->camera, base_folder,
+						      list, p->context), list);
 		CL ((list_count = gp_list_count (list)), list);
 		if (id >= (unsigned int) list_count) {
 			switch (list_count) {
@@ -330,7 +409,7 @@ for_each_file_in_range (GPParams *p, FileAction action,
 			const char *range)
 {
 	char	*index;
-	int 	i, max = 0, r;
+	int 	i, max = 0, r, n;
 	char 	ffolder[MAX_FOLDER_LEN], ffile[MAX_FILE_LEN];
 
 	index = calloc(MAX_IMAGE_NUMBER,1);
@@ -339,6 +418,9 @@ for_each_file_in_range (GPParams *p, FileAction action,
 	CR (parse_range (range, index, p->context));
 
 	for (max = MAX_IMAGE_NUMBER - 1; !index[max]; max--);
+	for (i = 0, n = 0; i <= max; i++)
+		n += index[i] ? 1 : 0;
+	batch_add (p, action, n);
 	
 	if (p->flags & FLAGS_REVERSE) {
 		for (i = max; 0 <= i; i--) {
@@ -347,7 +429,7 @@ for_each_file_in_range (GPParams *p, FileAction action,
 			if (index[i]) {
 				CR (get_path_for_id (p, p->folder,
 					(unsigned int) i, ffolder, ffile));
-				r = action (p, ffolder, ffile);
+				r = do_file_action (p, action, ffolder, ffile);
 				if (r == GP_OK) continue;
 				/* some cameras do not support downloads of some files */
 				if (r == GP_ERROR_NOT_SUPPORTED) continue;
@@ -373,7 +455,7 @@ for_each_file_in_range (GPParams *p, FileAction action,
 				CR (get_path_for_id (p, p->folder,
 					(unsigned int) i - count,
 					ffolder, ffile));
-				r = action (p, ffolder, ffile);
+				r = do_file_action (p, action, ffolder, ffile);
 				/* some cameras do not support downloads of some files */
 				if ((r != GP_OK) && (r != GP_ERROR_NOT_SUPPORTED)) {
 					free (index);
@@ -23,6 +23,14 @@
 #include "config.h"
 #include "gp-params.h"
 #include "i18n.h"
+#include "actions.h"
+#include "exposure.h"
+#include "hook.h"
+#include "journal.h"
+#include "probes.h"
+#include "progress.h"
+#include "schema.h"
+#include "trace.h"
 
 /* This needs to disappear. */
 #include "globals.h"
@@ -36,13 +44,6 @@
 #include "spawnve.h"
 #endif
 
-#ifndef MAX
-#define MAX(x, y) (((x)>(y))?(x):(y))
-#endif
-#ifndef MIN
-#define MIN(x, y) (((x)<(y))?(x):(y))
-#endif
-
 
 #ifdef __GNUC__
 #define __unused__ __attribute__((unused))
@@ -72,156 +73,6 @@ ctx_error_func (GPContext __unused__ *context, const char *str, void __unused__
         fflush  (stderr);
 }
 
-#define MAX_PROGRESS_STATES 16
-#define MAX_MSG_LEN 1024
-
-static struct {
-        char message[MAX_MSG_LEN + 1];
-        float target;
-        unsigned long int count;
-        struct {
-                float  current;
-                time_t time, left;
-        } last;
-} progress_states[MAX_PROGRESS_STATES];
-
-static unsigned int
-ctx_progress_start_func (GPContext __unused__ *context, float target,
-                         const char *str, void *data)
-{
-	GPParams *p = data;
-        unsigned int id, len;
-        static unsigned char initialized = 0;
-
-        if (!initialized) {
-                memset (progress_states, 0, sizeof (progress_states));
-                initialized = 1;
-        }
-
-	if (p->flags & FLAGS_QUIET)
-		return 0;
-
-        /*
-         * If the message is too long, we will shorten it. If we have less
-         * than 4 cols available, we won't display any message.
-         */
-        len = (p->cols * 0.5 < 4) ? 0 : MIN (p->cols * 0.5, MAX_MSG_LEN);
-
-        /* Remember message and target. */
-        for (id = 0; id < MAX_PROGRESS_STATES; id++)
-                if (!progress_states[id].target)
-                        break;
-        if (id == MAX_PROGRESS_STATES)
-                id--;
-        progress_states[id].target = target;
-        strncpy (progress_states[id].message, str, len + 1);
-        progress_states[id].count = 0;
-        progress_states[id].last.time = time (NULL);
-        progress_states[id].last.current = progress_states[id].last.left = 0.;
-
-        /* If message is too long, shorten it. */
-        if (progress_states[id].message[len - 1]) {
-                progress_states[id].message[len - 1] = '\0';
-                progress_states[id].message[len - 2] = '.';
-                progress_states[id].message[len - 3] = '.';
-                progress_states[id].message[len - 4] = '.';
-        }
-
-        return (id);
-}
-
-static void
-ctx_progress_update_func (GPContext __unused__ *context, unsigned int id,
-                          float current, void *data)
-{
-	GPParams *p = data;
-        static const char spinner[] = "\\|/-";
-        unsigned int i, width, pos;
-        float rate;
-        char remaining[10], buf[10];
-        time_t sec = 0;
-
-        /* Guard against buggy camera drivers */
-        if (id >= MAX_PROGRESS_STATES || ((int)id) < 0)
-                return;
-
-	if (p->flags & FLAGS_QUIET)
-		return;
-
-        /* How much time until completion? */
-        if ((time (NULL) - progress_states[id].last.time > 0) &&
-            (current - progress_states[id].last.current > 0)) {
-                rate = (time (NULL) - progress_states[id].last.time) /
-                       (current - progress_states[id].last.current);
-                sec = (MAX (0, progress_states[id].target - current)) * rate;
-                if (progress_states[id].last.left) {
-                        sec += progress_states[id].last.left;
-                        sec /= 2.;
-                }
-                progress_states[id].last.time = time (NULL);
-                progress_states[id].last.current = current;
-                progress_states[id].last.left = sec;
-        } else
-                sec = progress_states[id].last.left;
-        memset (remaining, 0, sizeof (remaining));
-        if ((int) sec >= 3600) {
-                snprintf (buf, sizeof (buf), "%2ih", (int) sec / 3600);
-                sec -= ((int) (sec / 3600) * 3600);
-                strncat (remaining, buf, sizeof (remaining) - strlen (remaining) - 1);
-        }
-        if ((int) sec >= 60) {
-                snprintf (buf, sizeof (buf), "%2im", (int) sec / 60);
-                sec -= ((int) (sec / 60) * 60);
-                strncat (remaining, buf, sizeof (remaining) - strlen (remaining) - 1);
-        }
-        if ((int) sec) {
-                snprintf (buf, sizeof (buf), "%2is", (int) sec);
-                strncat (remaining, buf, sizeof (remaining) - strlen (remaining) - 1);
-        }
-
-        /* Determine the width of the progress bar and the current position */
-        width = MAX (0, (int) (p->cols -
-			       strlen (progress_states[id].message) - 20));
-        pos = MIN (width, (MIN (current / progress_states[id].target, 100.) * width) + 0.5);
-
-        /* Print the progress bar */
-        printf ("%s |", progress_states[id].message);
-        for (i = 0; i < width; i++)
-                putchar ((i < pos) ? '-' : ' ');
-        if (pos == width)
-	        putchar ('|');
-        else
-                putchar (spinner[progress_states[id].count & 0x03]);
-        progress_states[id].count++;
-
-        printf (" %5.1f%% %9.9s\r",
-		current / progress_states[id].target * 100., remaining);
-        fflush (stdout);
-}
-
-static void
-ctx_progress_stop_func (GPContext __unused__ *context, unsigned int id,
-			void *data)
-{
-	GPParams *p = data;
-        unsigned int i;
-
-        /* Guard against buggy camera drivers */
-        if (id >= MAX_PROGRESS_STATES || ((int)id) < 0)
-                return;
-
-	if (p->flags & FLAGS_QUIET)
-		return;
-
-        /* Clear the progress bar. */
-        for (i = 0; i < p->cols; i++)
-                putchar (' ');
-        putchar ('\r');
-        fflush (stdout);
-
-        progress_states[id].target = 0.;
-}
-
 static GPContextFeedback
 ctx_cancel_func (GPContext __unused__ *context, void __unused__ *data)
 {
@@ -280,10 +131,7 @@ gp_params_init (GPParams *p, char **envp)
 	gp_context_set_error_func     (p->context, ctx_error_func,   p);
 	gp_context_set_status_func    (p->context, ctx_status_func,  p);
 	gp_context_set_message_func   (p->context, ctx_message_func, p);
-	if (isatty (STDOUT_FILENO))
-		gp_context_set_progress_funcs (p->context,
-			ctx_progress_start_func, ctx_progress_update_func,
-			ctx_progress_stop_func, p);
+	progress_init (p);
 
 	p->_abilities_list = NULL;
 
@@ -324,8 +172,18 @@ gp_params_exit (GPParams *p)
 		gp_context_unref (p->context);
 	if (p->hook_script)
 		free (p->hook_script);
+	if (p->benchmark_json)
+		free (p->benchmark_json);
 	if (p->portinfo_list)
 		gp_port_info_list_free (p->portinfo_list);
+	journal_close (p);
+	hook_close (p);
+	schema_free (p);
+	config_cache_free (p);
+	exposure_ramp_free (p);
+	progress_free (p);
+	if (p->move_queue)
+		gp_list_free (p->move_queue);
 	memset (p, 0, sizeof (GPParams));
 }
 
@@ -342,12 +200,24 @@ gp_params_run_hook (GPParams *params, const char *action, const char *argument)
 	/* printf("gp_params_run_hook(params, \"%s\", \"%s\")\n",
 	   action, argument);
 	*/
+	double start;
+	int r;
+
 	if (params->hook_script == NULL) {
 		return 0;
 	}
-	return internal_run_hook(params->hook_script,
-				 action, argument,
-				 params->envp);
+	/* With --hook-jobs, downloads only take the time to queue them. */
+	start = trace_begin ();
+	PROBE2 (hook_start, action, argument);
+	if (params->hook)
+		r = hook_send (params, action, argument);
+	else
+		r = internal_run_hook(params->hook_script,
+				      action, argument,
+				      params->envp);
+	PROBE3 (hook_done, action, argument, r);
+	trace_end ("hook", action, start, argument);
+	return r;
 }
 
 
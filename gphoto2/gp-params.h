@@ -38,6 +38,7 @@ typedef enum {
 	FLAGS_KEEP_RAW 		= 1 << 9,
 	FLAGS_SKIP_EXISTING	= 1 << 10,
 	FLAGS_PARSABLE		= 1 << 11,
+	FLAGS_MOVE		= 1 << 12,
 } Flags;
 
 typedef enum {
@@ -47,6 +48,13 @@ typedef enum {
 	MULTI_DELETE
 } MultiType;
 
+typedef struct _GPJournal GPJournal;
+typedef struct _GPSchema GPSchema;
+typedef struct _GPConfigCache GPConfigCache;
+typedef struct _GPExposure GPExposure;
+typedef struct _GPHook GPHook;
+typedef struct _GPProgress GPProgress;
+
 typedef struct _GPParams GPParams;
 struct _GPParams {
 	Camera		*camera;
@@ -73,6 +81,21 @@ struct _GPParams {
  
 	char		*hook_script; /* If non-NULL, hook script to run */
 	char		**envp;  /* envp from the main() function */
+	GPHook		*hook; /* --hook-persistent or --hook-jobs, NULL if not */
+
+	int		reconnect_tries; /* --reconnect, 0 to give up on I/O errors */
+	GPJournal	*journal; /* --journal, NULL if not recording */
+	CameraList	*move_queue; /* --move, verified files to delete */
+	GPSchema	*schema; /* cached config tree layout, see schema.c */
+	GPConfigCache	*config_cache; /* config widgets of this session */
+
+	int		movie_avi; /* --movie-format avi */
+	unsigned int	movie_segment_seconds; /* --movie-segment, 0 for no limit */
+	unsigned long	movie_segment_bytes;
+	unsigned int	motion_roi[4]; /* --motion-roi in percent, 0 for all */
+	GPExposure	*exposure; /* --exposure-ramp, NULL if off */
+	GPProgress	*progress; /* progress bars and --progress-fd, see progress.c */
+	char		*benchmark_json; /* --benchmark-json, NULL to only print */
 };
 
 void gp_params_init (GPParams *params, char **envp);
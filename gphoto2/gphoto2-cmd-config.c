@@ -44,27 +44,102 @@
 # define MIN(a, b) ((a) < (b) ? (a) : (b))
 #endif
 
+/* Widgets and sections remembered between two writes. */
+#define CMD_CONFIG_MAX_TRACKED 64
+
 typedef struct {
 	Camera *camera;
 	CDKSCREEN *screen;
 	CameraWidget *window;
 	GPContext *context;
+
+	/* 1 if the driver can set and get single widgets, -1 if unknown */
+	int single;
+
+	/* Edited, but not on the camera yet. */
+	CameraWidget *dirty[CMD_CONFIG_MAX_TRACKED];
+	int n_dirty, dirty_overflow;
+
+	/*
+	 * A write may change other values too. Sections are read back
+	 * from the camera when opened, once after each write.
+	 */
+	int written;
+	CameraWidget *fresh[CMD_CONFIG_MAX_TRACKED];
+	int n_fresh;
 } CmdConfig;
 
 #define CHECK(result) {int r=(result);if(r<0)return(r);}
 
 static int show_widget (CmdConfig *cmd_config, CameraWidget *widget);
 
+static void
+mark_dirty (CmdConfig *cmd_config, CameraWidget *widget)
+{
+	int i;
+
+	for (i = 0; i < cmd_config->n_dirty; i++)
+		if (cmd_config->dirty[i] == widget)
+			return;
+	if (cmd_config->n_dirty < CMD_CONFIG_MAX_TRACKED)
+		cmd_config->dirty[cmd_config->n_dirty++] = widget;
+	else
+		cmd_config->dirty_overflow = 1;
+}
+
+/*
+ * Send the dirty widgets one by one if the driver lets us, the whole
+ * tree otherwise. Widgets that failed stay dirty and are sent again
+ * with the next change, like they would be with the whole tree.
+ */
 static int
-set_config (CmdConfig *cmd_config)
+push_dirty (CmdConfig *cmd_config)
+{
+	CameraWidget *widget;
+	const char *name;
+	int result;
+
+	cmd_config->written = 1;
+	cmd_config->n_fresh = 0;
+
+	while (cmd_config->single && !cmd_config->dirty_overflow &&
+	       cmd_config->n_dirty) {
+		widget = cmd_config->dirty[cmd_config->n_dirty - 1];
+		gp_widget_get_name (widget, &name);
+		result = gp_camera_set_single_config (cmd_config->camera,
+				name, widget, cmd_config->context);
+		if (result == GP_ERROR_NOT_SUPPORTED) {
+			if (cmd_config->single < 0)
+				cmd_config->single = 0;
+			break;
+		}
+		if (result < 0)
+			return (result);
+		cmd_config->single = 1;
+		gp_widget_set_changed (widget, 0);
+		cmd_config->n_dirty--;
+	}
+	if (!cmd_config->n_dirty && !cmd_config->dirty_overflow)
+		return (GP_OK);
+
+	/* The driver only sends what is marked as changed. */
+	CHECK (gp_camera_set_config (cmd_config->camera, cmd_config->window,
+				     cmd_config->context));
+	cmd_config->n_dirty = 0;
+	cmd_config->dirty_overflow = 0;
+	return (GP_OK);
+}
+
+static int
+set_config (CmdConfig *cmd_config, CameraWidget *widget)
 {
 	int result, selection;
 	CDK_CONST char *msg[10];
 	CDK_CONST char *buttons[] = {N_("</B/24>Continue"), N_("</B16>Cancel")};
 	CDKDIALOG *question = NULL;
 
-	result = gp_camera_set_config (cmd_config->camera, cmd_config->window,
-				       cmd_config->context);
+	mark_dirty (cmd_config, widget);
+	result = push_dirty (cmd_config);
 	if (result < 0) {
 		msg[0] = N_("<C></5>Error");
 		msg[1] = "";
@@ -95,6 +170,83 @@ set_config (CmdConfig *cmd_config)
 	return (GP_OK);
 }
 
+static void
+copy_value (CameraWidget *to, CameraWidget *from)
+{
+	CameraWidgetType type;
+	const char *text;
+	float range;
+	int value;
+
+	gp_widget_get_type (to, &type);
+	switch (type) {
+	case GP_WIDGET_TEXT:
+	case GP_WIDGET_MENU:
+	case GP_WIDGET_RADIO:
+		if (gp_widget_get_value (from, &text) == GP_OK)
+			gp_widget_set_value (to, text);
+		break;
+	case GP_WIDGET_RANGE:
+		if (gp_widget_get_value (from, &range) == GP_OK)
+			gp_widget_set_value (to, &range);
+		break;
+	case GP_WIDGET_TOGGLE:
+	case GP_WIDGET_DATE:
+		if (gp_widget_get_value (from, &value) == GP_OK)
+			gp_widget_set_value (to, &value);
+		break;
+	default:
+		return;
+	}
+	/* This is what the camera has, nothing to send. */
+	gp_widget_set_changed (to, 0);
+}
+
+/* Read the values shown in section back, if anything was written since. */
+static void
+refresh_section (CmdConfig *cmd_config, CameraWidget *section)
+{
+	CameraWidget *child, *current;
+	CameraWidgetType type;
+	const char *name;
+	int i, x, count, result;
+
+	if (!cmd_config->written || !cmd_config->single)
+		return;
+	for (i = 0; i < cmd_config->n_fresh; i++)
+		if (cmd_config->fresh[i] == section)
+			return;
+
+	count = gp_widget_count_children (section);
+	for (x = 0; x < count; x++) {
+		if (gp_widget_get_child (section, x, &child) < 0)
+			continue;
+		gp_widget_get_type (child, &type);
+		if ((type == GP_WIDGET_SECTION) || (type == GP_WIDGET_WINDOW))
+			continue;
+		for (i = 0; i < cmd_config->n_dirty; i++)
+			if (cmd_config->dirty[i] == child)
+				break;
+		if (i < cmd_config->n_dirty)
+			continue;
+		gp_widget_get_name (child, &name);
+		result = gp_camera_get_single_config (cmd_config->camera, name,
+					&current, cmd_config->context);
+		if (result == GP_ERROR_NOT_SUPPORTED) {
+			if (cmd_config->single < 0)
+				cmd_config->single = 0;
+			return;
+		}
+		if (result < 0)
+			continue;
+		cmd_config->single = 1;
+		copy_value (child, current);
+		gp_widget_free (current);
+	}
+	if (cmd_config->n_fresh < CMD_CONFIG_MAX_TRACKED)
+		cmd_config->fresh[cmd_config->n_fresh++] = section;
+}
+
 static int
 show_section (CmdConfig *cmd_config, CameraWidget *section)
 {
@@ -107,6 +259,8 @@ show_section (CmdConfig *cmd_config, CameraWidget *section)
 	char title[1024];
 	int show_parent = 0, show_child = 0;
 
+	refresh_section (cmd_config, section);
+
 	/* Create the scroll list */
 	gp_widget_get_type (section, &type);
 	gp_widget_get_label (section, &label);
@@ -194,7 +348,7 @@ show_date (CmdConfig *cmd_config, CameraWidget *date)
 
 		xtime = mktime (date_info);
 		gp_widget_set_value (date, &xtime);
-		set_config (cmd_config);
+		set_config (cmd_config, date);
 	}
 
 	destroyCDKCalendar (calendar);
@@ -279,7 +433,7 @@ show_time (CmdConfig *cmd_config, CameraWidget *date)
 			&date_info->tm_min, &date_info->tm_sec);
 		xtime = mktime (date_info);
 		gp_widget_set_value (date, &xtime);
-		set_config (cmd_config);
+		set_config (cmd_config, date);
 	}
 	destroyCDKEntry (entry);
 	return (GP_OK);
@@ -327,7 +481,7 @@ show_radio (CmdConfig *cmd_config, CameraWidget *radio)
 	if (list->exitType == vNORMAL) {
 		gp_widget_get_choice (radio, selection, &value);
 		gp_widget_set_value (radio, (void *) value);
-		set_config (cmd_config);
+		set_config (cmd_config, radio);
 	}
 
 	destroyCDKItemlist (list);
@@ -355,7 +509,7 @@ show_text (CmdConfig *cmd_config, CameraWidget *text)
 	info = activateCDKEntry (entry, 0);
 	if (entry->exitType == vNORMAL) {
 		gp_widget_set_value (text, info);
-		set_config (cmd_config);
+		set_config (cmd_config, text);
 	}
 	destroyCDKEntry (entry);
 	return (GP_OK);
@@ -383,7 +537,7 @@ show_toggle (CmdConfig *cmd_config, CameraWidget *toggle)
 	if (list->exitType == vNORMAL) {
 		selection = 1 - selection;
 		gp_widget_set_value (toggle, &selection);
-		set_config (cmd_config);
+		set_config (cmd_config, toggle);
 	}
 
 	destroyCDKItemlist (list);
@@ -419,7 +573,7 @@ show_range_int (CmdConfig *cmd_config, CameraWidget *range)
 	if (slider->exitType == vNORMAL) {
 		value = selection;
 		gp_widget_set_value (range, &value);
-		set_config (cmd_config);
+		set_config (cmd_config, range);
 	}
 	
 	destroyCDKSlider (slider);
@@ -482,7 +636,7 @@ show_range_float (CmdConfig *cmd_config, CameraWidget *range)
         if (fscale->exitType == vNORMAL) {
 		value = selection;
                 gp_widget_set_value (range, &value);
-                set_config (cmd_config);
+                set_config (cmd_config, range);
         }
 
         destroyCDKFScale (fscale);
@@ -573,6 +727,8 @@ gp_cmd_config (Camera *camera, GPContext *context)
 	initCDKColor ();
 
 	/* Go! */
+	memset (&cmd_config, 0, sizeof (cmd_config));
+	cmd_config.single  = -1;
 	cmd_config.camera  = camera;
 	cmd_config.screen  = screen;
 	cmd_config.window  = config;
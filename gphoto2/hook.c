@@ -0,0 +1,878 @@
+/* hook.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#define _GNU_SOURCE	/* posix_spawn_file_actions_addclosefrom_np */
+
+#include "config.h"
+#include "gp-params.h"
+#include "hook.h"
+#include "i18n.h"
+#include "main.h"
+#include "probes.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_SYS_WAIT_H
+# include <fcntl.h>
+# include <poll.h>
+# include <signal.h>
+# include <unistd.h>
+# include <sys/types.h>
+# include <sys/wait.h>
+#endif
+
+/* --hook-jobs needs a thread to look after the running scripts. */
+#if defined (HAVE_SYS_WAIT_H) && defined (HAVE_SPAWN_H) && defined (HAVE_PTHREAD)
+# define HOOK_JOBS 1
+# include <pthread.h>
+# include <spawn.h>
+#endif
+
+#include <gphoto2/gphoto2-port-log.h>
+
+/* Where the script finds the answer pipe, keep both in sync. */
+#define HOOK_REPLY_FD	3
+#define HOOK_REPLY_ENV	"GPHOTO2_HOOK_REPLY_FD=3"
+
+#define HOOK_MAX_INFLIGHT 1024
+
+#define HOOK_MAX_JOBS	64
+#define HOOK_QUEUE_PER_JOB 4	/* downloads waiting for a free job */
+#define HOOK_OUTPUT_MAX	65536	/* kept per job and stream */
+
+#ifdef HOOK_JOBS
+typedef struct {
+	char		*action;	/* "ACTION=..." */
+	char		*argument;	/* "ARGUMENT=...", NULL if none */
+} HookEvent;
+
+typedef struct {
+	pid_t		pid;		/* 0 if the slot is free */
+	HookEvent	ev;
+	int		fd[2];		/* its stdout and stderr, -1 at end of file */
+	char		*out[2];
+	size_t		len[2];
+	int		truncated[2];
+	double		start;		/* for the trace */
+} HookJob;
+#endif
+
+struct _GPHook {
+	int		persistent;	/* --hook-persistent */
+	int		nul;		/* NUL instead of newline delimited */
+	int		inflight;	/* 0 if the script does not answer */
+	int		jobs;		/* --hook-jobs, 0 to run them one by one */
+#ifdef HAVE_SYS_WAIT_H
+	pid_t		pid;		/* 0 until the first event */
+	int		in, reply;	/* our ends of the pipes */
+	int		dead;
+
+	/* The records not answered yet, for error messages. */
+	char		**pending;
+	int		first, outstanding;
+
+	char		line[64];	/* partial answer */
+	size_t		len;
+#endif
+#ifdef HOOK_JOBS
+	char		*script;
+	char		**envp;		/* ours, filtered once for all runs */
+	int		envc;
+
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;		/* queue or pool changed */
+	int		wake[2];	/* gets the thread out of poll() */
+	int		started, closing;
+
+	HookEvent	*queue;
+	int		qfirst, queued, qsize;
+	HookJob		*job;		/* jobs slots, NULL until the first event */
+	int		running;
+	unsigned int	done, failed;
+#endif
+};
+
+static GPHook *
+hook_get (GPParams *p)
+{
+	if (!p->hook) {
+		p->hook = calloc (1, sizeof (GPHook));
+		if (!p->hook)
+			return NULL;
+	}
+	return p->hook;
+}
+
+int
+hook_set_persistent (GPParams *p, const char *delim)
+{
+#ifdef HAVE_SYS_WAIT_H
+	int nul = 0;
+
+	if (delim && !strcmp (delim, "nul"))
+		nul = 1;
+	else if (delim && strcmp (delim, "line")) {
+		cli_error_print (_("Invalid hook record delimiter '%s', use 'line' or 'nul'."),
+				 delim);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	if (!hook_get (p))
+		return GP_ERROR_NO_MEMORY;
+	if (p->hook->jobs) {
+		cli_error_print (_("--hook-persistent does not go with --hook-jobs."));
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	p->hook->persistent = 1;
+	p->hook->nul = nul;
+	return GP_OK;
+#else
+	cli_error_print (_("Persistent hook scripts are not supported on this platform."));
+	return GP_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+int
+hook_set_inflight (GPParams *p, const char *count)
+{
+	char	*end;
+	long	n;
+
+	n = strtol (count, &end, 10);
+	if (*end || (n < 1) || (n > HOOK_MAX_INFLIGHT)) {
+		cli_error_print (_("Invalid hook in-flight limit '%s', use 1 to %d."),
+				 count, HOOK_MAX_INFLIGHT);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	/* Implies --hook-persistent. */
+	if ((!p->hook || !p->hook->persistent) &&
+	    (hook_set_persistent (p, NULL) != GP_OK))
+		return GP_ERROR_BAD_PARAMETERS;
+	p->hook->inflight = n;
+	return GP_OK;
+}
+
+int
+hook_set_jobs (GPParams *p, const char *count)
+{
+#ifdef HOOK_JOBS
+	char	*end;
+	long	n;
+
+	n = strtol (count, &end, 10);
+	if (*end || (n < 1) || (n > HOOK_MAX_JOBS)) {
+		cli_error_print (_("Invalid hook job count '%s', use 1 to %d."),
+				 count, HOOK_MAX_JOBS);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	if (!hook_get (p))
+		return GP_ERROR_NO_MEMORY;
+	if (p->hook->persistent) {
+		cli_error_print (_("--hook-jobs does not go with --hook-persistent."));
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	p->hook->jobs = n;
+	return GP_OK;
+#else
+	cli_error_print (_("Parallel hook scripts are not supported on this platform."));
+	return GP_ERROR_NOT_SUPPORTED;
+#endif
+}
+
+#ifdef HAVE_SYS_WAIT_H
+
+/* Our environment without ACTION, ARGUMENT and our own variables,
+ * NULL terminated with room for extra more at the end (*count). */
+static char **
+hook_environment (GPParams *p, int extra, int *count)
+{
+	char	**envp;
+	int	i, n = 0, size = 0;
+
+	while (p->envp && p->envp[size])
+		size++;
+	envp = calloc (size + extra + 1, sizeof (char *));
+	if (!envp)
+		return NULL;
+	for (i = 0; i < size; i++)
+		if (strncmp (p->envp[i], "ACTION=", 7) &&
+		    strncmp (p->envp[i], "ARGUMENT=", 9) &&
+		    strncmp (p->envp[i], "GPHOTO2_HOOK_", 13))
+			envp[n++] = p->envp[i];
+	*count = n;
+	return envp;
+}
+
+static int
+hook_start (GPParams *p, GPHook *h)
+{
+	char	*argv[2], **envp;
+	int	in[2], reply[2] = { -1, -1 }, fd, n;
+
+	h->pending = calloc (h->inflight ? h->inflight : 1, sizeof (char *));
+	envp = hook_environment (p, 2, &n);
+	if (!h->pending || !envp) {
+		free (envp);
+		return GP_ERROR_NO_MEMORY;
+	}
+	envp[n++] = h->nul ? "GPHOTO2_HOOK_PROTOCOL=nul" : "GPHOTO2_HOOK_PROTOCOL=line";
+	if (h->inflight)
+		envp[n] = HOOK_REPLY_ENV;
+	if (pipe (in) || (h->inflight && pipe (reply))) {
+		cli_error_print (_("Could not start hook script '%s': %s"),
+				 p->hook_script, strerror (errno));
+		free (envp);
+		return GP_ERROR_OS_FAILURE;
+	}
+
+	h->pid = fork ();
+	if (h->pid == 0) {
+		/* Only standard input, output, error and the answer pipe. */
+		dup2 (in[0], STDIN_FILENO);
+		if (h->inflight)
+			dup2 (reply[1], HOOK_REPLY_FD);
+		for (fd = h->inflight ? HOOK_REPLY_FD + 1 : 3; fd < 200; fd++)
+			close (fd);
+		argv[0] = p->hook_script;
+		argv[1] = NULL;
+		execve (p->hook_script, argv, envp);
+		fprintf (stderr, "execve(\"%s\") failed: %s\n",
+			 p->hook_script, strerror (errno));
+		_exit (79);
+	}
+
+	free (envp);
+	close (in[0]);
+	if (h->inflight)
+		close (reply[1]);
+	if (h->pid < 0) {
+		cli_error_print (_("Could not start hook script '%s': %s"),
+				 p->hook_script, strerror (errno));
+		close (in[1]);
+		if (h->inflight)
+			close (reply[0]);
+		h->pid = 0;
+		return GP_ERROR_OS_FAILURE;
+	}
+	/* Not for the scripts run by --hook-script without us. */
+	fcntl (in[1], F_SETFD, FD_CLOEXEC);
+	h->in = in[1];
+	h->reply = reply[0];
+	if (h->reply >= 0)
+		fcntl (h->reply, F_SETFD, FD_CLOEXEC);
+	gp_log (GP_LOG_DEBUG, "hook", "Started '%s' as process %d.",
+		p->hook_script, (int) h->pid);
+	return GP_OK;
+}
+
+/*
+ * Reads answers until no more than max records are waiting for one.
+ * Returns how many of the answers were failures.
+ */
+static int
+hook_wait (GPHook *h, int max)
+{
+	struct pollfd	pfd;
+	ssize_t		r;
+	char		*nl, *record;
+	int		failed = 0, status;
+
+	pfd.fd = h->reply;
+	pfd.events = POLLIN;
+	while ((h->outstanding > 0) && !h->dead) {
+		/* Pick up what is there, wait only if we have to. */
+		r = poll (&pfd, 1, (h->outstanding > max) ? -1 : 0);
+		if ((r < 0) && (errno == EINTR))
+			continue;
+		if (r <= 0)
+			break;
+		r = read (h->reply, h->line + h->len, sizeof (h->line) - 1 - h->len);
+		if ((r < 0) && (errno == EINTR))
+			continue;
+		if (r <= 0) {
+			fprintf (stderr, _("Hook script exited with %d events unanswered.\n"),
+				 h->outstanding);
+			h->dead = 1;
+			break;
+		}
+		h->len += r;
+		h->line[h->len] = '\0';
+		while ((h->outstanding > 0) && (nl = strchr (h->line, '\n'))) {
+			*nl = '\0';
+			status = atoi (h->line);
+			record = h->pending[h->first];
+			if (status) {
+				fprintf (stderr, _("Hook script returned error code %d for %s\n"),
+					 status, record);
+				failed++;
+			}
+			free (record);
+			h->pending[h->first] = NULL;
+			h->first = (h->first + 1) % h->inflight;
+			h->outstanding--;
+			h->len -= nl + 1 - h->line;
+			memmove (h->line, nl + 1, h->len + 1);
+		}
+		/* A line longer than any status, drop it. */
+		if (h->len == sizeof (h->line) - 1)
+			h->len = 0;
+	}
+	return failed;
+}
+
+static int
+hook_write (GPHook *h, const char *data, size_t size)
+{
+	void	(*oldpipe)(int);
+	ssize_t	written;
+	int	ret = 0;
+
+	/* A script that died must not take us with it. */
+	oldpipe = signal (SIGPIPE, SIG_IGN);
+	while (size) {
+		written = write (h->in, data, size);
+		if ((written < 0) && (errno == EINTR))
+			continue;
+		if (written <= 0) {
+			fprintf (stderr, _("Hook script stopped reading events: %s\n"),
+				 strerror (errno));
+			h->dead = 1;
+			ret = 1;
+			break;
+		}
+		data += written;
+		size -= written;
+	}
+	signal (SIGPIPE, oldpipe);
+	return ret;
+}
+
+#ifdef HOOK_JOBS
+
+static char *
+hook_envar (const char *name, const char *value)
+{
+	char *envar = malloc (strlen (name) + 1 + strlen (value) + 1);
+
+	if (envar)
+		sprintf (envar, "%s=%s", name, value);
+	return envar;
+}
+
+static void
+hook_event_free (HookEvent *ev)
+{
+	free (ev->action);
+	free (ev->argument);
+	ev->action = ev->argument = NULL;
+}
+
+/* How the output and errors of a run are labelled: the file name for
+ * downloads, else the action. */
+static const char *
+hook_event_name (HookEvent *ev)
+{
+	return ev->argument ? ev->argument + 9 : ev->action + 7;
+}
+
+/*
+ * Starts one run of the script. With a job, its standard output and
+ * error go to pipes we read, else to ours. Standard input is /dev/null
+ * like with spawnve(), and no other descriptor of ours gets through:
+ * the pipes are close-on-exec and closefrom() takes care of the rest
+ * where posix_spawn() has it.
+ */
+static int
+hook_spawn (GPHook *h, HookEvent *ev, HookJob *job, pid_t *pid)
+{
+	posix_spawn_file_actions_t fa;
+	char	*argv[2], **envp;
+	int	out[2] = { -1, -1 }, err[2] = { -1, -1 }, i, n = 0, r;
+
+	envp = malloc ((2 + h->envc + 1) * sizeof (char *));
+	if (!envp)
+		return ENOMEM;
+	envp[n++] = ev->action;
+	if (ev->argument)
+		envp[n++] = ev->argument;
+	memcpy (envp + n, h->envp, (h->envc + 1) * sizeof (char *));
+
+	posix_spawn_file_actions_init (&fa);
+	posix_spawn_file_actions_addopen (&fa, STDIN_FILENO, "/dev/null", O_RDONLY, 0);
+	if (job) {
+		if (pipe (out) || pipe (err)) {
+			r = errno;
+			goto out;
+		}
+		for (i = 0; i < 2; i++) {
+			fcntl (out[i], F_SETFD, FD_CLOEXEC);
+			fcntl (err[i], F_SETFD, FD_CLOEXEC);
+		}
+		posix_spawn_file_actions_adddup2 (&fa, out[1], STDOUT_FILENO);
+		posix_spawn_file_actions_adddup2 (&fa, err[1], STDERR_FILENO);
+	}
+#ifdef HAVE_POSIX_SPAWN_FILE_ACTIONS_ADDCLOSEFROM_NP
+	posix_spawn_file_actions_addclosefrom_np (&fa, 3);
+#endif
+	argv[0] = h->script;
+	argv[1] = NULL;
+	r = posix_spawn (pid, h->script, &fa, NULL, argv, envp);
+
+out:
+	posix_spawn_file_actions_destroy (&fa);
+	free (envp);
+	if (job) {
+		/* Only the script writes to them now. */
+		if (out[1] >= 0)
+			close (out[1]);
+		if (err[1] >= 0)
+			close (err[1]);
+		if (r) {
+			if (out[0] >= 0)
+				close (out[0]);
+			if (err[0] >= 0)
+				close (err[0]);
+			out[0] = err[0] = -1;
+		}
+		job->fd[0] = out[0];
+		job->fd[1] = err[0];
+	}
+	return r;
+}
+
+static void
+hook_report (int status, HookEvent *ev)
+{
+	if (WIFEXITED (status) && WEXITSTATUS (status))
+		fprintf (stderr, _("Hook script returned error code %d for %s\n"),
+			 WEXITSTATUS (status), hook_event_name (ev));
+	else if (WIFSIGNALED (status))
+		fprintf (stderr, _("Hook script killed by signal %d for %s\n"),
+			 WTERMSIG (status), hook_event_name (ev));
+}
+
+/* Called with the lock held, takes the event. */
+static void
+hook_job_start (GPHook *h, HookEvent *ev)
+{
+	HookJob	*job;
+	int	r;
+
+	for (job = h->job; job->pid; job++)
+		;
+	job->ev = *ev;
+	job->start = trace_begin ();
+	r = hook_spawn (h, &job->ev, job, &job->pid);
+	if (r) {
+		fprintf (stderr, _("Could not start hook script '%s' for %s: %s\n"),
+			 h->script, hook_event_name (&job->ev), strerror (r));
+		hook_event_free (&job->ev);
+		job->pid = 0;
+		h->done++;
+		h->failed++;
+		return;
+	}
+	PROBE2 (hook_job_start, (int) job->pid, hook_event_name (&job->ev));
+	h->running++;
+}
+
+static void
+hook_job_read (HookJob *job, int k)
+{
+	char	buf[4096];
+	ssize_t	r;
+
+	r = read (job->fd[k], buf, sizeof (buf));
+	if ((r < 0) && ((errno == EINTR) || (errno == EAGAIN)))
+		return;
+	if (r <= 0) {
+		close (job->fd[k]);
+		job->fd[k] = -1;
+		return;
+	}
+	/* Keep reading past the limit, the script must not block on us. */
+	if (job->len[k] + r > HOOK_OUTPUT_MAX) {
+		job->truncated[k] = 1;
+		r = HOOK_OUTPUT_MAX - job->len[k];
+	}
+	if (!r)
+		return;
+	if (!job->out[k]) {
+		job->out[k] = malloc (HOOK_OUTPUT_MAX);
+		if (!job->out[k]) {
+			job->truncated[k] = 1;
+			return;
+		}
+	}
+	memcpy (job->out[k] + job->len[k], buf, r);
+	job->len[k] += r;
+}
+
+/* Passes the output on in one piece, every line marked with its file. */
+static void
+hook_job_output (HookJob *job, int k, FILE *f)
+{
+	const char	*name = hook_event_name (&job->ev);
+	char		*line = job->out[k], *end = line + job->len[k], *nl;
+
+	if (!job->len[k] && !job->truncated[k])
+		return;
+	flockfile (f);
+	while (line < end) {
+		nl = memchr (line, '\n', end - line);
+		if (!nl)
+			nl = end;
+		fprintf (f, "%s: %.*s\n", name, (int) (nl - line), line);
+		line = nl + 1;
+	}
+	if (job->truncated[k])
+		fprintf (f, "%s: [...]\n", name);
+	fflush (f);
+	funlockfile (f);
+}
+
+/* The script closed its output, wait for it and pass everything on.
+ * Returns 1 if it failed. */
+static int
+hook_job_finish (HookJob *job)
+{
+	int status = 0, k;
+
+	while ((waitpid (job->pid, &status, 0) < 0) && (errno == EINTR))
+		;
+	PROBE2 (hook_job_done, (int) job->pid, status);
+	trace_async ("hook", "hook_job", (unsigned long) job->pid, job->start,
+		     hook_event_name (&job->ev));
+	hook_job_output (job, 0, stdout);
+	hook_job_output (job, 1, stderr);
+	hook_report (status, &job->ev);
+
+	for (k = 0; k < 2; k++)
+		free (job->out[k]);
+	hook_event_free (&job->ev);
+	memset (job, 0, sizeof (HookJob));
+	return !WIFEXITED (status) || WEXITSTATUS (status);
+}
+
+/*
+ * Starts queued events while there is a free job and collects the
+ * output of the running ones. Only this thread touches the jobs, the
+ * lock protects the queue and the counters.
+ */
+static void *
+hook_thread (void *data)
+{
+	GPHook		*h = data;
+	struct pollfd	pfd[1 + 2 * HOOK_MAX_JOBS];
+	char		buf[64];
+	int		i, k, failed;
+
+	trace_thread_name ("hook");
+	pthread_mutex_lock (&h->lock);
+	for (;;) {
+		while (h->queued && (h->running < h->jobs)) {
+			hook_job_start (h, &h->queue[h->qfirst]);
+			h->qfirst = (h->qfirst + 1) % h->qsize;
+			h->queued--;
+			pthread_cond_broadcast (&h->cond);
+		}
+		if (h->closing && !h->queued && !h->running)
+			break;
+		pthread_mutex_unlock (&h->lock);
+
+		pfd[0].fd = h->wake[0];
+		pfd[0].events = POLLIN;
+		for (i = 0; i < h->jobs; i++)
+			for (k = 0; k < 2; k++) {
+				/* poll() skips negative descriptors. */
+				pfd[1 + 2 * i + k].fd = h->job[i].pid ? h->job[i].fd[k] : -1;
+				pfd[1 + 2 * i + k].events = POLLIN;
+			}
+		if (poll (pfd, 1 + 2 * h->jobs, -1) > 0) {
+			if (pfd[0].revents)
+				while (read (h->wake[0], buf, sizeof (buf)) > 0)
+					;
+			for (i = 0; i < h->jobs; i++)
+				for (k = 0; k < 2; k++)
+					if (pfd[1 + 2 * i + k].revents)
+						hook_job_read (&h->job[i], k);
+		}
+
+		failed = 0;
+		for (i = 0, k = 0; i < h->jobs; i++)
+			if (h->job[i].pid && (h->job[i].fd[0] < 0) &&
+			    (h->job[i].fd[1] < 0)) {
+				failed += hook_job_finish (&h->job[i]);
+				k++;
+			}
+		pthread_mutex_lock (&h->lock);
+		h->running -= k;
+		h->done += k;
+		h->failed += failed;
+		if (k)
+			pthread_cond_broadcast (&h->cond);
+	}
+	pthread_mutex_unlock (&h->lock);
+	return NULL;
+}
+
+static void
+hook_wake (GPHook *h)
+{
+	ssize_t r;
+
+	r = write (h->wake[1], "", 1);
+	(void) r; /* A full pipe wakes it up as well. */
+}
+
+static int
+hook_pool_start (GPParams *p, GPHook *h)
+{
+	h->script = strdup (p->hook_script);
+	h->envp = hook_environment (p, 0, &h->envc);
+	h->qsize = HOOK_QUEUE_PER_JOB * h->jobs;
+	h->queue = calloc (h->qsize, sizeof (HookEvent));
+	h->job = calloc (h->jobs, sizeof (HookJob));
+	if (!h->script || !h->envp || !h->queue || !h->job)
+		return GP_ERROR_NO_MEMORY;
+	if (pipe (h->wake))
+		return GP_ERROR_OS_FAILURE;
+	fcntl (h->wake[0], F_SETFD, FD_CLOEXEC);
+	fcntl (h->wake[1], F_SETFD, FD_CLOEXEC);
+	fcntl (h->wake[0], F_SETFL, O_NONBLOCK);
+	fcntl (h->wake[1], F_SETFL, O_NONBLOCK);
+	pthread_mutex_init (&h->lock, NULL);
+	pthread_cond_init (&h->cond, NULL);
+	if (pthread_create (&h->thread, NULL, hook_thread, h)) {
+		pthread_cond_destroy (&h->cond);
+		pthread_mutex_destroy (&h->lock);
+		return GP_ERROR_OS_FAILURE;
+	}
+	h->started = 1;
+	gp_log (GP_LOG_DEBUG, "hook", "Running up to %d hook scripts at a time.",
+		h->jobs);
+	return GP_OK;
+}
+
+/* Waits until no run is queued or running. */
+static void
+hook_pool_drain (GPHook *h)
+{
+	pthread_mutex_lock (&h->lock);
+	while (h->queued || h->running)
+		pthread_cond_wait (&h->cond, &h->lock);
+	pthread_mutex_unlock (&h->lock);
+}
+
+static void
+hook_pool_close (GPHook *h)
+{
+	int i;
+
+	if (h->started) {
+		pthread_mutex_lock (&h->lock);
+		h->closing = 1;
+		pthread_mutex_unlock (&h->lock);
+		hook_wake (h);
+		pthread_join (h->thread, NULL);
+		pthread_cond_destroy (&h->cond);
+		pthread_mutex_destroy (&h->lock);
+		if (h->failed)
+			fprintf (stderr, _("Hook script failed for %u of %u downloads.\n"),
+				 h->failed, h->done);
+	}
+	for (i = 0; i < 2; i++)
+		if (h->wake[i] > 0)
+			close (h->wake[i]);	/* 0 if never opened */
+	free (h->queue);
+	free (h->job);
+	free (h->envp);
+	free (h->script);
+}
+
+/*
+ * Downloads go through the pool and may finish in any order. Anything
+ * else waits for them and runs on its own, so the script sees stop
+ * after the last download and its answer to init still counts.
+ */
+static int
+hook_jobs_send (GPParams *p, GPHook *h, const char *action, const char *argument)
+{
+	HookEvent	ev;
+	pid_t		pid;
+	int		status, r;
+
+	if (!h->started && !h->dead) {
+		r = hook_pool_start (p, h);
+		if (r != GP_OK) {
+			cli_error_print (_("Could not start hook script '%s': %s"),
+					 p->hook_script, gp_result_as_string (r));
+			h->dead = 1;
+		}
+	}
+	if (h->dead)
+		return 1;
+
+	ev.action = hook_envar ("ACTION", action);
+	ev.argument = argument ? hook_envar ("ARGUMENT", argument) : NULL;
+	if (!ev.action || (argument && !ev.argument)) {
+		hook_event_free (&ev);
+		return 1;
+	}
+
+	if (!strcmp (action, "download")) {
+		/* Only wait if the queue is full. */
+		pthread_mutex_lock (&h->lock);
+		while (h->queued == h->qsize)
+			pthread_cond_wait (&h->cond, &h->lock);
+		h->queue[(h->qfirst + h->queued) % h->qsize] = ev;
+		h->queued++;
+		pthread_mutex_unlock (&h->lock);
+		hook_wake (h);
+		return 0;
+	}
+
+	hook_pool_drain (h);
+	r = hook_spawn (h, &ev, NULL, &pid);
+	if (r) {
+		fprintf (stderr, _("Could not start hook script '%s' for %s: %s\n"),
+			 h->script, action, strerror (r));
+		hook_event_free (&ev);
+		return 1;
+	}
+	while ((waitpid (pid, &status, 0) < 0) && (errno == EINTR))
+		;
+	hook_report (status, &ev);
+	hook_event_free (&ev);
+	return (!WIFEXITED (status) || WEXITSTATUS (status)) ? 1 : 0;
+}
+
+#endif /* HOOK_JOBS */
+
+int
+hook_send (GPParams *p, const char *action, const char *argument)
+{
+	GPHook	*h = p->hook;
+	char	*record;
+	size_t	alen, size;
+	int	ret;
+
+#ifdef HOOK_JOBS
+	if (h->jobs)
+		return hook_jobs_send (p, h, action, argument);
+#endif
+	if (!h->pid && !h->dead && (hook_start (p, h) != GP_OK))
+		h->dead = 1;
+	if (h->dead)
+		return 1;
+	if (!argument)
+		argument = "";
+
+	alen = strlen (action);
+	size = alen + 1 + strlen (argument) + 1;
+	record = malloc (size + 1);
+	if (!record)
+		return 1;
+	sprintf (record, "%s%c%s%c", action, h->nul ? '\0' : ' ', argument,
+		 h->nul ? '\0' : '\n');
+	if (h->inflight) {
+		hook_wait (h, h->inflight - 1);
+		if (h->dead) {
+			free (record);
+			return 1;
+		}
+	}
+	ret = hook_write (h, record, size);
+	if (ret || !h->inflight) {
+		free (record);
+		return ret;
+	}
+
+	/* Keep it for the error message, as "action argument". */
+	record[alen] = *argument ? ' ' : '\0';
+	record[size - 1] = '\0';
+	h->pending[(h->first + h->outstanding) % h->inflight] = record;
+	h->outstanding++;
+	/* Everything else may run ahead, init decides whether we go on. */
+	if (!strcmp (action, "init"))
+		return (hook_wait (h, 0) || h->dead) ? 1 : 0;
+	return 0;
+}
+
+void
+hook_close (GPParams *p)
+{
+	GPHook	*h = p->hook;
+	int	status = 0, i;
+
+	if (!h)
+		return;
+#ifdef HOOK_JOBS
+	if (h->jobs)
+		hook_pool_close (h);
+#endif
+	if (h->pid > 0) {
+		close (h->in);
+		if (h->reply >= 0) {
+			hook_wait (h, 0);
+			close (h->reply);
+		}
+		while ((waitpid (h->pid, &status, 0) < 0) && (errno == EINTR))
+			;
+		if (WIFEXITED (status) && WEXITSTATUS (status))
+			fprintf (stderr, _("Hook script returned error code %d\n"),
+				 WEXITSTATUS (status));
+		else if (WIFSIGNALED (status))
+			fprintf (stderr, _("Hook script killed by signal %d\n"),
+				 WTERMSIG (status));
+	}
+	for (i = 0; h->pending && (i < h->inflight); i++)
+		free (h->pending[i]);
+	free (h->pending);
+	free (h);
+	p->hook = NULL;
+}
+
+#else /* !HAVE_SYS_WAIT_H */
+
+int
+hook_send (GPParams *p, const char *action, const char *argument)
+{
+	return 1;
+}
+
+void
+hook_close (GPParams *p)
+{
+	free (p->hook);
+	p->hook = NULL;
+}
+
+#endif /* HAVE_SYS_WAIT_H */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
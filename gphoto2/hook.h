@@ -0,0 +1,70 @@
+/* hook.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_HOOK_H
+#define GPHOTO2_HOOK_H
+
+#include <gp-params.h>
+
+/*
+ * --hook-persistent starts the hook script once and writes one record
+ * per event to its standard input instead of running it per event:
+ *
+ *   line: ACTION ' ' ARGUMENT '\n'   (read -r action argument)
+ *   nul:  ACTION '\0' ARGUMENT '\0'  (for file names with newlines)
+ *
+ * GPHOTO2_HOOK_PROTOCOL in its environment is "line" or "nul". With
+ * --hook-inflight N the script also answers every record with its exit
+ * status on a line of its own on the file descriptor named in
+ * GPHOTO2_HOOK_REPLY_FD, and gphoto2 waits once N records are not
+ * answered yet. The answer to init decides whether gphoto2 goes on.
+ * The script sees end of file on standard input after stop.
+ *
+ * --hook-jobs N still runs the script once per event, but downloads
+ * are handed to a thread that runs up to N of them at a time, so the
+ * next transfer does not wait for the script. Once N * 4 more are
+ * queued, gphoto2 waits for a free job. Downloads may finish in any
+ * order; init, start and stop wait for all earlier runs and run on
+ * their own. The output of a download run is printed when it ends,
+ * every line prefixed with the file name. A failed run is reported
+ * with its file name and does not stop the downloads.
+ */
+
+/* --hook-persistent [line|nul] */
+int  hook_set_persistent (GPParams *p, const char *delim);
+/* --hook-inflight COUNT */
+int  hook_set_inflight   (GPParams *p, const char *count);
+/* --hook-jobs COUNT */
+int  hook_set_jobs       (GPParams *p, const char *count);
+
+/* Returns 0 if the event was handed over (and answered with 0, or
+ * queued), else 1, like gp_params_run_hook(). */
+int  hook_send  (GPParams *p, const char *action, const char *argument);
+
+/* Ends the co-process or waits for the queued runs. */
+void hook_close (GPParams *p);
+
+#endif /* !defined(GPHOTO2_HOOK_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
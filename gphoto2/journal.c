@@ -0,0 +1,238 @@
+/* journal.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "gp-params.h"
+#include "i18n.h"
+#include "journal.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gphoto2/gphoto2-port-log.h>
+
+struct _GPJournal {
+	FILE		*f;
+
+	/* Open addressed hash table of "<kind> <what>" lines. */
+	char		**slots;
+	unsigned int	size, used;
+
+	unsigned int	frames;
+};
+
+static unsigned int
+journal_hash (const char *s)
+{
+	unsigned int h = 2166136261u;
+
+	while (*s) {
+		h ^= (unsigned char) *s++;
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static char **
+journal_lookup (GPJournal *j, const char *line)
+{
+	unsigned int i = journal_hash (line) & (j->size - 1);
+
+	while (j->slots[i] && strcmp (j->slots[i], line))
+		i = (i + 1) & (j->size - 1);
+	return &j->slots[i];
+}
+
+/* Takes ownership of line. */
+static int
+journal_insert (GPJournal *j, char *line)
+{
+	char **slot;
+
+	if (2 * (j->used + 1) > j->size) {
+		char **old = j->slots;
+		unsigned int i, oldsize = j->size;
+
+		j->size = oldsize ? 2 * oldsize : 256;
+		j->slots = calloc (j->size, sizeof (char *));
+		if (!j->slots) {
+			j->slots = old;
+			j->size = oldsize;
+			free (line);
+			return GP_ERROR_NO_MEMORY;
+		}
+		for (i = 0; i < oldsize; i++)
+			if (old[i])
+				*journal_lookup (j, old[i]) = old[i];
+		free (old);
+	}
+	slot = journal_lookup (j, line);
+	if (*slot) {
+		free (line);
+		return GP_OK;
+	}
+	*slot = line;
+	j->used++;
+	if (!strncmp (line, "frame ", 6)) {
+		unsigned int frame = strtoul (line + 6, NULL, 10);
+
+		if (frame > j->frames)
+			j->frames = frame;
+	}
+	return GP_OK;
+}
+
+static char *
+journal_line (const char *kind, const char *what)
+{
+	char *line = malloc (strlen (kind) + 1 + strlen (what) + 1);
+
+	if (line)
+		sprintf (line, "%s %s", kind, what);
+	return line;
+}
+
+int
+journal_open (GPParams *p, const char *filename)
+{
+	GPJournal *j;
+	char buf[4096];
+	long start = 0, partial = -1;
+
+	journal_close (p);
+
+	j = calloc (1, sizeof (GPJournal));
+	if (!j)
+		return GP_ERROR_NO_MEMORY;
+	j->f = fopen (filename, "a+");
+	if (!j->f) {
+		gp_context_error (p->context,
+			_("Could not open journal file '%s': %s"),
+			filename, strerror (errno));
+		free (j);
+		return GP_ERROR_OS_FAILURE;
+	}
+
+	rewind (j->f);
+	while (fgets (buf, sizeof (buf), j->f)) {
+		size_t len = strlen (buf);
+
+		/* A line without newline was cut off by a crash, drop it. */
+		if (!len || buf[len - 1] != '\n') {
+			partial = start;
+			break;
+		}
+		start = ftell (j->f);
+		buf[len - 1] = '\0';
+		if (buf[0] && (journal_insert (j, strdup (buf)) < GP_OK))
+			break;
+	}
+	fflush (j->f);
+	p->journal = j;
+	/* New entries must not be appended to the cut off line. */
+	if ((partial >= 0) && ftruncate (fileno (j->f), partial)) {
+		gp_context_error (p->context,
+			_("Could not truncate journal file '%s': %s"),
+			filename, strerror (errno));
+		journal_close (p);
+		return GP_ERROR_OS_FAILURE;
+	}
+
+	gp_log (GP_LOG_DEBUG, "journal", "Loaded %u entries from '%s'.",
+		j->used, filename);
+	return GP_OK;
+}
+
+void
+journal_close (GPParams *p)
+{
+	GPJournal *j = p->journal;
+	unsigned int i;
+
+	if (!j)
+		return;
+	fclose (j->f);
+	for (i = 0; i < j->size; i++)
+		free (j->slots[i]);
+	free (j->slots);
+	free (j);
+	p->journal = NULL;
+}
+
+int
+journal_has (GPParams *p, const char *kind, const char *what)
+{
+	char *line;
+	int found;
+
+	if (!p->journal || !p->journal->used)
+		return 0;
+	line = journal_line (kind, what);
+	if (!line)
+		return 0;
+	found = (*journal_lookup (p->journal, line) != NULL);
+	free (line);
+	return found;
+}
+
+void
+journal_add (GPParams *p, const char *kind, const char *what)
+{
+	char *line;
+
+	if (!p->journal)
+		return;
+	line = journal_line (kind, what);
+	if (!line)
+		return;
+	if (p->journal->slots && *journal_lookup (p->journal, line)) {
+		free (line);
+		return;
+	}
+	/* Get it on disk before we move on, a crash may follow. */
+	fprintf (p->journal->f, "%s\n", line);
+	fflush (p->journal->f);
+	fsync (fileno (p->journal->f));
+	journal_insert (p->journal, line);
+}
+
+unsigned int
+journal_frames (GPParams *p)
+{
+	return p->journal ? p->journal->frames : 0;
+}
+
+void
+journal_add_frame (GPParams *p, unsigned int frame)
+{
+	char buf[16];
+
+	snprintf (buf, sizeof (buf), "%u", frame);
+	journal_add (p, "frame", buf);
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,47 @@
+/* journal.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_JOURNAL_H
+#define GPHOTO2_JOURNAL_H
+
+#include <gp-params.h>
+
+/*
+ * The journal remembers which operations of a long batch job have
+ * already completed, one "<kind> <what>" line per operation, so that
+ * a rerun (or a run that lost the camera) can skip them.
+ */
+int  journal_open   (GPParams *p, const char *filename);
+void journal_close  (GPParams *p);
+
+int  journal_has    (GPParams *p, const char *kind, const char *what);
+void journal_add    (GPParams *p, const char *kind, const char *what);
+
+/* Highest "frame" number recorded, 0 if none. */
+unsigned int journal_frames (GPParams *p);
+void journal_add_frame      (GPParams *p, unsigned int frame);
+
+#endif /* !defined(GPHOTO2_JOURNAL_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
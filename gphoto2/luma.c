@@ -0,0 +1,140 @@
+/* luma.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "luma.h"
+
+#include <setjmp.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <jpeglib.h>
+
+#include <gphoto2/gphoto2-result.h>
+
+struct luma_jpeg_error {
+	struct jpeg_error_mgr	pub;
+	jmp_buf			jmp;
+};
+
+static void
+luma_jpeg_exit (j_common_ptr cinfo)
+{
+	longjmp (((struct luma_jpeg_error *) cinfo->err)->jmp, 1);
+}
+
+static void
+luma_jpeg_message (j_common_ptr cinfo)
+{
+	/* A corrupt frame is skipped, no need to tell. */
+}
+
+/*
+ * Grayscale output lets libjpeg skip the chroma planes, and scaling in
+ * the IDCT by up to 1/8 leaves a fraction of the work. Rows below the
+ * region are not decoded at all.
+ */
+int
+luma_decode (LumaImage *img, const char *data, unsigned long size,
+	     unsigned int min_width, const unsigned int *roi)
+{
+	static const unsigned int	all[4] = { 0, 0, 100, 100 };
+	struct jpeg_decompress_struct	cinfo;
+	struct luma_jpeg_error		jerr;
+	unsigned char * volatile	line = NULL;
+	JSAMPROW			row;
+	unsigned int			denom, ow, oh, x0, y0, w, h, y;
+
+	if (!roi)
+		roi = all;
+	cinfo.err = jpeg_std_error (&jerr.pub);
+	jerr.pub.error_exit = luma_jpeg_exit;
+	jerr.pub.output_message = luma_jpeg_message;
+	if (setjmp (jerr.jmp)) {
+		jpeg_destroy_decompress (&cinfo);
+		free (line);
+		return GP_ERROR_CORRUPTED_DATA;
+	}
+	jpeg_create_decompress (&cinfo);
+	jpeg_mem_src (&cinfo, (unsigned char *) data, size);
+	jpeg_read_header (&cinfo, TRUE);
+
+	for (denom = 8; (denom > 1) && (cinfo.image_width / denom < min_width); denom /= 2)
+		;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = denom;
+	cinfo.out_color_space = JCS_GRAYSCALE;
+	cinfo.dct_method = JDCT_IFAST;
+	cinfo.do_fancy_upsampling = FALSE;
+	cinfo.do_block_smoothing = FALSE;
+	jpeg_start_decompress (&cinfo);
+	ow = cinfo.output_width;
+	oh = cinfo.output_height;
+
+	x0 = roi[0] * ow / 100;
+	y0 = roi[1] * oh / 100;
+	w = roi[2] * ow / 100;
+	h = roi[3] * oh / 100;
+	w = w ? w : 1;
+	h = h ? h : 1;
+	if (x0 + w > ow)
+		x0 = ow - w;
+	if (y0 + h > oh)
+		y0 = oh - h;
+
+	if (img->alloc < (size_t) w * h) {
+		unsigned char *d = realloc (img->data, (size_t) w * h);
+
+		if (!d)
+			longjmp (jerr.jmp, 1);
+		img->data = d;
+		img->alloc = (size_t) w * h;
+	}
+	line = malloc (ow);
+	if (!line)
+		longjmp (jerr.jmp, 1);
+
+	row = line;
+	for (y = 0; y < y0 + h; y++) {
+		jpeg_read_scanlines (&cinfo, &row, 1);
+		if (y >= y0)
+			memcpy (img->data + (size_t) (y - y0) * w, line + x0, w);
+	}
+	/* Dropping the rest of the frame is fine, nobody reads it. */
+	jpeg_destroy_decompress (&cinfo);
+	free (line);
+	img->width = w;
+	img->height = h;
+	return GP_OK;
+}
+
+void
+luma_image_clear (LumaImage *img)
+{
+	free (img->data);
+	memset (img, 0, sizeof (LumaImage));
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,49 @@
+/* luma.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_LUMA_H
+#define GPHOTO2_LUMA_H
+
+#include <stddef.h>
+
+/* 8 bit luma, width x height, row after row. */
+typedef struct {
+	unsigned char	*data;
+	size_t		alloc;
+	int		width, height;
+} LumaImage;
+
+/*
+ * Decodes the luma of a JPEG preview frame into img, scaled down in the
+ * IDCT as far as possible while staying at least min_width wide. roi is
+ * left, top, width and height in percent of the frame, NULL for all of
+ * it. Returns GP_ERROR_CORRUPTED_DATA for frames libjpeg rejects.
+ */
+int  luma_decode      (LumaImage *img, const char *data, unsigned long size,
+		       unsigned int min_width, const unsigned int *roi);
+void luma_image_clear (LumaImage *img);
+
+#endif /* !defined(GPHOTO2_LUMA_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -26,15 +26,31 @@
 #include <signal.h>
 #endif
 #include "actions.h"
+#include "benchmark.h"
+#include "capstats.h"
+#include "debuglog.h"
+#include "exposure.h"
 #include "foreach.h"
+#include "hook.h"
 #include <gphoto2/gphoto2-port-info-list.h>
 #include <gphoto2/gphoto2-port-log.h>
 #include <gphoto2/gphoto2-setting.h>
 #include "gp-params.h"
 #include "i18n.h"
+#include "journal.h"
 #include "main.h"
+#include "metrics.h"
+#include "motion.h"
+#include "movie.h"
+#include "preview.h"
+#include "probes.h"
+#include "progress.h"
 #include "range.h"
+#include "reconnect.h"
+#include "serve.h"
+#include "shmring.h"
 #include "shell.h"
+#include "trace.h"
 
 #ifdef HAVE_CDK
 #  include "gphoto2-cmd-config.h"
@@ -51,6 +67,7 @@
 #include <utime.h>
 #include <limits.h>
 #include <errno.h>
+#include <sys/stat.h>
 #include <sys/time.h>
 
 #include <popt.h>
@@ -367,14 +384,123 @@ get_path_for_file (const char *folder, const char *name, CameraFileType type, Ca
 }
 
 
-int
-save_camera_file_to_file (
-	const char *folder, const char *name, CameraFileType type, CameraFile *file, const char *curname
+/* 64 bit FNV-1a, fed in chunks while streaming a file. */
+static uint64_t
+hash_update (uint64_t h, const unsigned char *buf, size_t len)
+{
+	while (len--) {
+		h ^= *buf++;
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+#define HASH_INIT 14695981039346656037ULL
+
+/* The download file handler, which counts and hashes what it is given. */
+struct privstr {
+	int fd;
+	uint64_t received;
+	uint64_t hash;
+};
+
+/*
+ * For --move: get the saved file onto stable storage and check that it
+ * is what libgphoto2 delivered before the copy on the camera is allowed
+ * to go away. GP_ERROR_NOT_SUPPORTED if there is nothing to check it
+ * against.
+ */
+static int
+verify_saved_file (const char *folder, const char *name, const char *s,
+		   const struct privstr *ps)
+{
+	CameraFileInfo info;
+	struct stat st;
+	char dir[1024], *slash;
+	int fd, res = GP_OK, checked = 0;
+
+	fd = open (s, O_RDONLY);
+	if (fd < 0) {
+		cli_error_print (_("Could not open %s for verification."), s);
+		return GP_ERROR_OS_FAILURE;
+	}
+	if ((fsync (fd) == -1) && (errno != EINVAL)) {
+		cli_error_print (_("Could not sync %s to disk."), s);
+		res = GP_ERROR_OS_FAILURE;
+	}
+	if ((res == GP_OK) && (fstat (fd, &st) == -1)) {
+		cli_error_print (_("Could not stat %s."), s);
+		res = GP_ERROR_OS_FAILURE;
+	}
+	if ((res == GP_OK) && ps && ((uint64_t) st.st_size != ps->received)) {
+		cli_error_print (_("%s has %lu bytes, but %lu were downloaded."),
+				 s, (unsigned long) st.st_size,
+				 (unsigned long) ps->received);
+		res = GP_ERROR_CORRUPTED_DATA;
+	}
+	if ((res == GP_OK) &&
+	    (metered_camera_file_get_info (gp_params.camera, folder, name, &info,
+					   gp_params.context) == GP_OK) &&
+	    (info.file.fields & GP_FILE_INFO_SIZE)) {
+		checked = 1;
+		if (info.file.size != (uint64_t) st.st_size) {
+			cli_error_print (_("%s has %lu bytes, but the camera reports %lu."),
+					 s, (unsigned long) st.st_size,
+					 (unsigned long) info.file.size);
+			res = GP_ERROR_CORRUPTED_DATA;
+		}
+	}
+	/* Covers the rename or the copy across filesystems as well. */
+	if ((res == GP_OK) && ps) {
+		unsigned char buf[65536];
+		uint64_t h = HASH_INIT;
+		ssize_t len;
+
+		checked = 1;
+		while ((len = read (fd, buf, sizeof (buf))) > 0)
+			h = hash_update (h, buf, len);
+		if ((len < 0) || (h != ps->hash)) {
+			cli_error_print (_("%s does not match the downloaded data."), s);
+			res = GP_ERROR_CORRUPTED_DATA;
+		}
+	}
+	if ((res == GP_OK) && !checked) {
+		cli_error_print (_("Nothing to verify %s against, keeping it on the camera."), s);
+		res = GP_ERROR_NOT_SUPPORTED;
+	}
+	close (fd);
+	if (res != GP_OK)
+		return res;
+
+	/* The rename is only durable once the directory is synced. */
+	strncpy (dir, s, sizeof (dir) - 1);
+	dir[sizeof (dir) - 1] = '\0';
+	slash = strrchr (dir, gp_system_dir_delim);
+	if (slash == dir)
+		slash[1] = '\0';
+	else if (slash)
+		*slash = '\0';
+	else
+		strcpy (dir, ".");
+	fd = open (dir, O_RDONLY);
+	if (fd >= 0) {
+		fsync (fd);
+		close (fd);
+	}
+	return GP_OK;
+}
+
+/* ps, if given, is the handler that received the data of curname. */
+static int
+do_save_camera_file_to_file (
+	const char *folder, const char *name, CameraFileType type, CameraFile *file, const char *curname,
+	const struct privstr *ps
 ) {
 	char *path = NULL, s[1024], c[1024];
 	int res;
 	time_t mtime;
 	struct utimbuf u;
+	double hookstart;
 
 	CR (get_path_for_file (folder, name, type, file, &path));
 	strncpy (s, path, sizeof (s) - 1);
@@ -457,7 +583,7 @@ save_camera_file_to_file (
 
 				while (1) {
 					ssize_t result = read(in_fd, buf, sizeof(buf));
-					if (!result) break;
+					if (result <= 0) break;
 					if (-1 == write(out_fd, buf, result)) {
 						perror("write");
 						break;
@@ -479,17 +605,34 @@ save_camera_file_to_file (
                 u.modtime = mtime;
                 utime (s, &u);
         }
+	if ((gp_params.flags & FLAGS_MOVE) && folder && curname &&
+	    (type == GP_FILE_TYPE_NORMAL)) {
+		res = verify_saved_file (folder, name, s, ps);
+		if (res == GP_OK)
+			res = move_queue_add (&gp_params, folder, name);
+		if ((res != GP_OK) && (res != GP_ERROR_NOT_SUPPORTED))
+			return res;
+	}
+	hookstart = capstats_begin ();
 	gp_params_run_hook(&gp_params, "download", s);
+	capstats_stage (CAPSTATS_HOOK, hookstart);
 	return (GP_OK);
 }
 
+int
+save_camera_file_to_file (
+	const char *folder, const char *name, CameraFileType type, CameraFile *file, const char *curname
+) {
+	return do_save_camera_file_to_file (folder, name, type, file, curname, NULL);
+}
+
 int
 camera_file_exists (Camera *camera, GPContext *context, const char *folder,
 		    const char *filename, CameraFileType type)
 {
 	CameraFileInfo info;
-	CR (gp_camera_file_get_info (camera, folder, filename, &info,
-				     context));
+	CR (metered_camera_file_get_info (camera, folder, filename, &info,
+					  context));
 	switch (type) {
 	case GP_FILE_TYPE_METADATA:
 		return TRUE;
@@ -506,10 +649,6 @@ camera_file_exists (Camera *camera, GPContext *context, const char *folder,
 	}
 }
 
-struct privstr {
-	int fd;
-};
-
 static int x_size(void*priv,uint64_t *size) {
 	struct privstr *ps = priv;
 	int fd = ps->fd;
@@ -565,16 +704,18 @@ static int x_write(void*priv,unsigned char *data, uint64_t *size) {
 		if (!res) break;
 		curwritten += res;
 	}
+	ps->received += curwritten;
+	ps->hash = hash_update (ps->hash, data, curwritten);
 	*size = curwritten;
 	return GP_OK;
 }
 
 static CameraFileHandler xhandler = { x_size, x_read, x_write };
 
-int
-save_file_to_file (Camera *camera, GPContext *context, Flags flags,
-		   const char *folder, const char *filename,
-		   CameraFileType type)
+static int
+do_save_file_to_file (Camera *camera, GPContext *context, Flags flags,
+		      const char *folder, const char *filename,
+		      CameraFileType type)
 {
         int fd, res;
         CameraFile *file;
@@ -600,8 +741,8 @@ save_file_to_file (Camera *camera, GPContext *context, Flags flags,
 	if (flags & FLAGS_NEW) {
 		CameraFileInfo info;
 		
-		CR (gp_camera_file_get_info (camera, folder, filename,
-					     &info, context));
+		CR (metered_camera_file_get_info (camera, folder, filename,
+						  &info, context));
 		switch (type) {
 		case GP_FILE_TYPE_PREVIEW:
 			if (info.preview.fields & GP_FILE_INFO_STATUS &&
@@ -634,7 +775,8 @@ save_file_to_file (Camera *camera, GPContext *context, Flags flags,
 	    CR (gp_file_new (&file));
 	    tmpfilename = NULL;
 	} else {
-		if (time(NULL) & 1) { /* to test both methods. */
+		/* --move checks the saved file against what the handler got. */
+		if (!(flags & FLAGS_MOVE) && (time(NULL) & 1)) { /* to test both methods. */
 			gp_log (GP_LOG_DEBUG, "save_file_to_file","using fd method");
 			res = gp_file_new_from_fd (&file, fd);
 			if (res < GP_OK) {
@@ -647,6 +789,8 @@ save_file_to_file (Camera *camera, GPContext *context, Flags flags,
 			ps = malloc (sizeof(*ps));
 			if (!ps) return GP_ERROR_NO_MEMORY;
 			ps->fd = fd;
+			ps->received = 0;
+			ps->hash = HASH_INIT;
 			/* just pass in the file pointer as private */
 			res = gp_file_new_from_handler (&file, &xhandler, ps);
 			if (res < GP_OK) {
@@ -657,14 +801,46 @@ save_file_to_file (Camera *camera, GPContext *context, Flags flags,
 		}
 		tmpfilename = tmpname;
 	}
-        res = gp_camera_file_get (camera, folder, filename, type,
-				  file, context);
+	if (progress_wanted (&gp_params)) {
+		CameraFileInfo info;
+		unsigned long size = 0;
+
+		/* Turns the driver's progress into bytes. */
+		if (metered_camera_file_get_info (camera, folder, filename, &info,
+						  context) == GP_OK) {
+			if ((type == GP_FILE_TYPE_PREVIEW) &&
+			    (info.preview.fields & GP_FILE_INFO_SIZE))
+				size = info.preview.size;
+			else if ((type == GP_FILE_TYPE_NORMAL) &&
+				 (info.file.fields & GP_FILE_INFO_SIZE))
+				size = info.file.size;
+		}
+		progress_file_start (&gp_params, filename, size);
+	}
+	PROBE3 (download_start, folder, filename, (int) type);
+        res = metered_camera_file_get (camera, folder, filename, type,
+				       file, context);
+	progress_file_stop (&gp_params, res);
 	if (res < GP_OK) {
+		PROBE4 (download_done, folder, filename, res, 0UL);
 		free (ps);
 		gp_file_unref (file);
 		if (tmpfilename) unlink (tmpfilename);
 		return res;
 	}
+	do {
+		struct stat st;
+		const char *data;
+		unsigned long int size = 0;
+
+		if (tmpfilename && !stat (tmpfilename, &st))
+			size = st.st_size;
+		else if (!tmpfilename &&
+			 (gp_file_get_data_and_size (file, &data, &size) != GP_OK))
+			size = 0;
+		metrics_bytes (METRIC_FILE_GET, size);
+		PROBE4 (download_done, folder, filename, res, size);
+	} while (0);
 
 	if (flags & FLAGS_STDOUT) {
                 const char *data;
@@ -682,7 +858,13 @@ save_file_to_file (Camera *camera, GPContext *context, Flags flags,
 		unlink (tmpname);
 		return (GP_OK);
 	}
-	res = save_camera_file_to_file (folder, filename, type, file, tmpfilename);
+	do {
+		double start = trace_begin ();
+
+		res = do_save_camera_file_to_file (folder, filename, type, file,
+						   tmpfilename, ps);
+		trace_end ("disk", "save_camera_file_to_file", start, filename);
+	} while (0);
 	if (ps && ps->fd) close (ps->fd);
 	free (ps);
 	gp_file_unref (file);
@@ -691,6 +873,20 @@ save_file_to_file (Camera *camera, GPContext *context, Flags flags,
         return (res);
 }
 
+int
+save_file_to_file (Camera *camera, GPContext *context, Flags flags,
+		   const char *folder, const char *filename,
+		   CameraFileType type)
+{
+	double	start = trace_begin ();
+	int	res;
+
+	res = do_save_file_to_file (camera, context, flags, folder, filename,
+				    type);
+	trace_end ("frontend", "save_file_to_file", start, filename);
+	return res;
+}
+
 static void
 dissolve_filename (
 	const char *folder, const char *filename,
@@ -796,7 +992,7 @@ sig_handler_end_next (int sig_num)
 /* temp test function */
 int
 trigger_capture (void) {
-	int result =  gp_camera_trigger_capture (gp_params.camera, gp_params.context);
+	int result =  metered_camera_trigger_capture (gp_params.camera, gp_params.context);
 	if (result != GP_OK) {
 		cli_error_print(_("Could not trigger capture."));
 		return (result);
@@ -817,6 +1013,7 @@ static int
 save_captured_file (CameraFilePath *path, int download) {
 	char *pathsep;
 	static CameraFilePath last;
+	double start;
 	int result;
 
 	if (strcmp(path->folder, "/") == 0)
@@ -831,6 +1028,7 @@ save_captured_file (CameraFilePath *path, int download) {
 		printf (_("New file is in location %s%s%s on the camera\n"),
 			path->folder, pathsep, path->name);
 	}
+	capstats_file (path);
 	if (download) {
 		if (strcmp(path->folder, last.folder)) {
 			memcpy(&last, path, sizeof(last));
@@ -850,7 +1048,9 @@ save_captured_file (CameraFilePath *path, int download) {
 			return GP_OK;
 		}
 
+		start = capstats_begin ();
 		result = get_file_common (path->name, GP_FILE_TYPE_NORMAL);
+		capstats_stage (CAPSTATS_DOWNLOAD, start);
 		if (result != GP_OK) {
 			cli_error_print (_("Could not get image."));
 			if(result == GP_ERROR_FILE_NOT_FOUND) {
@@ -864,12 +1064,18 @@ save_captured_file (CameraFilePath *path, int download) {
 			return (result);
 		}
 
+		/* --move deletes in batches once the download is verified. */
+		if (gp_params.flags & FLAGS_MOVE)
+			return GP_OK;
+
 		if (!(gp_params.flags & FLAGS_KEEP)) {
 			if (!(gp_params.flags & FLAGS_QUIET))
 				printf (_("Deleting file %s%s%s on the camera\n"),
 					path->folder, pathsep, path->name);
 
+			start = capstats_begin ();
 			result = delete_file_action (&gp_params, path->folder, path->name);
+			capstats_stage (CAPSTATS_DELETE, start);
 			if (result != GP_OK) {
 				cli_error_print ( _("Could not delete image."));
 				return (result);
@@ -884,7 +1090,7 @@ save_captured_file (CameraFilePath *path, int download) {
 }
 
 static int
-wait_and_handle_event (long waittime, CameraEventType *type, int download) {
+do_wait_and_handle_event (long waittime, CameraEventType *type, int download) {
 	int 		result;
 	CameraEventType	evtype;
 	void		*data;
@@ -893,7 +1099,7 @@ wait_and_handle_event (long waittime, CameraEventType *type, int download) {
 	if (!type) type = &evtype;
 	evtype = GP_EVENT_UNKNOWN;
 	data = NULL;
-	result = gp_camera_wait_for_event(gp_params.camera, waittime, type, &data, gp_params.context);
+	result = metered_camera_wait_for_event(gp_params.camera, waittime, type, &data, gp_params.context);
 	if (result == GP_ERROR_NOT_SUPPORTED) {
 		*type = GP_EVENT_TIMEOUT;
 		usleep(waittime*1000);
@@ -936,11 +1142,89 @@ wait_and_handle_event (long waittime, CameraEventType *type, int download) {
 	return result;
 }
 
-int
-capture_generic (CameraCaptureType type, const char __unused__ *name, int download)
+/* In the trace, the event that ended the wait. */
+static int
+wait_and_handle_event (long waittime, CameraEventType *type, int download) {
+	static const char *const names[] = {
+		"unknown", "timeout", "file_added", "folder_added",
+		"capture_complete", "file_changed"
+	};
+	CameraEventType	evtype = GP_EVENT_UNKNOWN;
+	double		start = trace_begin ();
+	int		result;
+
+	if (!type) type = &evtype;
+	result = do_wait_and_handle_event (waittime, type, download);
+	trace_end ("frontend", "wait_and_handle_event", start,
+		   (result != GP_OK) ? "error" :
+		   ((unsigned int) *type < sizeof (names) / sizeof (names[0])) ?
+		   names[*type] : "other");
+	return result;
+}
+
+/* Drain the event queue and download left over added images. */
+static void
+wait_for_leftover_files (int download) {
+	struct timeval expose_end_time;
+	CameraEventType evtype;
+	long waittime;
+	int result;
+
+	gettimeofday (&expose_end_time, NULL);
+	waittime = 3000;
+	/* tricky, this loop might need to download both JPG and RAW. so wait longer. */
+	/*if (glob_frames || end_next || !glob_interval || glob_bulblength) waittime = 2000;*/
+	while (1) {
+		int realwait = waittime - (-timediff_now(&expose_end_time));
+		if (realwait < -3) break; /* wait at most 6 seconds */
+
+		if (realwait < 0) realwait = 0; /* just drain the queue now */
+		result = wait_and_handle_event(realwait, &evtype, download);
+		if ((result != GP_OK) || (evtype == GP_EVENT_TIMEOUT)) {
+			/*printf("Timeout or error, leaving loop.\n");*/
+			break;
+		}
+		if (evtype == GP_EVENT_CAPTURE_COMPLETE) {
+			/*printf("Capture complete, waiting final 0.1s.\n");*/
+			waittime = 100;
+		}
+		if (evtype == GP_EVENT_FILE_ADDED) { /* Restart timer, more image data might come. */
+			/*printf("File added, waiting more %gs.\n", waittime/1000.0);*/
+			gettimeofday (&expose_end_time, NULL);
+		}
+	}
+}
+
+/*
+ * Saves the just captured PATH and drains the files that follow it (the
+ * second half of RAW+JPEG). The picture is on the card already, so after
+ * a reconnect only the download and the drain are done again.
+ */
+static int
+save_capture_result (CameraFilePath *path, int download, int *attempt)
+{
+	CameraEventType	evtype;
+	int		result;
+
+	result = save_captured_file (path, download);
+	while ((result != GP_OK) && reconnect_retry (&gp_params, result, attempt))
+		result = save_captured_file (path, download);
+	while (result == GP_OK) {
+		result = wait_and_handle_event (1, &evtype, download);
+		if (result != GP_OK) {
+			if (reconnect_retry (&gp_params, result, attempt))
+				result = GP_OK;
+		} else if (evtype == GP_EVENT_TIMEOUT)
+			break;
+	}
+	return result;
+}
+
+static int
+do_capture_generic (CameraCaptureType type, int download)
 {
 	CameraFilePath path;
-	int result, frames = 0;
+	int result, frames = 0, attempt = 0;
 	CameraAbilities	a;
 	CameraEventType evtype;
 	long waittime;
@@ -970,6 +1254,15 @@ capture_generic (CameraCaptureType type, const char __unused__ *name, int downlo
 		}
 	}
 
+	/* Continue a time-lapse where an earlier run left off. */
+	if (glob_interval && journal_frames (&gp_params)) {
+		frames = journal_frames (&gp_params);
+		if (glob_frames && frames >= glob_frames)
+			return GP_OK;
+		if (!(gp_params.flags & FLAGS_QUIET))
+			printf (_("Resuming after frame #%d.\n"), frames);
+	}
+
 	while(++frames) {
 		if (!(gp_params.flags & FLAGS_QUIET) && glob_interval) {
 			if(!glob_frames)
@@ -983,8 +1276,13 @@ capture_generic (CameraCaptureType type, const char __unused__ *name, int downlo
 		/* Now handle the different capture methods */
 		if(glob_bulblength) {
 			/* Bulb mode is special ... we enable it, wait disable it */
+			capstats_trigger (capstats_begin ());
 			result = set_config_action (&gp_params, "bulb", "1");
 			if (result != GP_OK) {
+				if (reconnect_retry (&gp_params, result, &attempt)) {
+					frames--;
+					continue;
+				}
 				cli_error_print(_("Could not set bulb capture, result %d."), result);
 				return (result);
 			}
@@ -994,14 +1292,26 @@ capture_generic (CameraCaptureType type, const char __unused__ *name, int downlo
 			while(waittime > 0) {
 				result = wait_and_handle_event(waittime, &evtype, download);
 				if (result != GP_OK)
-					return result;
+					break;
 				waittime = timediff_now (&expose_end_time);
 			}
+			if (result != GP_OK) {
+				if (reconnect_retry (&gp_params, result, &attempt)) {
+					frames--;
+					continue;
+				}
+				return result;
+			}
 			result = set_config_action (&gp_params, "bulb", "0");
 			if (result != GP_OK) {
+				if (reconnect_retry (&gp_params, result, &attempt)) {
+					frames--;
+					continue;
+				}
 				cli_error_print(_("Could not end capture (bulb mode)."));
 				return (result);
 			}
+			capstats_captured (NULL);
 			/* The actual download will happen down below in the interval wait
 			 * or the loop exit.
 			 */
@@ -1010,17 +1320,19 @@ capture_generic (CameraCaptureType type, const char __unused__ *name, int downlo
 #if 0
 			/* Not a good idea, as we do not know how long to wait after capture ... */
 			if (a.operations & GP_OPERATION_TRIGGER_CAPTURE) {
-				result = gp_camera_trigger_capture (gp_params.camera, gp_params.context);
+				result = metered_camera_trigger_capture (gp_params.camera, gp_params.context);
 				if ((result != GP_OK) && (result != GP_ERROR_NOT_SUPPORTED))
 					cli_error_print(_("Could not trigger image capture."));
 				/* The downloads will be handled by wait_event */
 			}
 #endif
 			if (result == GP_ERROR_NOT_SUPPORTED) {
-				result = gp_camera_capture (gp_params.camera, type, &path, gp_params.context);
+				capstats_trigger (capstats_begin ());
+				result = metered_camera_capture (gp_params.camera, type, &path, gp_params.context);
 				if (result != GP_OK) {
 					cli_error_print(_("Could not capture image."));
 				} else {
+					capstats_captured (&path);
 					/* If my Canon EOS 10D is set to auto-focus and it is unable to
 					 * get focus lock - it will return with *UNKNOWN* as the filename.
 					 */
@@ -1032,11 +1344,19 @@ capture_generic (CameraCaptureType type, const char __unused__ *name, int downlo
 						}
 					}
 					result = save_captured_file (&path, download);
+					/* The picture is taken, only get it again. */
+					while ((result != GP_OK) &&
+					       reconnect_retry (&gp_params, result, &attempt))
+						result = save_captured_file (&path, download);
 					if (result != GP_OK)
 						break;
 				}
 			}
 			if (result != GP_OK) {
+				if (reconnect_retry (&gp_params, result, &attempt)) {
+					frames--;
+					continue;
+				}
 				cli_error_print(_("Could not capture."));
 				if (	(result == GP_ERROR_NOT_SUPPORTED)	||
 					(result == GP_ERROR_NO_MEMORY)		||
@@ -1051,6 +1371,13 @@ capture_generic (CameraCaptureType type, const char __unused__ *name, int downlo
 			}
 		}
 
+		if (result == GP_OK) {
+			attempt = 0;
+			if (glob_interval)
+				journal_add_frame (&gp_params, frames);
+			move_queue_flush (&gp_params, 0);
+		}
+
 		/* Break if we've reached the requested number of frames
 		 * to capture.
 		 */
@@ -1068,6 +1395,10 @@ capture_generic (CameraCaptureType type, const char __unused__ *name, int downlo
 		 * [alesan]
 		 */
 		if (glob_interval != -1) {
+			/* Meter for the next frame while we have to wait anyway. */
+			if (gp_params.exposure && !glob_bulblength)
+				exposure_ramp_step (&gp_params, timediff_now (&next_pic_time),
+						    glob_interval / 2.0);
 			waittime = timediff_now (&next_pic_time);
 			result = GP_OK;
 			if (waittime > 0) {
@@ -1096,7 +1427,8 @@ capture_generic (CameraCaptureType type, const char __unused__ *name, int downlo
 				if (!(gp_params.flags & FLAGS_QUIET) && glob_interval)
 					printf (_("not sleeping (%ld seconds behind schedule)\n"), -waittime/1000);
 			}
-			if (result != GP_OK) break;
+			if ((result != GP_OK) && !reconnect_retry (&gp_params, result, &attempt))
+				break;
 			if (capture_now && (gp_params.flags & FLAGS_RESET_CAPTURE_INTERVAL)) {
 				gettimeofday (&next_pic_time, NULL);
 				next_pic_time.tv_sec += glob_interval;
@@ -1118,6 +1450,8 @@ capture_generic (CameraCaptureType type, const char __unused__ *name, int downlo
 			/* wait indefinitely for SIGUSR1 */
 			do {
 				result = wait_and_handle_event (200, &evtype, download);
+				if ((result != GP_OK) && reconnect_retry (&gp_params, result, &attempt))
+					result = GP_OK;
 			} while(!capture_now && (result == GP_OK));
 			if (result != GP_OK)
 				break;
@@ -1129,31 +1463,247 @@ capture_generic (CameraCaptureType type, const char __unused__ *name, int downlo
 	/* The final capture will fall out of the loop into this case,
 	 * so make sure we wait a bit for the the camera to finish stuff.
 	 */
-	gettimeofday (&expose_end_time, NULL);
-	waittime = 3000;
-	/* tricky, this loop might need to download both JPG and RAW. so wait longer. */
-	/*if (glob_frames || end_next || !glob_interval || glob_bulblength) waittime = 2000;*/
-	/* Drain the event queue at the end and download left over added images */
-	while (1) {
-		int realwait = waittime - (-timediff_now(&expose_end_time));
-		if (realwait < -3) break; /* wait at most 6 seconds */
+	wait_for_leftover_files (download);
+	return GP_OK;
+}
 
-		if (realwait < 0) realwait = 0; /* just drain the queue now */
-		result = wait_and_handle_event(realwait, &evtype, download);
-		if ((result != GP_OK) || (evtype == GP_EVENT_TIMEOUT)) {
-			/*printf("Timeout or error, leaving loop.\n");*/
+int
+capture_generic (CameraCaptureType type, const char __unused__ *name, int download)
+{
+	int result;
+
+	result = do_capture_generic (type, download);
+	capstats_report ();
+	return result;
+}
+
+/*
+ * --capture-sequence "aperture=5.6,shutterspeed=1/100;shutterspeed=1/50;..."
+ *
+ * Every ';' separated step applies its settings and then captures one
+ * image. The widgets are looked up once for the whole sequence, so a
+ * step costs one set per changed setting plus the capture itself.
+ */
+int
+capture_sequence (const char *spec, int download)
+{
+	struct setting { char *name, *value; } *set;
+	CameraFilePath path;
+	struct timeval start, t;
+	long tset, tcapture, tsave;
+	char *buf, *step, *next, *assign, *comma;
+	int *first, nsteps = 1, nset = 0, i, j, result = GP_OK, attempt = 0;
+
+	buf = strdup (spec);
+	if (!buf)
+		return GP_ERROR_NO_MEMORY;
+	for (i = 0; buf[i]; i++)
+		if (buf[i] == ';')
+			nsteps++;
+	/* Enough for one setting per character, which is never exceeded. */
+	set = calloc (strlen (buf) + 1, sizeof (*set));
+	first = calloc (nsteps + 1, sizeof (int));
+	if (!set || !first) {
+		free (buf); free (set); free (first);
+		return GP_ERROR_NO_MEMORY;
+	}
+
+	/* Parse all of it up front, so a typo does not abort half way. */
+	for (i = 0, step = buf; step; step = next, i++) {
+		next = strchr (step, ';');
+		if (next)
+			*next++ = '\0';
+		first[i] = nset;
+		for (assign = step; assign; assign = comma) {
+			comma = strchr (assign, ',');
+			if (comma)
+				*comma++ = '\0';
+			if (!*assign)
+				continue;
+			set[nset].name = assign;
+			set[nset].value = strchr (assign, '=');
+			if (!set[nset].value) {
+				cli_error_print (_("Missing '=' in step %d of the capture sequence: '%s'"), i + 1, assign);
+				result = GP_ERROR_BAD_PARAMETERS;
+				goto out;
+			}
+			*set[nset].value++ = '\0';
+			nset++;
+		}
+	}
+	first[nsteps] = nset;
+
+	for (i = 0; (i < nsteps) && !glob_cancel && !end_next; i++) {
+		if (!(gp_params.flags & FLAGS_QUIET))
+			printf (_("Capturing step #%d/%d...\n"), i + 1, nsteps);
+		fflush (stdout);
+
+		gettimeofday (&start, NULL);
+		for (j = first[i]; (j < first[i + 1]) && (result == GP_OK); j++)
+			result = set_config_action (&gp_params, set[j].name, set[j].value);
+		tset = -timediff_now (&start);
+
+		gettimeofday (&t, NULL);
+		if (result == GP_OK)
+			result = metered_camera_capture (gp_params.camera, GP_CAPTURE_IMAGE, &path, gp_params.context);
+		tcapture = -timediff_now (&t);
+
+		/* Nothing was taken yet, so the whole step can run again. */
+		if (result != GP_OK) {
+			if (reconnect_retry (&gp_params, result, &attempt)) {
+				result = GP_OK;
+				i--;
+				continue;
+			}
+			cli_error_print (_("Could not capture step %d of the sequence."), i + 1);
 			break;
 		}
-		if (evtype == GP_EVENT_CAPTURE_COMPLETE) {
-			/*printf("Capture complete, waiting final 0.1s.\n");*/
-			waittime = 100;
+
+		gettimeofday (&t, NULL);
+		/* Pick up the second half of RAW+JPEG before the next step. */
+		result = save_capture_result (&path, download, &attempt);
+		tsave = -timediff_now (&t);
+		if (result != GP_OK) {
+			cli_error_print (_("Could not download the picture of step %d of the sequence."), i + 1);
+			break;
 		}
-		if (evtype == GP_EVENT_FILE_ADDED) { /* Restart timer, more image data might come. */
-			/*printf("File added, waiting more %gs.\n", waittime/1000.0);*/
-			gettimeofday (&expose_end_time, NULL);
+		attempt = 0;
+		move_queue_flush (&gp_params, 0);
+
+		if (!(gp_params.flags & FLAGS_QUIET))
+			printf (_("Step #%d took %ld ms (settings %ld ms, capture %ld ms, %s %ld ms).\n"),
+				i + 1, -timediff_now (&start), tset, tcapture,
+				download ? _("download") : _("event"), tsave);
+	}
+	if (result == GP_OK)
+		wait_for_leftover_files (download);
+out:
+	free (first);
+	free (set);
+	free (buf);
+	return result;
+}
+
+/*
+ * --capture-motion [THRESHOLD]
+ *
+ * Watches the preview frames and captures an image whenever two frames
+ * differ by more than THRESHOLD within --motion-roi. The camera can't
+ * do live view and capture at once, so the preview stops for the
+ * capture; the first frame after it is the new reference.
+ */
+int
+capture_motion (const char *threshold, int download)
+{
+	PreviewSource	*source = NULL;
+	PreviewFrame	*frame;
+	MotionDetector	*detector;
+	CameraFilePath	path;
+	struct timeval	seen, t;
+	unsigned long	seq = 0;
+	double		limit = 8, diff;
+	long		tdetect, ttrigger, tcapture, tsave;
+	long		detect_sum = 0, detect_max = 0;
+	int		frames = 0, result = GP_OK, attempt = 0;
+	char		*end;
+
+	if (threshold) {
+		limit = strtod (threshold, &end);
+		if (*end || (limit <= 0) || (limit > 255)) {
+			cli_error_print (_("Invalid motion threshold '%s', use a number between 0 and 255."),
+					 threshold);
+			return GP_ERROR_BAD_PARAMETERS;
 		}
 	}
-	return GP_OK;
+	result = motion_detector_new (&gp_params, &detector);
+	if (result != GP_OK)
+		return result;
+	if (!(gp_params.flags & FLAGS_QUIET))
+		printf (_("Watching for motion (threshold %g)...\n"), limit);
+
+	while (!glob_cancel && !end_next) {
+		if (!source) {
+			result = preview_source_start (&gp_params, &source);
+			if (result != GP_OK)
+				break;
+			motion_detector_reset (detector);
+			seq = 0;
+		}
+		frame = preview_source_next (source, seq);
+		if (!frame)
+			break;
+		seq = frame->seq;
+		result = motion_detector_feed (detector, frame, &diff);
+		gettimeofday (&seen, NULL);
+		tdetect = (seen.tv_sec - frame->time.tv_sec) * 1000 +
+			  (seen.tv_usec - frame->time.tv_usec) / 1000;
+		t = frame->time;
+		preview_frame_unref (source, frame);
+		if ((result != GP_OK) || (diff < limit)) {
+			result = GP_OK;
+			continue;
+		}
+
+		preview_source_halt (source);
+		preview_source_free (source);
+		source = NULL;
+		frames++;
+		ttrigger = -timediff_now (&t);
+		if (!(gp_params.flags & FLAGS_QUIET))
+			printf (_("Motion detected (difference %.1f), capturing frame #%d...\n"),
+				diff, frames);
+		fflush (stdout);
+
+		gettimeofday (&t, NULL);
+		result = metered_camera_capture (gp_params.camera, GP_CAPTURE_IMAGE, &path, gp_params.context);
+		tcapture = -timediff_now (&t);
+
+		if (result != GP_OK) {
+			frames--;
+			if (reconnect_retry (&gp_params, result, &attempt)) {
+				result = GP_OK;
+				continue;
+			}
+			cli_error_print (_("Could not capture."));
+			break;
+		}
+
+		gettimeofday (&t, NULL);
+		/* Pick up the second half of RAW+JPEG before watching again. */
+		result = save_capture_result (&path, download, &attempt);
+		tsave = -timediff_now (&t);
+		if (result != GP_OK) {
+			cli_error_print (_("Could not download frame #%d."), frames);
+			break;
+		}
+		attempt = 0;
+		move_queue_flush (&gp_params, 0);
+		detect_sum += tdetect;
+		if (tdetect > detect_max)
+			detect_max = tdetect;
+
+		if (!(gp_params.flags & FLAGS_QUIET))
+			printf (_("Frame #%d: detected %ld ms after the preview frame, capture started after %ld ms and took %ld ms, %s %ld ms.\n"),
+				frames, tdetect, ttrigger, tcapture,
+				download ? _("download") : _("event"), tsave);
+		if (glob_frames && (frames == glob_frames))
+			break;
+	}
+	if (source) {
+		int r = preview_source_halt (source);
+
+		if (result == GP_OK)
+			result = r;
+		preview_source_free (source);
+	}
+	motion_detector_free (detector);
+	if (frames) {
+		wait_for_leftover_files (download);
+		if (!(gp_params.flags & FLAGS_QUIET))
+			printf (_("Captured %d frames on motion, detection latency %ld ms average, %ld ms worst.\n"),
+				frames, detect_sum / frames, detect_max);
+	}
+	return result;
 }
 
 
@@ -1291,8 +1841,14 @@ typedef enum {
 	ARG_TRIGGER_CAPTURE,
 	ARG_CAPTURE_IMAGE,
 	ARG_CAPTURE_IMAGE_AND_DOWNLOAD,
+	ARG_CAPTURE_SEQUENCE,
+	ARG_CAPTURE_SEQUENCE_AND_DOWNLOAD,
+	ARG_CAPTURE_MOTION,
+	ARG_CAPTURE_MOTION_AND_DOWNLOAD,
 	ARG_CAPTURE_MOVIE,
 	ARG_CAPTURE_PREVIEW,
+	ARG_BENCHMARK_PREVIEW,
+	ARG_BENCHMARK_JSON,
 	ARG_SHOW_PREVIEW,
 	ARG_CAPTURE_SOUND,
 	ARG_CAPTURE_TETHERED,
@@ -1300,8 +1856,13 @@ typedef enum {
 	ARG_DEBUG,
 	ARG_DEBUG_LOGLEVEL,
 	ARG_DEBUG_LOGFILE,
+	ARG_DEBUG_DOMAINS,
+	ARG_DEBUG_BINLOG,
+	ARG_DEBUG_BINLOG_SIZE,
+	ARG_DEBUG_BINLOG_PRINT,
 	ARG_DELETE_ALL_FILES,
 	ARG_DELETE_FILE,
+	ARG_EXPOSURE_RAMP,
 	ARG_FILENAME,
 	ARG_FILENUMBER,
 	ARG_FOLDER,
@@ -1314,8 +1875,11 @@ typedef enum {
 	ARG_GET_ALL_THUMBNAILS,
 	ARG_GET_AUDIO_DATA,
 	ARG_GET_CONFIG,
+	ARG_GET_CONFIG_LIST,
 	ARG_SET_CONFIG,
+	ARG_SET_CONFIG_FILE,
 	ARG_SET_CONFIG_INDEX,
+	ARG_SET_CONFIG_LIST,
 	ARG_SET_CONFIG_VALUE,
 	ARG_GET_EXIF,
 	ARG_GET_FILE,
@@ -1324,6 +1888,10 @@ typedef enum {
 	ARG_GET_THUMBNAIL,
 	ARG_HELP,
 	ARG_HOOK_SCRIPT,
+	ARG_HOOK_PERSISTENT,
+	ARG_HOOK_INFLIGHT,
+	ARG_HOOK_JOBS,
+	ARG_JOURNAL,
 	ARG_KEEP,
 	ARG_KEEP_RAW,
 	ARG_LIST_CAMERAS,
@@ -1332,24 +1900,38 @@ typedef enum {
 	ARG_LIST_FILES,
 	ARG_LIST_FOLDERS,
 	ARG_LIST_PORTS,
+	ARG_LOAD_CONFIG,
 	ARG_MANUAL,
 	ARG_MKDIR,
 	ARG_MODEL,
+	ARG_MOTION_ROI,
+	ARG_MOVE,
+	ARG_MOVIE_FORMAT,
+	ARG_MOVIE_SEGMENT,
 	ARG_NEW,
 	ARG_NO_KEEP,
 	ARG_NO_RECURSE,
 	ARG_NUM_FILES,
 	ARG_PORT,
+	ARG_PUBLISH_PREVIEW,
 	ARG_QUIET,
+	ARG_RECONNECT,
 	ARG_RECURSE,
 	ARG_REVERSE,
 	ARG_RESET,
 	ARG_RESET_INTERVAL,
 	ARG_RMDIR,
+	ARG_SAVE_CONFIG,
+	ARG_SERVE_PREVIEW,
 	ARG_SHELL,
 	ARG_SHOW_EXIF,
 	ARG_SHOW_INFO,
 	ARG_PARSABLE,
+	ARG_PROGRESS_FD,
+	ARG_METRICS,
+	ARG_TRACE,
+	ARG_CAPTURE_STATS,
+	ARG_CAPTURE_STATS_CSV,
 	ARG_SKIP_EXISTING,
 	ARG_SPEED,
 	ARG_STDOUT,
@@ -1361,7 +1943,8 @@ typedef enum {
 	ARG_USAGE,
 	ARG_USBID,
 	ARG_VERSION,
-	ARG_WAIT_EVENT
+	ARG_WAIT_EVENT,
+	ARG_WATCH_CONFIG
 } Arg;
 
 typedef enum {
@@ -1484,6 +2067,9 @@ cb_arg_init (poptContext __unused__ ctx,
 	case ARG_NO_KEEP:
 		gp_params.flags &= ~FLAGS_KEEP;
 		break;
+	case ARG_MOVE:
+		gp_params.flags |= FLAGS_MOVE;
+		break;
 
 	case ARG_NO_RECURSE:
 		gp_params.flags &= ~FLAGS_RECURSE;
@@ -1511,6 +2097,13 @@ cb_arg_init (poptContext __unused__ ctx,
 		gp_params.flags |= FLAGS_SKIP_EXISTING;
 		break;
 
+	case ARG_RECONNECT:
+		gp_params.reconnect_tries = atoi (arg);
+		break;
+	case ARG_JOURNAL:
+		params->p.r = journal_open (&gp_params, arg);
+		break;
+
 	case ARG_SPEED:
 		params->p.r = action_camera_set_speed (&gp_params, atoi (arg));
 		break;
@@ -1523,6 +2116,21 @@ cb_arg_init (poptContext __unused__ ctx,
 		gp_params.flags |= FLAGS_QUIET;
 		gp_params.flags |= FLAGS_PARSABLE;
 		break;
+	case ARG_PROGRESS_FD:
+		params->p.r = progress_set_fd (&gp_params, arg);
+		break;
+	case ARG_METRICS:
+		params->p.r = metrics_add_file (arg);
+		break;
+	case ARG_TRACE:
+		params->p.r = trace_open (arg);
+		break;
+	case ARG_CAPTURE_STATS:
+		params->p.r = capstats_enable (NULL);
+		break;
+	case ARG_CAPTURE_STATS_CSV:
+		params->p.r = capstats_enable (arg);
+		break;
 
 	case ARG_RESET_INTERVAL:
 		gp_params.flags |= FLAGS_RESET_CAPTURE_INTERVAL;
@@ -1536,16 +2144,19 @@ cb_arg_init (poptContext __unused__ ctx,
 				perror("malloc error");
 				exit (EXIT_FAILURE);
 			}
+			/* The init hook runs once all options are known */
 			gp_params.hook_script = strcpy(copy, arg);
-			/* Run init hook */
-			if (0!=gp_params_run_hook(&gp_params, "init", NULL)) {
-				fprintf(stderr,
-					"Hook script \"%s\" init failed. Aborting.\n",
-					gp_params.hook_script);
-				exit(3);
-			}
 		} while (0);
 		break;
+	case ARG_HOOK_PERSISTENT:
+		params->p.r = hook_set_persistent (&gp_params, arg);
+		break;
+	case ARG_HOOK_INFLIGHT:
+		params->p.r = hook_set_inflight (&gp_params, arg);
+		break;
+	case ARG_HOOK_JOBS:
+		params->p.r = hook_set_jobs (&gp_params, arg);
+		break;
 
 	case ARG_STDOUT:
 		gp_params.flags |= FLAGS_QUIET | FLAGS_STDOUT;
@@ -1561,6 +2172,21 @@ cb_arg_init (poptContext __unused__ ctx,
 	case ARG_CAPTURE_INTERVAL:
 		glob_interval = atoi(arg);
 		break;
+	case ARG_MOVIE_FORMAT:
+		params->p.r = movie_set_format (&gp_params, arg);
+		break;
+	case ARG_BENCHMARK_JSON:
+		params->p.r = benchmark_set_json (&gp_params, arg);
+		break;
+	case ARG_MOVIE_SEGMENT:
+		params->p.r = movie_set_segment (&gp_params, arg);
+		break;
+	case ARG_MOTION_ROI:
+		params->p.r = motion_set_roi (&gp_params, arg);
+		break;
+	case ARG_EXPOSURE_RAMP:
+		params->p.r = exposure_ramp_set (&gp_params, arg);
+		break;
 	case ARG_CAPTURE_BULB:
 		glob_bulblength = atoi(arg);
 		break;
@@ -1583,6 +2209,7 @@ cb_arg_run (poptContext __unused__ ctx,
 	    CallbackParams *params)
 {
 	char *newfilename = NULL, *newfolder = NULL;
+	double start = trace_begin ();
 
 	switch (opt->val) {
 	case ARG_ABILITIES:
@@ -1603,14 +2230,35 @@ cb_arg_run (poptContext __unused__ ctx,
 	case ARG_CAPTURE_IMAGE_AND_DOWNLOAD:
 		params->p.r = capture_generic (GP_CAPTURE_IMAGE, arg, 1);
 		break;
+	case ARG_CAPTURE_SEQUENCE:
+		params->p.r = capture_sequence (arg, 0);
+		break;
+	case ARG_CAPTURE_SEQUENCE_AND_DOWNLOAD:
+		params->p.r = capture_sequence (arg, 1);
+		break;
+	case ARG_CAPTURE_MOTION:
+		params->p.r = capture_motion (arg, 0);
+		break;
+	case ARG_CAPTURE_MOTION_AND_DOWNLOAD:
+		params->p.r = capture_motion (arg, 1);
+		break;
 	case ARG_CAPTURE_MOVIE:
 		params->p.r = action_camera_capture_movie (&gp_params, arg);
 		break;
 	case ARG_CAPTURE_PREVIEW:
 		params->p.r = action_camera_capture_preview (&gp_params);
 		break;
+	case ARG_BENCHMARK_PREVIEW:
+		params->p.r = benchmark_preview (&gp_params, arg);
+		break;
+	case ARG_SERVE_PREVIEW:
+		params->p.r = serve_preview (&gp_params, arg);
+		break;
+	case ARG_PUBLISH_PREVIEW:
+		params->p.r = shm_ring_publish (&gp_params, arg);
+		break;
 	case ARG_SHOW_PREVIEW:
-		params->p.r = action_camera_show_preview (&gp_params);
+		params->p.r = action_camera_show_preview (&gp_params, arg);
 		break;
 	case ARG_CAPTURE_SOUND:
 		params->p.r = capture_generic (GP_CAPTURE_SOUND, arg, 0);
@@ -1682,6 +2330,9 @@ cb_arg_run (poptContext __unused__ ctx,
 		gp_params.multi_type = MULTI_DOWNLOAD;
 		params->p.r = get_file_common (arg, GP_FILE_TYPE_RAW);
 		break;
+	case ARG_DEBUG_BINLOG_PRINT:
+		params->p.r = debuglog_print (arg);
+		break;
 	case ARG_LIST_CAMERAS:
 		params->p.r = list_cameras_action (&gp_params);
 		break;
@@ -1839,6 +2490,26 @@ cb_arg_run (poptContext __unused__ ctx,
 		free (name);
 		break;
 	}
+	case ARG_GET_CONFIG_LIST:
+		params->p.r = get_config_list_action (&gp_params, arg);
+		break;
+	case ARG_SET_CONFIG_LIST:
+		params->p.r = set_config_list_action (&gp_params, arg);
+		break;
+	case ARG_SET_CONFIG_FILE:
+		params->p.r = set_config_file_action (&gp_params, arg);
+		break;
+	case ARG_SAVE_CONFIG:
+		params->p.r = save_config_action (&gp_params, arg);
+		break;
+	case ARG_LOAD_CONFIG:
+		params->p.r = load_config_action (&gp_params, arg);
+		break;
+	case ARG_WATCH_CONFIG:
+		/* --interval sets the polling period, default is a second */
+		params->p.r = watch_config_action (&gp_params, arg,
+			(glob_interval > 0) ? glob_interval * 1000 : 1000);
+		break;
 	case ARG_WAIT_EVENT:
 		params->p.r = action_camera_wait_event (&gp_params, DT_NO_DOWNLOAD, arg);
 		break;
@@ -1849,8 +2520,10 @@ cb_arg_run (poptContext __unused__ ctx,
 		params->p.r = print_storage_info (&gp_params);
 		break;
 	default:
-		break;
+		/* Options that are no actions. */
+		return;
 	};
+	trace_end ("action", opt->longName, start, arg);
 }
 
 
@@ -1993,6 +2666,8 @@ main (int argc, char **argv, char **envp)
 	int i, help_option_given = 0;
 	int usage_option_given = 0;
 	char *debug_logfile_name = NULL, *debug_loglevel = NULL;
+	char *debug_domains = NULL;
+	char *debug_binlog_name = NULL, *debug_binlog_size = NULL;
 	const struct poptOption generalOptions[] = {
 		GPHOTO2_POPT_CALLBACK
 		{"help", '?', POPT_ARG_NONE, (void *) &help_option_given, ARG_HELP,
@@ -2005,13 +2680,45 @@ main (int argc, char **argv, char **envp)
 		 N_("Set debug level [error|debug|data|all]"), NULL},
 		{"debug-logfile", '\0', POPT_ARG_STRING, (void *) &debug_logfile_name, ARG_DEBUG_LOGFILE,
 		 N_("Name of file to write debug info to"), N_("FILENAME")},
+		{"debug-domains", '\0', POPT_ARG_STRING, (void *) &debug_domains, ARG_DEBUG_DOMAINS,
+		 N_("Set debug level per domain, e.g. ptp2=data,libusb1=debug,*=error"), N_("SPEC")},
+		{"debug-binlog", '\0', POPT_ARG_STRING, (void *) &debug_binlog_name, ARG_DEBUG_BINLOG,
+		 N_("Turn on debugging, written in binary to FILENAME by a background thread"), N_("FILENAME")},
+		{"debug-binlog-size", '\0', POPT_ARG_STRING, (void *) &debug_binlog_size, ARG_DEBUG_BINLOG_SIZE,
+		 N_("Keep at most SIZE of binary debug log, in FILENAME and FILENAME.1 (default 64M)"), N_("SIZE")},
+		{"debug-binlog-print", '\0', POPT_ARG_STRING, NULL, ARG_DEBUG_BINLOG_PRINT,
+		 N_("Print a binary debug log as text"), N_("FILENAME")},
 		{"quiet", 'q', POPT_ARG_NONE, NULL, ARG_QUIET,
 		 N_("Quiet output (default=verbose)"), NULL},
 		{"parsable", '\0', POPT_ARG_NONE, NULL, ARG_PARSABLE,
 		 N_("Simple parsable output (implies quiet)"), NULL},
+		{"progress-fd", '\0', POPT_ARG_STRING, NULL, ARG_PROGRESS_FD,
+		 N_("Write transfer progress as tab separated lines to file descriptor FD"),
+		 N_("FD")},
+		{"metrics", '\0', POPT_ARG_STRING, NULL, ARG_METRICS,
+		 N_("Write camera call counts and latencies to FILENAME, as JSON or for Prometheus if it ends in .prom"),
+		 N_("FILENAME")},
+		{"trace", '\0', POPT_ARG_STRING, NULL, ARG_TRACE,
+		 N_("Write a timeline of actions, camera calls and hooks to FILENAME, for Perfetto"),
+		 N_("FILENAME")},
+		{"capture-stats", '\0', POPT_ARG_NONE, NULL, ARG_CAPTURE_STATS,
+		 N_("Time capture, download, delete and hook of each frame and print percentiles"),
+		 NULL},
+		{"capture-stats-csv", '\0', POPT_ARG_STRING, NULL, ARG_CAPTURE_STATS_CSV,
+		 N_("Same, and write the times of each file to FILENAME as CSV"),
+		 N_("FILENAME")},
 		{"hook-script", '\0', POPT_ARG_STRING, NULL, ARG_HOOK_SCRIPT,
 		 N_("Hook script to call after downloads, captures, etc."),
 		 N_("FILENAME")},
+		{"hook-persistent", '\0', POPT_ARG_STRING|POPT_ARGFLAG_OPTIONAL, NULL, ARG_HOOK_PERSISTENT,
+		 N_("Start the hook script once and send it one 'line' or 'nul' delimited record per event"),
+		 N_("DELIMITER")},
+		{"hook-inflight", '\0', POPT_ARG_STRING, NULL, ARG_HOOK_INFLIGHT,
+		 N_("Wait for the persistent hook script to answer when COUNT events are unanswered"),
+		 N_("COUNT")},
+		{"hook-jobs", '\0', POPT_ARG_STRING, NULL, ARG_HOOK_JOBS,
+		 N_("Run the hook script for up to COUNT downloads at a time, without waiting for it"),
+		 N_("COUNT")},
 		POPT_TABLEEND
 	};
 	const struct poptOption cameraOptions[] = {
@@ -2024,6 +2731,11 @@ main (int argc, char **argv, char **envp)
 		 N_("Specify camera model"), N_("MODEL")},
 		{"usbid", '\0', POPT_ARG_STRING, NULL, ARG_USBID,
 		 N_("(expert only) Override USB IDs"), N_("USBIDs")},
+		{"reconnect", '\0', POPT_ARG_INT, NULL, ARG_RECONNECT,
+		 N_("Reconnect to the camera up to COUNT times after I/O errors"), N_("COUNT")},
+		{"journal", '\0', POPT_ARG_STRING, NULL, ARG_JOURNAL,
+		 N_("Record completed downloads and frames, skip them when resuming"),
+		 N_("FILENAME")},
 		POPT_TABLEEND
 	};
 	const struct poptOption infoOptions[] = {
@@ -2056,6 +2768,18 @@ main (int argc, char **argv, char **envp)
 		 N_("Set configuration value index in choices"), NULL},
 		{"set-config-value", '\0', POPT_ARG_STRING, NULL, ARG_SET_CONFIG_VALUE,
 		 N_("Set configuration value"), NULL},
+		{"get-config-list", '\0', POPT_ARG_STRING, NULL, ARG_GET_CONFIG_LIST,
+		 N_("Get several configuration values at once"), N_("NAME,...")},
+		{"set-config-list", '\0', POPT_ARG_STRING, NULL, ARG_SET_CONFIG_LIST,
+		 N_("Set several configuration values in one transaction"), N_("NAME=VALUE,...")},
+		{"set-config-file", '\0', POPT_ARG_STRING, NULL, ARG_SET_CONFIG_FILE,
+		 N_("Set the NAME=VALUE lines of FILENAME in one transaction"), N_("FILENAME")},
+		{"save-config", '\0', POPT_ARG_STRING, NULL, ARG_SAVE_CONFIG,
+		 N_("Save the configuration tree to FILENAME"), N_("FILENAME")},
+		{"load-config", '\0', POPT_ARG_STRING, NULL, ARG_LOAD_CONFIG,
+		 N_("Restore a configuration saved with --save-config, sending only the differences"), N_("FILENAME")},
+		{"watch-config", '\0', POPT_ARG_STRING, NULL, ARG_WATCH_CONFIG,
+		 N_("Print configuration values whenever they change"), N_("NAME,...")},
 		{"reset", '\0', POPT_ARG_NONE, NULL, ARG_RESET,
 		 N_("Reset device port"), NULL},
 		POPT_TABLEEND
@@ -2068,6 +2792,8 @@ main (int argc, char **argv, char **envp)
 		 N_("Keep RAW images on camera after capturing"), NULL},
 		{"no-keep", '\0', POPT_ARG_NONE, NULL, ARG_NO_KEEP,
 		 N_("Remove images from camera after capturing"), NULL},
+		{"move", '\0', POPT_ARG_NONE, NULL, ARG_MOVE,
+		 N_("Remove files from camera once their download is verified"), NULL},
 		{"wait-event", '\0', POPT_ARG_STRING|POPT_ARGFLAG_OPTIONAL, NULL, ARG_WAIT_EVENT,
 		 N_("Wait for event(s) from camera"), N_("EVENT")},
 		{"wait-event-and-download", '\0', POPT_ARG_STRING|POPT_ARGFLAG_OPTIONAL, NULL,
@@ -2075,9 +2801,9 @@ main (int argc, char **argv, char **envp)
 		{"capture-preview", '\0', POPT_ARG_NONE, NULL,
 		 ARG_CAPTURE_PREVIEW,
 		 N_("Capture a quick preview"), NULL},
-		{"show-preview", '\0', POPT_ARG_NONE, NULL,
+		{"show-preview", '\0', POPT_ARG_STRING|POPT_ARGFLAG_OPTIONAL, NULL,
 		 ARG_SHOW_PREVIEW,
-		 N_("Show a quick preview as Ascii Art"), NULL},
+		 N_("Show a live preview in the terminal, MODE is truecolor, 256, ascii or aa"), N_("MODE")},
 		{"bulb", 'B', POPT_ARG_INT, NULL, ARG_CAPTURE_BULB,
 		 N_("Set bulb exposure time in seconds"), N_("SECONDS")},
 		{"frames", 'F', POPT_ARG_INT, NULL, ARG_CAPTURE_FRAMES,
@@ -2086,14 +2812,38 @@ main (int argc, char **argv, char **envp)
 		 N_("Set capture interval in seconds"), N_("SECONDS")},
 		{"reset-interval", '\0', POPT_ARG_NONE, NULL, ARG_RESET_INTERVAL,
 		 N_("Reset capture interval on signal (default=no)"), NULL},
+		{"exposure-ramp", '\0', POPT_ARG_STRING|POPT_ARGFLAG_OPTIONAL, NULL, ARG_EXPOSURE_RAMP,
+		 N_("Keep the time-lapse brightness at TARGET (default 118) by stepping shutter speed and ISO"), N_("TARGET")},
 		{"capture-image", '\0', POPT_ARG_NONE, NULL,
 		 ARG_CAPTURE_IMAGE, N_("Capture an image"), NULL},
 		{"trigger-capture", '\0', POPT_ARG_NONE, NULL,
 		 ARG_TRIGGER_CAPTURE, N_("Trigger capture of an image"), NULL},
 		{"capture-image-and-download", '\0', POPT_ARG_NONE, NULL,
 		 ARG_CAPTURE_IMAGE_AND_DOWNLOAD, N_("Capture an image and download it"), NULL},
+		{"capture-sequence", '\0', POPT_ARG_STRING, NULL,
+		 ARG_CAPTURE_SEQUENCE, N_("Capture one image per step, after setting the step's config values"), N_("NAME=VALUE,...;...")},
+		{"capture-sequence-and-download", '\0', POPT_ARG_STRING, NULL,
+		 ARG_CAPTURE_SEQUENCE_AND_DOWNLOAD, N_("Capture and download one image per step of the sequence"), N_("NAME=VALUE,...;...")},
+		{"capture-motion", '\0', POPT_ARG_STRING|POPT_ARGFLAG_OPTIONAL, NULL,
+		 ARG_CAPTURE_MOTION, N_("Capture an image whenever the live view changes by more than THRESHOLD (default 8)"), N_("THRESHOLD")},
+		{"capture-motion-and-download", '\0', POPT_ARG_STRING|POPT_ARGFLAG_OPTIONAL, NULL,
+		 ARG_CAPTURE_MOTION_AND_DOWNLOAD, N_("Capture and download an image whenever the live view changes"), N_("THRESHOLD")},
+		{"motion-roi", '\0', POPT_ARG_STRING, NULL,
+		 ARG_MOTION_ROI, N_("Only watch this part of the frame for --capture-motion, in percent"), N_("LEFT,TOP,WIDTH,HEIGHT")},
 		{"capture-movie", '\0', POPT_ARG_STRING|POPT_ARGFLAG_OPTIONAL, NULL,
 		 ARG_CAPTURE_MOVIE, N_("Capture a movie"), N_("COUNT or SECONDS")},
+		{"movie-format", '\0', POPT_ARG_STRING, NULL,
+		 ARG_MOVIE_FORMAT, N_("Write --capture-movie as 'mjpg' (default) or indexed 'avi'"), N_("FORMAT")},
+		{"movie-segment", '\0', POPT_ARG_STRING, NULL,
+		 ARG_MOVIE_SEGMENT, N_("Start a new movie file every SECONDS or MEGABYTES, e.g. 600s or 500M"), N_("LIMIT")},
+		{"benchmark-preview", '\0', POPT_ARG_STRING|POPT_ARGFLAG_OPTIONAL, NULL,
+		 ARG_BENCHMARK_PREVIEW, N_("Capture preview frames back to back and report fps, latencies and sizes"), N_("COUNT or SECONDS")},
+		{"benchmark-json", '\0', POPT_ARG_STRING, NULL,
+		 ARG_BENCHMARK_JSON, N_("Also write the --benchmark-preview results as JSON, '-' for stdout"), N_("FILENAME")},
+		{"serve-preview", '\0', POPT_ARG_STRING, NULL,
+		 ARG_SERVE_PREVIEW, N_("Stream the live view as MJPEG over HTTP, HOST defaults to localhost"), N_("[HOST:]PORT")},
+		{"publish-preview", '\0', POPT_ARG_STRING, NULL,
+		 ARG_PUBLISH_PREVIEW, N_("Publish live view frames in the shared memory ring /NAME"), N_("NAME")},
 		{"capture-sound", '\0', POPT_ARG_NONE, NULL,
 		 ARG_CAPTURE_SOUND, N_("Capture an audio clip"), NULL},
 		{"capture-tethered", '\0', POPT_ARG_STRING|POPT_ARGFLAG_OPTIONAL, NULL,
@@ -2277,7 +3027,11 @@ main (int argc, char **argv, char **envp)
                 poptFreeContext(ctx);
 		return 0;
 	}
-	if (debug_option_given) {
+	if (debug_domains)
+		CR_MAIN (debuglog_set_domains (debug_domains));
+	if (debug_binlog_name)
+		CR_MAIN (debuglog_open (debug_binlog_name, debug_binlog_size));
+	if (debug_option_given || debug_binlog_name) {
 		CR_MAIN (debug_action (&gp_params, debug_loglevel, debug_logfile_name));
 	}
 
@@ -2314,15 +3068,16 @@ main (int argc, char **argv, char **envp)
 		char buf[PATH_MAX];
 		if (gp_setting_get("gphoto2","hook-script",buf)>=0) {
 			gp_params.hook_script = strdup(buf);
-			/* Run init hook */
-			if (0!=gp_params_run_hook(&gp_params, "init", NULL)) {
-				fprintf(stdout,
-					"Hook script \"%s\" init failed. Aborting.\n",
-					gp_params.hook_script);
-				exit(3);
-			}
 		}	
 	}
+	/* Run init hook */
+	if (gp_params.hook_script &&
+	    (0!=gp_params_run_hook(&gp_params, "init", NULL))) {
+		fprintf(stderr,
+			"Hook script \"%s\" init failed. Aborting.\n",
+			gp_params.hook_script);
+		exit(3);
+	}
 	CR_MAIN (cb_params.p.r);
 
 #define CHECK_OPT(o)					\
@@ -2342,9 +3097,16 @@ main (int argc, char **argv, char **envp)
 	CHECK_OPT (ARG_ABILITIES);
 	CHECK_OPT (ARG_CAPTURE_IMAGE);
 	CHECK_OPT (ARG_CAPTURE_IMAGE_AND_DOWNLOAD);
+	CHECK_OPT (ARG_CAPTURE_SEQUENCE);
+	CHECK_OPT (ARG_CAPTURE_SEQUENCE_AND_DOWNLOAD);
+	CHECK_OPT (ARG_CAPTURE_MOTION);
+	CHECK_OPT (ARG_CAPTURE_MOTION_AND_DOWNLOAD);
 	CHECK_OPT (ARG_CAPTURE_MOVIE);
 	CHECK_OPT (ARG_CAPTURE_PREVIEW);
+	CHECK_OPT (ARG_BENCHMARK_PREVIEW);
 	CHECK_OPT (ARG_SHOW_PREVIEW);
+	CHECK_OPT (ARG_SERVE_PREVIEW);
+	CHECK_OPT (ARG_PUBLISH_PREVIEW);
 	CHECK_OPT (ARG_CAPTURE_SOUND);
 	CHECK_OPT (ARG_CAPTURE_TETHERED);
 	CHECK_OPT (ARG_CONFIG);
@@ -2356,19 +3118,24 @@ main (int argc, char **argv, char **envp)
 	CHECK_OPT (ARG_GET_ALL_THUMBNAILS);
 	CHECK_OPT (ARG_GET_AUDIO_DATA);
 	CHECK_OPT (ARG_GET_CONFIG);
+	CHECK_OPT (ARG_GET_CONFIG_LIST);
 	CHECK_OPT (ARG_GET_FILE);
 	CHECK_OPT (ARG_GET_RAW_DATA);
 	CHECK_OPT (ARG_GET_THUMBNAIL);
 	CHECK_OPT (ARG_LIST_CONFIG);
 	CHECK_OPT (ARG_LIST_FILES);
 	CHECK_OPT (ARG_LIST_FOLDERS);
+	CHECK_OPT (ARG_LOAD_CONFIG);
 	CHECK_OPT (ARG_MANUAL);
 	CHECK_OPT (ARG_MKDIR);
 	CHECK_OPT (ARG_NUM_FILES);
 	CHECK_OPT (ARG_RESET);
 	CHECK_OPT (ARG_RMDIR);
+	CHECK_OPT (ARG_SAVE_CONFIG);
 	CHECK_OPT (ARG_SET_CONFIG);
+	CHECK_OPT (ARG_SET_CONFIG_FILE);
 	CHECK_OPT (ARG_SET_CONFIG_INDEX);
+	CHECK_OPT (ARG_SET_CONFIG_LIST);
 	CHECK_OPT (ARG_SET_CONFIG_VALUE);
 	CHECK_OPT (ARG_SHELL);
 	CHECK_OPT (ARG_SHOW_EXIF);
@@ -2379,6 +3146,7 @@ main (int argc, char **argv, char **envp)
 	CHECK_OPT (ARG_UPLOAD_FILE);
 	CHECK_OPT (ARG_UPLOAD_METADATA);
 	CHECK_OPT (ARG_WAIT_EVENT);
+	CHECK_OPT (ARG_WATCH_CONFIG);
 	gp_port_info_get_type (info, &type);
 	if (cb_params.p.q.found &&
 	    (!strcmp (a.model, "") || (type == GP_PORT_NONE))) {
@@ -2437,6 +3205,7 @@ main (int argc, char **argv, char **envp)
 
                 } else if (!count) {
 			int ret;
+			double start;
 			/*
 			 * No camera detected. Have a look at the settings.
 			 * Ignore errors here, it might be a serial one.
@@ -2445,7 +3214,9 @@ main (int argc, char **argv, char **envp)
 				action_camera_set_model (&gp_params, buf);
 			if (gp_setting_get ("gphoto2", "port", buf) >= 0)
 				action_camera_set_port (&gp_params, buf);
+			start = trace_begin ();
 			ret = gp_camera_init (gp_params.camera, gp_params.context);
+			trace_end ("camera", "init", start, NULL);
 			if (ret != GP_OK) {
 				if (ret == GP_ERROR_BAD_PARAMETERS)
 					ret = -2000;
@@ -2608,6 +3379,9 @@ main (int argc, char **argv, char **envp)
 
 	CR_MAIN (cb_params.p.r);
 
+	/* Issue the deletes --move still has queued */
+	CR_MAIN (move_queue_flush (&gp_params, 1));
+
 	/* Run stop hook */
 	gp_params_run_hook(&gp_params, "stop", NULL);
 
@@ -0,0 +1,520 @@
+/* metrics.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "i18n.h"
+#include "main.h"
+#include "metrics.h"
+#include "probes.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include <gphoto2/gphoto2-port-log.h>
+
+/* 16 buckets per power of two, up to 2^40 us (12 days). */
+#define METRICS_SUB_BITS	4
+#define METRICS_SUB		(1 << METRICS_SUB_BITS)
+#define METRICS_MAX_USEC	((uint64_t) 1 << 40)
+#define METRICS_BUCKETS		((40 - METRICS_SUB_BITS + 2) * METRICS_SUB)
+
+#define METRICS_MAX_FILES	4
+
+typedef struct {
+	unsigned long	count, errors;
+	uint64_t	bytes;
+	uint64_t	usec, min, max;
+	unsigned int	bucket[METRICS_BUCKETS];
+} MetricsStat;
+
+static const char *const metrics_names[METRIC_COUNT] = {
+	"list_folders", "list_files", "get_info", "file_get", "delete",
+	"capture", "trigger_capture", "capture_preview", "wait_for_event",
+	"config_get", "config_set"
+};
+
+/* Buckets of the Prometheus histograms, in seconds. */
+static const double metrics_le[] = {
+	0.0001, 0.0005, 0.001, 0.005, 0.01, 0.05, 0.1, 0.5, 1, 5, 10, 30, 60
+};
+
+/* One set for the whole process, the camera calls do not know about
+ * GPParams. */
+static struct {
+	int		enabled;
+	char		*file[METRICS_MAX_FILES];
+	int		files;
+	double		start, written;
+	MetricsStat	stat[METRIC_COUNT];
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t	lock;
+#endif
+} metrics;
+
+static void
+metrics_lock (void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock (&metrics.lock);
+#endif
+}
+
+static void
+metrics_unlock (void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock (&metrics.lock);
+#endif
+}
+
+static double
+metrics_now (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+static unsigned int
+metrics_bucket (uint64_t usec)
+{
+	unsigned int shift = 0;
+
+	if (usec >= METRICS_MAX_USEC)
+		usec = METRICS_MAX_USEC - 1;
+	while ((usec >> shift) >= 2 * METRICS_SUB)
+		shift++;
+	return shift * METRICS_SUB + (unsigned int) (usec >> shift);
+}
+
+/* The largest value that goes into a bucket. */
+static uint64_t
+metrics_bucket_max (unsigned int bucket)
+{
+	unsigned int shift = (bucket < 2 * METRICS_SUB) ? 0 : bucket / METRICS_SUB - 1;
+	uint64_t m = bucket - shift * METRICS_SUB;
+
+	return ((m + 1) << shift) - 1;
+}
+
+static uint64_t
+metrics_percentile (MetricsStat *s, double q)
+{
+	unsigned long	seen = 0, want = (unsigned long) (q * s->count + 0.5);
+	unsigned int	i;
+
+	if (!want)
+		want = 1;
+	for (i = 0; i < METRICS_BUCKETS; i++) {
+		seen += s->bucket[i];
+		if (seen >= want)
+			break;
+	}
+	if (i == METRICS_BUCKETS)
+		return s->max;
+	return (metrics_bucket_max (i) < s->max) ? metrics_bucket_max (i) : s->max;
+}
+
+static void
+metrics_write_json (FILE *f, MetricsStat *stat, double uptime)
+{
+	MetricsStat	*s;
+	int		i, first = 1;
+
+	fprintf (f, "{\n  \"uptime\": %.3f,\n  \"operations\": {", uptime);
+	for (i = 0; i < METRIC_COUNT; i++) {
+		s = &stat[i];
+		if (!s->count)
+			continue;
+		fprintf (f, "%s\n    \"%s\": {\"count\": %lu, \"errors\": %lu, "
+			 "\"bytes\": %llu, \"seconds\": %.6f, \"min\": %.6f, "
+			 "\"p50\": %.6f, \"p90\": %.6f, \"p99\": %.6f, \"max\": %.6f}",
+			 first ? "" : ",", metrics_names[i], s->count, s->errors,
+			 (unsigned long long) s->bytes, s->usec / 1e6, s->min / 1e6,
+			 metrics_percentile (s, .5) / 1e6,
+			 metrics_percentile (s, .9) / 1e6,
+			 metrics_percentile (s, .99) / 1e6, s->max / 1e6);
+		first = 0;
+	}
+	fprintf (f, "\n  }\n}\n");
+}
+
+static void
+metrics_write_prom (FILE *f, MetricsStat *stat, double uptime)
+{
+	MetricsStat	*s;
+	unsigned long	below;
+	unsigned int	b;
+	int		i, k;
+
+	fprintf (f, "# HELP gphoto2_uptime_seconds Seconds since gphoto2 started.\n"
+		 "# TYPE gphoto2_uptime_seconds gauge\n"
+		 "gphoto2_uptime_seconds %.3f\n", uptime);
+
+	fprintf (f, "# HELP gphoto2_camera_calls_total Camera calls by operation.\n"
+		 "# TYPE gphoto2_camera_calls_total counter\n");
+	for (i = 0; i < METRIC_COUNT; i++)
+		if (stat[i].count)
+			fprintf (f, "gphoto2_camera_calls_total{op=\"%s\"} %lu\n",
+				 metrics_names[i], stat[i].count);
+
+	fprintf (f, "# HELP gphoto2_camera_errors_total Camera calls that failed.\n"
+		 "# TYPE gphoto2_camera_errors_total counter\n");
+	for (i = 0; i < METRIC_COUNT; i++)
+		if (stat[i].count)
+			fprintf (f, "gphoto2_camera_errors_total{op=\"%s\"} %lu\n",
+				 metrics_names[i], stat[i].errors);
+
+	fprintf (f, "# HELP gphoto2_camera_bytes_total Bytes moved by camera calls.\n"
+		 "# TYPE gphoto2_camera_bytes_total counter\n");
+	for (i = 0; i < METRIC_COUNT; i++)
+		if (stat[i].bytes)
+			fprintf (f, "gphoto2_camera_bytes_total{op=\"%s\"} %llu\n",
+				 metrics_names[i], (unsigned long long) stat[i].bytes);
+
+	fprintf (f, "# HELP gphoto2_camera_call_seconds Duration of camera calls.\n"
+		 "# TYPE gphoto2_camera_call_seconds histogram\n");
+	for (i = 0; i < METRIC_COUNT; i++) {
+		s = &stat[i];
+		if (!s->count)
+			continue;
+		below = 0;
+		b = 0;
+		for (k = 0; k < (int) (sizeof (metrics_le) / sizeof (metrics_le[0])); k++) {
+			while ((b < METRICS_BUCKETS) &&
+			       (metrics_bucket_max (b) <= metrics_le[k] * 1e6))
+				below += s->bucket[b++];
+			fprintf (f, "gphoto2_camera_call_seconds_bucket{op=\"%s\",le=\"%g\"} %lu\n",
+				 metrics_names[i], metrics_le[k], below);
+		}
+		fprintf (f, "gphoto2_camera_call_seconds_bucket{op=\"%s\",le=\"+Inf\"} %lu\n"
+			 "gphoto2_camera_call_seconds_sum{op=\"%s\"} %.6f\n"
+			 "gphoto2_camera_call_seconds_count{op=\"%s\"} %lu\n",
+			 metrics_names[i], s->count, metrics_names[i], s->usec / 1e6,
+			 metrics_names[i], s->count);
+	}
+}
+
+/* Replaces the files, readers never see half of one. */
+static void
+metrics_write (void)
+{
+	MetricsStat	*stat;
+	double		uptime;
+	char		*tmpname;
+	FILE		*f;
+	size_t		len;
+	int		i;
+
+	stat = malloc (sizeof (metrics.stat));
+	if (!stat)
+		return;
+	metrics_lock ();
+	memcpy (stat, metrics.stat, sizeof (metrics.stat));
+	metrics.written = metrics_now ();
+	uptime = metrics.written - metrics.start;
+	metrics_unlock ();
+
+	for (i = 0; i < metrics.files; i++) {
+		tmpname = malloc (strlen (metrics.file[i]) + 5);
+		if (!tmpname)
+			break;
+		sprintf (tmpname, "%s.tmp", metrics.file[i]);
+		f = fopen (tmpname, "w");
+		if (!f) {
+			gp_log (GP_LOG_DEBUG, "metrics", "Cannot write '%s'.", tmpname);
+			free (tmpname);
+			continue;
+		}
+		len = strlen (metrics.file[i]);
+		if ((len > 5) && !strcmp (metrics.file[i] + len - 5, ".prom"))
+			metrics_write_prom (f, stat, uptime);
+		else
+			metrics_write_json (f, stat, uptime);
+		if (ferror (f) | fclose (f) || rename (tmpname, metrics.file[i]))
+			unlink (tmpname);
+		free (tmpname);
+	}
+	free (stat);
+}
+
+static void
+metrics_exit (void)
+{
+	int i;
+
+	metrics_write ();
+	for (i = 0; i < metrics.files; i++)
+		free (metrics.file[i]);
+	metrics.files = 0;
+}
+
+int
+metrics_add_file (const char *filename)
+{
+	if (metrics.files == METRICS_MAX_FILES) {
+		cli_error_print (_("Too many metrics files, at most %d."),
+				 METRICS_MAX_FILES);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	metrics.file[metrics.files] = strdup (filename);
+	if (!metrics.file[metrics.files])
+		return GP_ERROR_NO_MEMORY;
+	if (!metrics.files++) {
+#ifdef HAVE_PTHREAD
+		pthread_mutex_init (&metrics.lock, NULL);
+#endif
+		metrics.start = metrics.written = metrics_now ();
+		metrics.enabled = 1;
+		atexit (metrics_exit);
+	}
+	return GP_OK;
+}
+
+/* Both the metrics and the trace time the calls, on the same clock. */
+static double
+metrics_begin (void)
+{
+	return metrics.enabled ? metrics_now () : trace_begin ();
+}
+
+/* what is the folder, file or config name the call was about. */
+static int
+metrics_end (MetricsOp op, const char *what, double start, int result)
+{
+	MetricsStat	*s = &metrics.stat[op];
+	double		now;
+	uint64_t	usec;
+	int		write;
+
+	trace_end ("camera", metrics_names[op], start, what);
+	if (!metrics.enabled)
+		return result;
+	now = metrics_now ();
+	usec = (now - start) * 1e6;
+	metrics_lock ();
+	if (!s->count || (usec < s->min))
+		s->min = usec;
+	if (usec > s->max)
+		s->max = usec;
+	s->count++;
+	s->usec += usec;
+	s->bucket[metrics_bucket (usec)]++;
+	if (result < GP_OK)
+		s->errors++;
+	write = (now - metrics.written >= METRICS_INTERVAL);
+	if (write)
+		metrics.written = now;
+	metrics_unlock ();
+	if (write)
+		metrics_write ();
+	return result;
+}
+
+void
+metrics_bytes (MetricsOp op, unsigned long bytes)
+{
+	if (!metrics.enabled)
+		return;
+	metrics_lock ();
+	metrics.stat[op].bytes += bytes;
+	metrics_unlock ();
+}
+
+int
+metered_camera_folder_list_folders (Camera *camera, const char *folder,
+				    CameraList *list, GPContext *context)
+{
+	double start = metrics_begin ();
+
+	return metrics_end (METRIC_LIST_FOLDERS, folder, start,
+		gp_camera_folder_list_folders (camera, folder, list, context));
+}
+
+int
+metered_camera_folder_list_files (Camera *camera, const char *folder,
+				  CameraList *list, GPContext *context)
+{
+	double start = metrics_begin ();
+
+	return metrics_end (METRIC_LIST_FILES, folder, start,
+		gp_camera_folder_list_files (camera, folder, list, context));
+}
+
+int
+metered_camera_folder_delete_all (Camera *camera, const char *folder,
+				  GPContext *context)
+{
+	double start = metrics_begin ();
+
+	return metrics_end (METRIC_DELETE, folder, start,
+		gp_camera_folder_delete_all (camera, folder, context));
+}
+
+int
+metered_camera_file_get_info (Camera *camera, const char *folder,
+			      const char *file, CameraFileInfo *info,
+			      GPContext *context)
+{
+	double start = metrics_begin ();
+
+	return metrics_end (METRIC_GET_INFO, file, start,
+		gp_camera_file_get_info (camera, folder, file, info, context));
+}
+
+int
+metered_camera_file_get (Camera *camera, const char *folder,
+			 const char *file, CameraFileType type,
+			 CameraFile *camera_file, GPContext *context)
+{
+	double start = metrics_begin ();
+
+	return metrics_end (METRIC_FILE_GET, file, start,
+		gp_camera_file_get (camera, folder, file, type, camera_file,
+				    context));
+}
+
+int
+metered_camera_file_delete (Camera *camera, const char *folder,
+			    const char *file, GPContext *context)
+{
+	double start = metrics_begin ();
+
+	return metrics_end (METRIC_DELETE, file, start,
+		gp_camera_file_delete (camera, folder, file, context));
+}
+
+int
+metered_camera_capture (Camera *camera, CameraCaptureType type,
+			CameraFilePath *path, GPContext *context)
+{
+	double	start = metrics_begin ();
+	int	r;
+
+	PROBE1 (capture_start, (int) type);
+	r = gp_camera_capture (camera, type, path, context);
+	PROBE3 (capture_done, r, path->folder, path->name);
+	return metrics_end (METRIC_CAPTURE, NULL, start, r);
+}
+
+int
+metered_camera_trigger_capture (Camera *camera, GPContext *context)
+{
+	double	start = metrics_begin ();
+	int	r;
+
+	PROBE1 (capture_start, -1);
+	r = gp_camera_trigger_capture (camera, context);
+	PROBE3 (capture_done, r, (const char *) NULL, (const char *) NULL);
+	return metrics_end (METRIC_TRIGGER_CAPTURE, NULL, start, r);
+}
+
+int
+metered_camera_capture_preview (Camera *camera, CameraFile *file,
+				GPContext *context)
+{
+	double start = metrics_begin ();
+
+	return metrics_end (METRIC_CAPTURE_PREVIEW, NULL, start,
+		gp_camera_capture_preview (camera, file, context));
+}
+
+int
+metered_camera_wait_for_event (Camera *camera, int timeout,
+			       CameraEventType *eventtype, void **eventdata,
+			       GPContext *context)
+{
+	double	start = metrics_begin ();
+	int	r;
+
+	r = gp_camera_wait_for_event (camera, timeout, eventtype, eventdata,
+				      context);
+	PROBE3 (event, r, (r == GP_OK) ? (int) *eventtype : -1, timeout);
+	if ((r == GP_OK) && (*eventtype == GP_EVENT_FILE_ADDED))
+		PROBE2 (file_added, ((CameraFilePath *) *eventdata)->folder,
+			((CameraFilePath *) *eventdata)->name);
+	return metrics_end (METRIC_WAIT_FOR_EVENT, NULL, start, r);
+}
+
+int
+metered_camera_get_config (Camera *camera, CameraWidget **window,
+			   GPContext *context)
+{
+	double start = metrics_begin ();
+
+	return metrics_end (METRIC_CONFIG_GET, NULL, start,
+		gp_camera_get_config (camera, window, context));
+}
+
+int
+metered_camera_get_single_config (Camera *camera, const char *name,
+				  CameraWidget **widget, GPContext *context)
+{
+	double start = metrics_begin ();
+
+	return metrics_end (METRIC_CONFIG_GET, name, start,
+		gp_camera_get_single_config (camera, name, widget, context));
+}
+
+int
+metered_camera_set_config (Camera *camera, CameraWidget *window,
+			   GPContext *context)
+{
+	double start = metrics_begin ();
+
+	return metrics_end (METRIC_CONFIG_SET, NULL, start,
+		gp_camera_set_config (camera, window, context));
+}
+
+int
+metered_camera_set_single_config (Camera *camera, const char *name,
+				  CameraWidget *widget, GPContext *context)
+{
+	double start = metrics_begin ();
+
+	return metrics_end (METRIC_CONFIG_SET, name, start,
+		gp_camera_set_single_config (camera, name, widget, context));
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
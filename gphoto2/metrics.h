@@ -0,0 +1,101 @@
+/* metrics.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_METRICS_H
+#define GPHOTO2_METRICS_H
+
+#include <gphoto2/gphoto2-camera.h>
+
+/*
+ * Counters, bytes and latency histograms of the camera calls, per
+ * operation. The histograms have 16 linear buckets per power of two
+ * microseconds, so percentiles are within about 6%.
+ *
+ * --metrics FILE writes them as JSON, or in the Prometheus text format
+ * if FILE ends in ".prom" (for node_exporter's textfile collector).
+ * The files are replaced every METRICS_INTERVAL seconds while calls
+ * come in, and at exit.
+ */
+
+#define METRICS_INTERVAL 10
+
+typedef enum {
+	METRIC_LIST_FOLDERS,
+	METRIC_LIST_FILES,
+	METRIC_GET_INFO,
+	METRIC_FILE_GET,
+	METRIC_DELETE,
+	METRIC_CAPTURE,
+	METRIC_TRIGGER_CAPTURE,
+	METRIC_CAPTURE_PREVIEW,
+	METRIC_WAIT_FOR_EVENT,
+	METRIC_CONFIG_GET,
+	METRIC_CONFIG_SET,
+	METRIC_COUNT
+} MetricsOp;
+
+/* --metrics FILE, may be given more than once */
+int  metrics_add_file (const char *filename);
+
+/* Counts bytes the caller knows an operation moved. */
+void metrics_bytes (MetricsOp op, unsigned long bytes);
+
+/* The camera calls, timed and traced (see trace.h). Same arguments and
+ * results as gp_camera_*. */
+int metered_camera_folder_list_folders (Camera *camera, const char *folder,
+					CameraList *list, GPContext *context);
+int metered_camera_folder_list_files   (Camera *camera, const char *folder,
+					CameraList *list, GPContext *context);
+int metered_camera_folder_delete_all   (Camera *camera, const char *folder,
+					GPContext *context);
+int metered_camera_file_get_info (Camera *camera, const char *folder,
+				  const char *file, CameraFileInfo *info,
+				  GPContext *context);
+int metered_camera_file_get      (Camera *camera, const char *folder,
+				  const char *file, CameraFileType type,
+				  CameraFile *camera_file, GPContext *context);
+int metered_camera_file_delete   (Camera *camera, const char *folder,
+				  const char *file, GPContext *context);
+int metered_camera_capture         (Camera *camera, CameraCaptureType type,
+				    CameraFilePath *path, GPContext *context);
+int metered_camera_trigger_capture (Camera *camera, GPContext *context);
+int metered_camera_capture_preview (Camera *camera, CameraFile *file,
+				    GPContext *context);
+int metered_camera_wait_for_event  (Camera *camera, int timeout,
+				    CameraEventType *eventtype,
+				    void **eventdata, GPContext *context);
+int metered_camera_get_config        (Camera *camera, CameraWidget **window,
+				      GPContext *context);
+int metered_camera_get_single_config (Camera *camera, const char *name,
+				      CameraWidget **widget,
+				      GPContext *context);
+int metered_camera_set_config        (Camera *camera, CameraWidget *window,
+				      GPContext *context);
+int metered_camera_set_single_config (Camera *camera, const char *name,
+				      CameraWidget *widget,
+				      GPContext *context);
+
+#endif /* !defined(GPHOTO2_METRICS_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,225 @@
+/* motion.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "gp-params.h"
+#include "i18n.h"
+#include "main.h"
+#include "motion.h"
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_JPEG
+# include "luma.h"
+#endif
+
+#include <gphoto2/gphoto2-port-log.h>
+
+/* Decode at no less than this width, enough to see a bird. */
+#define MOTION_MIN_WIDTH 80
+
+/*
+ * Differences are summed over blocks of this size, the frame counts as
+ * changed when one block does. A small subject moving in a large region
+ * would vanish in the mean over all of it.
+ */
+#define MOTION_BLOCK 16
+
+int
+motion_set_roi (GPParams *p, const char *spec)
+{
+	unsigned int	roi[4];
+	char		c;
+
+	if ((sscanf (spec, "%u,%u,%u,%u%c", &roi[0], &roi[1], &roi[2], &roi[3], &c) != 4) ||
+	    !roi[2] || !roi[3] || (roi[0] + roi[2] > 100) || (roi[1] + roi[3] > 100)) {
+		cli_error_print (_("Invalid motion region '%s', use LEFT,TOP,WIDTH,HEIGHT in percent, e.g. '25,25,50,50'."),
+				 spec);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	memcpy (p->motion_roi, roi, sizeof (roi));
+	return GP_OK;
+}
+
+#ifdef HAVE_JPEG
+
+struct _MotionDetector {
+	unsigned int	roi[4];		/* percent */
+	LumaImage	image[2];	/* the frame and the one before */
+	int		cur, have_prev;
+	uint32_t	*block;		/* sums of one row of blocks */
+	int		block_alloc;
+};
+
+/*
+ * Sum of absolute differences of one block row. With the length known
+ * at compile time even -O2 turns this into psadbw on x86 and uabdl on
+ * ARM; the partial blocks at the right edge take the plain loop.
+ */
+static uint32_t
+motion_sad_block (const unsigned char *a, const unsigned char *b)
+{
+	uint32_t	sum = 0;
+	int		i;
+
+	for (i = 0; i < MOTION_BLOCK; i++)
+		sum += abs (a[i] - b[i]);
+	return sum;
+}
+
+static uint32_t
+motion_sad (const unsigned char *a, const unsigned char *b, int n)
+{
+	uint32_t	sum = 0;
+	int		i;
+
+	for (i = 0; i < n; i++)
+		sum += abs (a[i] - b[i]);
+	return sum;
+}
+
+int
+motion_detector_new (GPParams *p, MotionDetector **detector)
+{
+	MotionDetector *d;
+
+	d = calloc (1, sizeof (MotionDetector));
+	if (!d)
+		return GP_ERROR_NO_MEMORY;
+	if (p->motion_roi[2])
+		memcpy (d->roi, p->motion_roi, sizeof (d->roi));
+	else {
+		d->roi[2] = 100;
+		d->roi[3] = 100;
+	}
+	*detector = d;
+	return GP_OK;
+}
+
+/* The largest mean difference of any block. */
+static double
+motion_compare (uint32_t *block, LumaImage *a, LumaImage *b)
+{
+	int	bx, by, y, x, n, bw, bh, w = a->width, h = a->height;
+	size_t	o;
+	double	diff, max = 0;
+
+	for (by = 0; by < h; by += MOTION_BLOCK) {
+		bh = (h - by < MOTION_BLOCK) ? h - by : MOTION_BLOCK;
+		memset (block, 0, ((w + MOTION_BLOCK - 1) / MOTION_BLOCK) * sizeof (uint32_t));
+		for (y = by; y < by + bh; y++) {
+			o = (size_t) y * w;
+			for (x = 0, bx = 0; x < w; x += MOTION_BLOCK, bx++) {
+				n = w - x;
+				if (n >= MOTION_BLOCK)
+					block[bx] += motion_sad_block (a->data + o + x, b->data + o + x);
+				else
+					block[bx] += motion_sad (a->data + o + x, b->data + o + x, n);
+			}
+		}
+		for (x = 0, bx = 0; x < w; x += MOTION_BLOCK, bx++) {
+			bw = (w - x < MOTION_BLOCK) ? w - x : MOTION_BLOCK;
+			diff = (double) block[bx] / (bw * bh);
+			if (diff > max)
+				max = diff;
+		}
+	}
+	return max;
+}
+
+int
+motion_detector_feed (MotionDetector *d, PreviewFrame *frame, double *diff)
+{
+	LumaImage	*cur = &d->image[d->cur], *prev = &d->image[!d->cur];
+	int		nb;
+
+	*diff = -1;
+	if (luma_decode (cur, frame->data, frame->size, MOTION_MIN_WIDTH,
+			 d->roi) != GP_OK)
+		return GP_ERROR_CORRUPTED_DATA;
+	nb = (cur->width + MOTION_BLOCK - 1) / MOTION_BLOCK;
+	if (d->block_alloc < nb) {
+		uint32_t *block = realloc (d->block, nb * sizeof (uint32_t));
+
+		if (!block)
+			return GP_ERROR_NO_MEMORY;
+		d->block = block;
+		d->block_alloc = nb;
+	}
+	if (d->have_prev && (cur->width == prev->width) &&
+	    (cur->height == prev->height))
+		*diff = motion_compare (d->block, cur, prev);
+	d->cur = !d->cur;
+	d->have_prev = 1;
+	return GP_OK;
+}
+
+void
+motion_detector_reset (MotionDetector *d)
+{
+	d->have_prev = 0;
+}
+
+void
+motion_detector_free (MotionDetector *d)
+{
+	if (!d)
+		return;
+	luma_image_clear (&d->image[0]);
+	luma_image_clear (&d->image[1]);
+	free (d->block);
+	free (d);
+}
+
+#else /* !HAVE_JPEG */
+
+int
+motion_detector_new (GPParams *p, MotionDetector **detector)
+{
+	cli_error_print (_("Motion detection needs libjpeg, which gphoto2 was built without."));
+	return GP_ERROR_NOT_SUPPORTED;
+}
+
+int
+motion_detector_feed (MotionDetector *d, PreviewFrame *frame, double *diff)
+{
+	return GP_ERROR_NOT_SUPPORTED;
+}
+
+void
+motion_detector_reset (MotionDetector *d)
+{
+}
+
+void
+motion_detector_free (MotionDetector *d)
+{
+}
+
+#endif /* HAVE_JPEG */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
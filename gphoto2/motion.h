@@ -0,0 +1,55 @@
+/* motion.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_MOTION_H
+#define GPHOTO2_MOTION_H
+
+#include <gp-params.h>
+#include <preview.h>
+
+/* --motion-roi LEFT,TOP,WIDTH,HEIGHT in percent of the frame */
+int motion_set_roi (GPParams *p, const char *spec);
+
+/*
+ * Compares each preview frame with the one before it. Only the luma of
+ * a downscaled decode is looked at, within the --motion-roi region. The
+ * difference is the mean absolute difference per pixel, 0 to 255, of
+ * the block that changed most.
+ */
+typedef struct _MotionDetector MotionDetector;
+
+int  motion_detector_new   (GPParams *p, MotionDetector **detector);
+
+/* Sets *diff to the difference to the previous frame, or to -1 if
+ * there is nothing to compare with yet. */
+int  motion_detector_feed  (MotionDetector *detector, PreviewFrame *frame,
+			    double *diff);
+
+/* Forget the previous frame, the next one becomes the reference. */
+void motion_detector_reset (MotionDetector *detector);
+void motion_detector_free  (MotionDetector *detector);
+
+#endif /* !defined(GPHOTO2_MOTION_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
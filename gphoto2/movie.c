@@ -0,0 +1,408 @@
+/* movie.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "gp-params.h"
+#include "i18n.h"
+#include "main.h"
+#include "movie.h"
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+
+#ifndef O_BINARY
+# define O_BINARY 0
+#endif
+
+#define CR(result) {int r = (result); if (r < 0) return (r);}
+
+/* RIFF sizes are 32 bit, stay well below. */
+#define AVI_MAX_BYTES		(1024UL * 1024 * 1024)
+/* Everything up to and including the "movi" list header. */
+#define AVI_HEADER_SIZE		224
+/* Index offsets count from the "movi" fourcc. */
+#define AVI_MOVI_OFFSET		220
+
+struct _MovieWriter {
+	GPParams	*p;
+	int		fd;
+	char		name[64];
+	unsigned int	segment;	/* 1 for the first file */
+
+	/* This file */
+	unsigned long	bytes;
+	unsigned long	frames;
+	struct timeval	first, last;
+
+	/* AVI */
+	uint32_t	*index;		/* offset and size of each frame */
+	unsigned long	index_size;
+	unsigned long	max_frame;
+	unsigned int	width, height;
+};
+
+int
+movie_set_format (GPParams *p, const char *format)
+{
+	if (!strcmp (format, "mjpg") || !strcmp (format, "mjpeg"))
+		p->movie_avi = 0;
+	else if (!strcmp (format, "avi"))
+		p->movie_avi = 1;
+	else {
+		cli_error_print (_("Unknown movie format '%s', use 'mjpg' or 'avi'."),
+				 format);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	return GP_OK;
+}
+
+int
+movie_set_segment (GPParams *p, const char *spec)
+{
+	char		*end;
+	unsigned long	n;
+
+	n = strtoul (spec, &end, 10);
+	if (n && !strcmp (end, "s")) {
+		p->movie_segment_seconds = n;
+		return GP_OK;
+	}
+	if (n && (!strcmp (end, "M") || !strcmp (end, "G"))) {
+		p->movie_segment_bytes = n * 1024 * 1024;
+		if (*end == 'G')
+			p->movie_segment_bytes *= 1024;
+		return GP_OK;
+	}
+	cli_error_print (_("Invalid movie segment '%s', use e.g. '600s' or '500M'."),
+			 spec);
+	return GP_ERROR_BAD_PARAMETERS;
+}
+
+static int
+movie_write (MovieWriter *w, const void *data, size_t size)
+{
+	const char	*s = data;
+	ssize_t		written;
+
+	while (size) {
+		written = write (w->fd, s, size);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			cli_error_print (_("Could not write to '%s': %s"),
+					 w->name, strerror (errno));
+			return GP_ERROR_OS_FAILURE;
+		}
+		s += written;
+		size -= written;
+		w->bytes += written;
+	}
+	return GP_OK;
+}
+
+static void
+put32 (unsigned char *b, uint32_t v)
+{
+	b[0] = v; b[1] = v >> 8; b[2] = v >> 16; b[3] = v >> 24;
+}
+
+static void
+put16 (unsigned char *b, uint16_t v)
+{
+	b[0] = v; b[1] = v >> 8;
+}
+
+/* Width and height from the JPEG start of frame marker. */
+static void
+movie_jpeg_size (const unsigned char *d, unsigned long size,
+		 unsigned int *width, unsigned int *height)
+{
+	unsigned long i = 2;
+
+	while (i + 9 < size) {
+		if (d[i] != 0xff)
+			return;
+		if (d[i + 1] == 0xff) {
+			i++;
+			continue;
+		}
+		if ((d[i + 1] >= 0xc0) && (d[i + 1] <= 0xcf) &&
+		    (d[i + 1] != 0xc4) && (d[i + 1] != 0xc8) && (d[i + 1] != 0xcc)) {
+			*height = (d[i + 5] << 8) | d[i + 6];
+			*width = (d[i + 7] << 8) | d[i + 8];
+			return;
+		}
+		i += 2 + ((d[i + 2] << 8) | d[i + 3]);
+	}
+}
+
+/* RIFF header of a complete file, one MJPG video stream. The movi list
+ * ends at movi_end, the index follows it. */
+static void
+movie_avi_header (MovieWriter *w, unsigned long movi_end, unsigned char *h)
+{
+	unsigned long usec = 0;
+
+	if (w->frames > 1)
+		usec = ((w->last.tv_sec - w->first.tv_sec) * 1000000UL +
+			w->last.tv_usec - w->first.tv_usec) / (w->frames - 1);
+
+	memset (h, 0, AVI_HEADER_SIZE);
+	memcpy (h, "RIFF", 4);
+	put32 (h + 4, w->bytes - 8);
+	memcpy (h + 8, "AVI LIST", 8);
+	put32 (h + 16, 192);
+	memcpy (h + 20, "hdrlavih", 8);
+	put32 (h + 28, 56);
+	put32 (h + 32, usec);			/* dwMicroSecPerFrame */
+	put32 (h + 44, 0x10);			/* AVIF_HASINDEX */
+	put32 (h + 48, w->frames);
+	put32 (h + 56, 1);			/* dwStreams */
+	put32 (h + 60, w->max_frame);
+	put32 (h + 64, w->width);
+	put32 (h + 68, w->height);
+	memcpy (h + 88, "LIST", 4);
+	put32 (h + 92, 116);
+	memcpy (h + 96, "strlstrh", 8);
+	put32 (h + 104, 56);
+	memcpy (h + 108, "vidsMJPG", 8);
+	put32 (h + 128, usec ? usec : 1);	/* dwScale */
+	put32 (h + 132, usec ? 1000000 : 1);	/* dwRate */
+	put32 (h + 140, w->frames);		/* dwLength */
+	put32 (h + 144, w->max_frame);
+	put32 (h + 148, 0xffffffff);		/* dwQuality */
+	put16 (h + 160, w->width);
+	put16 (h + 162, w->height);
+	memcpy (h + 164, "strf", 4);
+	put32 (h + 168, 40);
+	put32 (h + 172, 40);			/* BITMAPINFOHEADER */
+	put32 (h + 176, w->width);
+	put32 (h + 180, w->height);
+	put16 (h + 184, 1);
+	put16 (h + 186, 24);
+	memcpy (h + 188, "MJPG", 4);
+	put32 (h + 192, w->width * w->height * 3);
+	memcpy (h + 212, "LIST", 4);
+	put32 (h + 216, movi_end - AVI_MOVI_OFFSET);
+	memcpy (h + 220, "movi", 4);
+}
+
+static int
+movie_open (MovieWriter *w)
+{
+	GPParams	*p = w->p;
+	const char	*ext = p->movie_avi ? "avi" : "mjpg";
+	unsigned char	header[AVI_HEADER_SIZE];
+
+	w->segment++;
+	w->bytes = w->frames = w->index_size = w->max_frame = 0;
+	w->width = w->height = 0;
+	if (p->flags & FLAGS_STDOUT) {
+		strcpy (w->name, "stdout");
+		w->fd = dup (fileno (stdout));
+		return GP_OK;
+	}
+	if (p->movie_segment_seconds || p->movie_segment_bytes || (w->segment > 1))
+		snprintf (w->name, sizeof (w->name), "movie-%04u.%s", w->segment, ext);
+	else
+		snprintf (w->name, sizeof (w->name), "movie.%s", ext);
+	w->fd = open (w->name, O_WRONLY | O_CREAT | O_TRUNC | O_BINARY, 0660);
+	if (w->fd == -1) {
+		cli_error_print (_("Could not open '%s'."), w->name);
+		return GP_ERROR;
+	}
+	if (p->movie_avi) {
+		/* Filled in when the file is complete. */
+		memset (header, 0, sizeof (header));
+		CR (movie_write (w, header, sizeof (header)));
+	}
+	return GP_OK;
+}
+
+static int
+movie_close (MovieWriter *w)
+{
+	unsigned char	buf[8], header[AVI_HEADER_SIZE];
+	int		r = GP_OK;
+
+	/* The next segment could not be opened, there is nothing to finish. */
+	if (w->fd < 0)
+		return GP_OK;
+	if (w->p->movie_avi) {
+		unsigned long i, movi_end = w->bytes;
+
+		memcpy (buf, "idx1", 4);
+		put32 (buf + 4, w->frames * 16);
+		r = movie_write (w, buf, 8);
+		for (i = 0; (r == GP_OK) && (i < w->frames); i++) {
+			unsigned char e[16];
+
+			memcpy (e, "00dc", 4);
+			put32 (e + 4, 0x10);		/* AVIIF_KEYFRAME */
+			put32 (e + 8, w->index[2 * i]);
+			put32 (e + 12, w->index[2 * i + 1]);
+			r = movie_write (w, e, 16);
+		}
+		if (r == GP_OK) {
+			movie_avi_header (w, movi_end, header);
+			if (lseek (w->fd, 0, SEEK_SET) ||
+			    (write (w->fd, header, sizeof (header)) != sizeof (header))) {
+				cli_error_print (_("Could not write to '%s': %s"),
+						 w->name, strerror (errno));
+				r = GP_ERROR_OS_FAILURE;
+			}
+		}
+	}
+	if (close (w->fd) && (r == GP_OK)) {
+		cli_error_print (_("Could not write to '%s': %s"),
+				 w->name, strerror (errno));
+		r = GP_ERROR_OS_FAILURE;
+	}
+	w->fd = -1;
+	return r;
+}
+
+int
+movie_writer_new (GPParams *p, MovieWriter **writer)
+{
+	MovieWriter *w;
+	int r;
+
+	if ((p->flags & FLAGS_STDOUT) && p->movie_avi) {
+		cli_error_print (_("AVI movies can't be written to stdout."));
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	w = calloc (1, sizeof (MovieWriter));
+	if (!w)
+		return GP_ERROR_NO_MEMORY;
+	w->p = p;
+	r = movie_open (w);
+	if (r != GP_OK) {
+		free (w);
+		return r;
+	}
+	*writer = w;
+	return GP_OK;
+}
+
+const char *
+movie_writer_name (MovieWriter *w)
+{
+	return w->name;
+}
+
+/* Time to start the next file? Never on stdout. */
+static int
+movie_full (MovieWriter *w, PreviewFrame *frame)
+{
+	GPParams	*p = w->p;
+	unsigned long	limit = p->movie_segment_bytes;
+
+	if (!w->frames || (p->flags & FLAGS_STDOUT))
+		return 0;
+	if (p->movie_avi && (!limit || (limit > AVI_MAX_BYTES)))
+		limit = AVI_MAX_BYTES;
+	/* Room for this frame, and for the AVI index behind it. */
+	if (limit && (w->bytes + frame->size + 8 +
+		      (p->movie_avi ? 8 + 16 * (w->frames + 1) : 0) > limit))
+		return 1;
+	return p->movie_segment_seconds &&
+		(frame->time.tv_sec - w->first.tv_sec >= (long) p->movie_segment_seconds);
+}
+
+int
+movie_writer_put (MovieWriter *w, PreviewFrame *frame)
+{
+	unsigned char	buf[8];
+
+	/* Stopped when the next segment could not be opened. */
+	if (w->fd < 0)
+		return GP_ERROR;
+	if (movie_full (w, frame)) {
+		unsigned long frames = w->frames;
+		char name[sizeof (w->name)];
+
+		strcpy (name, w->name);
+		CR (movie_close (w));
+		CR (movie_open (w));
+		if (!(w->p->flags & FLAGS_QUIET))
+			fprintf (stderr, _("Wrote '%s' (%lu frames), continuing in '%s'.\n"),
+				 name, frames, w->name);
+	}
+	if (!w->frames)
+		w->first = frame->time;
+	w->last = frame->time;
+
+	if (!w->p->movie_avi) {
+		CR (movie_write (w, frame->data, frame->size));
+		w->frames++;
+		return GP_OK;
+	}
+
+	if (!w->frames)
+		movie_jpeg_size ((const unsigned char *) frame->data, frame->size,
+				 &w->width, &w->height);
+	if (2 * (w->frames + 1) > w->index_size) {
+		unsigned long size = w->index_size ? 2 * w->index_size : 2048;
+		uint32_t *index = realloc (w->index, size * sizeof (uint32_t));
+
+		if (!index)
+			return GP_ERROR_NO_MEMORY;
+		w->index = index;
+		w->index_size = size;
+	}
+	w->index[2 * w->frames] = w->bytes - AVI_MOVI_OFFSET;
+	w->index[2 * w->frames + 1] = frame->size;
+
+	memcpy (buf, "00dc", 4);
+	put32 (buf + 4, frame->size);
+	CR (movie_write (w, buf, 8));
+	CR (movie_write (w, frame->data, frame->size));
+	if (frame->size & 1)
+		CR (movie_write (w, "", 1));
+	if (frame->size > w->max_frame)
+		w->max_frame = frame->size;
+	w->frames++;
+	return GP_OK;
+}
+
+int
+movie_writer_close (MovieWriter *w)
+{
+	int r;
+
+	r = movie_close (w);
+	free (w->index);
+	free (w);
+	return r;
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
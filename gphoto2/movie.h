@@ -0,0 +1,52 @@
+/* movie.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_MOVIE_H
+#define GPHOTO2_MOVIE_H
+
+#include <gp-params.h>
+#include <preview.h>
+
+/* --movie-format mjpg|avi */
+int movie_set_format  (GPParams *p, const char *format);
+
+/* --movie-segment SECONDSs|MEGABYTESM */
+int movie_set_segment (GPParams *p, const char *spec);
+
+/*
+ * Writes the frames of --capture-movie to movie.mjpg or movie.avi, to
+ * movie-0001.mjpg, movie-0002.mjpg, ... with --movie-segment, or to
+ * stdout with --stdout (MJPEG only). AVI files get an index and are
+ * split at 1 GiB, as AVI 1.0 can't be larger.
+ */
+typedef struct _MovieWriter MovieWriter;
+
+int  movie_writer_new   (GPParams *p, MovieWriter **writer);
+const char *movie_writer_name (MovieWriter *writer);
+int  movie_writer_put   (MovieWriter *writer, PreviewFrame *frame);
+int  movie_writer_close (MovieWriter *writer);
+
+#endif /* !defined(GPHOTO2_MOVIE_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
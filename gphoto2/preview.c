@@ -0,0 +1,323 @@
+/* preview.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "globals.h"
+#include "gp-params.h"
+#include "i18n.h"
+#include "main.h"
+#include "metrics.h"
+#include "preview.h"
+#include "reconnect.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include <gphoto2/gphoto2-port-log.h>
+
+#define CR(result) {int r = (result); if (r < 0) return (r);}
+
+/* Retries while the camera is busy, e.g. still focusing. */
+#define PREVIEW_BUSY_TRIES 20
+
+struct _PreviewSource {
+	GPParams	*p;
+#ifdef HAVE_PTHREAD
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	pthread_cond_t	cond;	/* new frame or stopped */
+#endif
+
+	PreviewFrame	*latest;
+	unsigned long	seq;
+	int		running;
+	int		result;
+};
+
+static void
+preview_frame_free (PreviewFrame *frame)
+{
+	gp_file_unref (frame->file);
+	free (frame);
+}
+
+static int
+preview_capture (PreviewSource *s, PreviewFrame **frame)
+{
+	CameraFile	*file;
+	const char	*mime;
+	struct timeval	start;
+	int		r;
+
+	CR (gp_file_new (&file));
+	gettimeofday (&start, NULL);
+	r = metered_camera_capture_preview (s->p->camera, file, s->p->context);
+	if (r == GP_OK) {
+		gp_file_get_mime_type (file, &mime);
+		if (strcmp (mime, GP_MIME_JPEG)) {
+			cli_error_print (_("Movie capture error... Unhandled MIME type '%s'."), mime);
+			r = GP_ERROR_NOT_SUPPORTED;
+		}
+	}
+	if (r == GP_OK) {
+		*frame = calloc (1, sizeof (PreviewFrame));
+		if (!*frame)
+			r = GP_ERROR_NO_MEMORY;
+	}
+	if (r != GP_OK) {
+		gp_file_unref (file);
+		return r;
+	}
+	(*frame)->file = file;
+	(*frame)->refs = 1;
+	gettimeofday (&(*frame)->time, NULL);
+	(*frame)->capture_usec = (*frame)->time.tv_usec - start.tv_usec +
+		((*frame)->time.tv_sec - start.tv_sec) * 1000000L;
+	r = gp_file_get_data_and_size (file, &(*frame)->data, &(*frame)->size);
+	if (r != GP_OK) {
+		preview_frame_free (*frame);
+		*frame = NULL;
+	} else
+		metrics_bytes (METRIC_CAPTURE_PREVIEW, (*frame)->size);
+	return r;
+}
+
+/* Capture the next frame, riding out busy cameras and reconnects.
+ * Returns GP_OK with a new frame, or why there will be none. */
+static int
+preview_capture_retry (PreviewSource *s, PreviewFrame **frame)
+{
+	int r = GP_OK, busy = 0, attempt = 0;
+
+	while (s->running && !glob_cancel && !end_next) {
+		r = preview_capture (s, frame);
+		if (r == GP_OK)
+			return GP_OK;
+		if ((r == GP_ERROR_CAMERA_BUSY) && (busy++ < PREVIEW_BUSY_TRIES))
+			continue;
+		if (reconnect_retry (s->p, r, &attempt))
+			continue;
+		return r;
+	}
+	/* Asked to stop. */
+	return GP_ERROR_CANCEL;
+}
+
+#ifdef HAVE_PTHREAD
+
+static void *
+preview_thread (void *data)
+{
+	PreviewSource	*s = data;
+	PreviewFrame	*frame, *old;
+	int		r;
+
+	while ((r = preview_capture_retry (s, &frame)) == GP_OK) {
+		pthread_mutex_lock (&s->lock);
+		old = s->latest;
+		s->latest = frame;
+		frame->seq = ++s->seq;
+		pthread_cond_broadcast (&s->cond);
+		pthread_mutex_unlock (&s->lock);
+		if (old)
+			preview_frame_unref (s, old);
+	}
+
+	pthread_mutex_lock (&s->lock);
+	s->running = 0;
+	s->result = (r == GP_ERROR_CANCEL) ? GP_OK : r;
+	pthread_cond_broadcast (&s->cond);
+	pthread_mutex_unlock (&s->lock);
+	return NULL;
+}
+
+int
+preview_source_start (GPParams *p, PreviewSource **source)
+{
+	PreviewSource *s;
+
+	s = calloc (1, sizeof (PreviewSource));
+	if (!s)
+		return GP_ERROR_NO_MEMORY;
+	s->p = p;
+	s->running = 1;
+	pthread_mutex_init (&s->lock, NULL);
+	pthread_cond_init (&s->cond, NULL);
+	if (pthread_create (&s->thread, NULL, preview_thread, s)) {
+		pthread_cond_destroy (&s->cond);
+		pthread_mutex_destroy (&s->lock);
+		free (s);
+		return GP_ERROR_OS_FAILURE;
+	}
+	*source = s;
+	return GP_OK;
+}
+
+PreviewFrame *
+preview_source_next (PreviewSource *s, unsigned long seq)
+{
+	PreviewFrame *frame = NULL;
+
+	pthread_mutex_lock (&s->lock);
+	while (s->running && (!s->latest || (s->latest->seq <= seq)))
+		pthread_cond_wait (&s->cond, &s->lock);
+	if (s->running) {
+		frame = s->latest;
+		frame->refs++;
+	}
+	pthread_mutex_unlock (&s->lock);
+	return frame;
+}
+
+void
+preview_frame_unref (PreviewSource *s, PreviewFrame *frame)
+{
+	int refs;
+
+	pthread_mutex_lock (&s->lock);
+	refs = --frame->refs;
+	pthread_mutex_unlock (&s->lock);
+	if (!refs)
+		preview_frame_free (frame);
+}
+
+int
+preview_source_running (PreviewSource *s)
+{
+	int running;
+
+	pthread_mutex_lock (&s->lock);
+	running = s->running;
+	pthread_mutex_unlock (&s->lock);
+	return running;
+}
+
+unsigned long
+preview_source_frames (PreviewSource *s)
+{
+	unsigned long seq;
+
+	pthread_mutex_lock (&s->lock);
+	seq = s->seq;
+	pthread_mutex_unlock (&s->lock);
+	return seq;
+}
+
+int
+preview_source_halt (PreviewSource *s)
+{
+	pthread_mutex_lock (&s->lock);
+	s->running = 0;
+	pthread_cond_broadcast (&s->cond);
+	pthread_mutex_unlock (&s->lock);
+	pthread_join (s->thread, NULL);
+	return s->result;
+}
+
+void
+preview_source_free (PreviewSource *s)
+{
+	if (s->latest)
+		preview_frame_unref (s, s->latest);
+	pthread_cond_destroy (&s->cond);
+	pthread_mutex_destroy (&s->lock);
+	free (s);
+}
+
+#else /* !HAVE_PTHREAD */
+
+/* Without threads, the consumer captures each frame itself. */
+
+int
+preview_source_start (GPParams *p, PreviewSource **source)
+{
+	PreviewSource *s;
+
+	s = calloc (1, sizeof (PreviewSource));
+	if (!s)
+		return GP_ERROR_NO_MEMORY;
+	s->p = p;
+	s->running = 1;
+	*source = s;
+	return GP_OK;
+}
+
+PreviewFrame *
+preview_source_next (PreviewSource *s, unsigned long seq)
+{
+	PreviewFrame *frame;
+	int r;
+
+	if (!s->running)
+		return NULL;
+	r = preview_capture_retry (s, &frame);
+	if (r != GP_OK) {
+		s->running = 0;
+		s->result = (r == GP_ERROR_CANCEL) ? GP_OK : r;
+		return NULL;
+	}
+	frame->seq = ++s->seq;
+	return frame;
+}
+
+void
+preview_frame_unref (PreviewSource *s, PreviewFrame *frame)
+{
+	if (!--frame->refs)
+		preview_frame_free (frame);
+}
+
+int
+preview_source_running (PreviewSource *s)
+{
+	return s->running;
+}
+
+unsigned long
+preview_source_frames (PreviewSource *s)
+{
+	return s->seq;
+}
+
+int
+preview_source_halt (PreviewSource *s)
+{
+	s->running = 0;
+	return s->result;
+}
+
+void
+preview_source_free (PreviewSource *s)
+{
+	free (s);
+}
+
+#endif /* HAVE_PTHREAD */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,77 @@
+/* preview.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_PREVIEW_H
+#define GPHOTO2_PREVIEW_H
+
+#include <gp-params.h>
+
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+/*
+ * A preview frame as captured, shared by all consumers. data points
+ * into the CameraFile, so nobody copies it; hold a reference while
+ * using it.
+ */
+typedef struct _PreviewFrame PreviewFrame;
+struct _PreviewFrame {
+	CameraFile	*file;
+	const char	*data;
+	unsigned long	size;
+	unsigned long	seq;	/* 1 for the first frame, gaps are drops */
+	struct timeval	time;	/* when capturing it finished */
+	long		capture_usec;	/* time gp_camera_capture_preview took */
+	int		refs;
+};
+
+/*
+ * Captures preview frames on its own thread as fast as the camera
+ * delivers them. Only the newest frame is kept; consumers that are too
+ * slow skip frames and never hold up the camera. Without pthread,
+ * preview_source_next captures the frame itself.
+ */
+typedef struct _PreviewSource PreviewSource;
+
+int  preview_source_start   (GPParams *p, PreviewSource **source);
+
+/* Returns the newest frame after seq, waiting for it if needed, or NULL
+ * once the source has stopped. Pass the frame to preview_frame_unref. */
+PreviewFrame *preview_source_next (PreviewSource *source, unsigned long seq);
+void preview_frame_unref    (PreviewSource *source, PreviewFrame *frame);
+
+int  preview_source_running (PreviewSource *source);
+unsigned long preview_source_frames (PreviewSource *source);
+
+/* Stops capturing and wakes up all waiting consumers. Returns why
+ * the capture thread ended, GP_OK if it was asked to. */
+int  preview_source_halt    (PreviewSource *source);
+
+/* All consumers must be done with the source. */
+void preview_source_free    (PreviewSource *source);
+
+#endif /* !defined(GPHOTO2_PREVIEW_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
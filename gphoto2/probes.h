@@ -0,0 +1,68 @@
+/* probes.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_PROBES_H
+#define GPHOTO2_PROBES_H
+
+/*
+ * USDT probes of the provider gphoto2, for bpftrace, perf and
+ * SystemTap. configure adds them where <sys/sdt.h> works, unless
+ * --without-usdt; each is a nop until a tracer attaches. For example
+ *
+ *   bpftrace -e 'usdt:/usr/bin/gphoto2:gphoto2:download_done
+ *                { @bytes = hist(arg3); }'
+ *
+ * Strings are passed as pointers, results as GP_* codes.
+ *
+ *   download_start  folder, file, CameraFileType
+ *   download_done   folder, file, result, bytes
+ *   capture_start   CameraCaptureType, -1 for a trigger
+ *   capture_done    result, folder, file (NULL after a trigger)
+ *   event           result, CameraEventType, timeout in ms
+ *   file_added      folder, file
+ *   hook_start      action, argument
+ *   hook_done       action, argument, result (0 if it worked)
+ *   hook_job_start  pid, argument, for --hook-jobs
+ *   hook_job_done   pid, wait status
+ *   retry           result, attempt, whether it is retried
+ *   backoff         attempt, seconds slept before it
+ *   reconnect_done  result
+ */
+
+#ifdef HAVE_USDT
+# include <sys/sdt.h>
+# define PROBE1(name, a)		DTRACE_PROBE1 (gphoto2, name, a)
+# define PROBE2(name, a, b)		DTRACE_PROBE2 (gphoto2, name, a, b)
+# define PROBE3(name, a, b, c)		DTRACE_PROBE3 (gphoto2, name, a, b, c)
+# define PROBE4(name, a, b, c, d)	DTRACE_PROBE4 (gphoto2, name, a, b, c, d)
+#else
+# define PROBE1(name, a)		do {} while (0)
+# define PROBE2(name, a, b)		do {} while (0)
+# define PROBE3(name, a, b, c)		do {} while (0)
+# define PROBE4(name, a, b, c, d)	do {} while (0)
+#endif
+
+#endif /* !defined(GPHOTO2_PROBES_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,412 @@
+/* progress.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "gp-params.h"
+#include "i18n.h"
+#include "main.h"
+#include "progress.h"
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_FCNTL_H
+# include <fcntl.h>
+#endif
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+
+#include <gphoto2/gphoto2-port-log.h>
+
+#ifndef MAX
+#define MAX(x, y) (((x)>(y))?(x):(y))
+#endif
+#ifndef MIN
+#define MIN(x, y) (((x)<(y))?(x):(y))
+#endif
+
+#define PROGRESS_MAX_STATES	16
+#define PROGRESS_MAX_MSG_LEN	1024
+#define PROGRESS_INTERVAL	0.1	/* seconds between redraws */
+#define PROGRESS_RATE_TAU	2.0	/* seconds the rate is averaged over */
+
+typedef struct {
+	char		message[PROGRESS_MAX_MSG_LEN + 1];
+	float		target;		/* 0 if the slot is free */
+	unsigned long	size;		/* bytes of the target, 0 if unknown */
+	unsigned long	spin;
+	double		start, last;	/* started, last redrawn */
+	float		current;	/* at the last redraw */
+	double		rate;		/* units per second, < 0 until known */
+} ProgressState;
+
+struct _GPProgress {
+	int		fd;		/* --progress-fd, -1 if none */
+	int		tty;		/* bars on stdout */
+	ProgressState	state[PROGRESS_MAX_STATES];
+
+	char		*file;		/* being downloaded, NULL if none */
+	unsigned long	size;
+	double		file_start;
+
+	unsigned int	files, index;	/* in the batch, current one */
+	unsigned int	done;		/* files downloaded */
+	double		bytes, busy;	/* their known bytes, and seconds */
+};
+
+/* Seconds on a clock that does not jump with the wall clock. */
+static double
+progress_now (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+static GPProgress *
+progress_get (GPParams *p)
+{
+	if (!p->progress) {
+		p->progress = calloc (1, sizeof (GPProgress));
+		if (!p->progress)
+			return NULL;
+		p->progress->fd = -1;
+		p->progress->tty = isatty (STDOUT_FILENO);
+	}
+	return p->progress;
+}
+
+static int
+progress_draws (GPParams *p)
+{
+	return p->progress->tty && !(p->flags & FLAGS_QUIET);
+}
+
+/* Time left as " 1h 2m 3s", empty while unknown. */
+static void
+progress_eta (char *buf, size_t size, ProgressState *s)
+{
+	long	sec;
+	int	n = 0;
+
+	buf[0] = '\0';
+	if (s->rate <= 0)
+		return;
+	sec = (long) (MAX (0, s->target - s->current) / s->rate + 0.5);
+	if (sec >= 3600)
+		n += snprintf (buf + n, size - n, "%2lih", sec / 3600);
+	sec %= 3600;
+	if ((sec >= 60) && (n < (int) size))
+		n += snprintf (buf + n, size - n, "%2lim", sec / 60);
+	sec %= 60;
+	if (sec && (n < (int) size))
+		snprintf (buf + n, size - n, "%2lis", sec);
+}
+
+/* One write for the whole bar, no matter how wide. */
+static void
+progress_draw (GPParams *p, ProgressState *s)
+{
+	static const char spinner[] = "\\|/-";
+	GPProgress	*g = p->progress;
+	char		line[PROGRESS_MAX_MSG_LEN + 1024], right[64];
+	char		eta[16], rate[24] = "", file[24] = "";
+	int		width, pos, n, i;
+	float		fraction = MIN (s->current / s->target, 1.);
+
+	progress_eta (eta, sizeof (eta), s);
+	if (s->size && (s->rate > 0))
+		snprintf (rate, sizeof (rate), " %6.1f MB/s",
+			  s->rate / s->target * s->size / 1e6);
+	if ((g->files > 1) && g->index)
+		snprintf (file, sizeof (file), " %u/%u", g->index, g->files);
+	snprintf (right, sizeof (right), " %5.1f%%%s %9.9s%s",
+		  fraction * 100., rate, eta, file);
+
+	n = snprintf (line, sizeof (line), "%s |", s->message);
+	width = (int) p->cols - n - 1 - (int) strlen (right);
+	width = MAX (0, MIN (width, (int) (sizeof (line) - n - sizeof (right) - 3)));
+	pos = MIN (width, (int) (fraction * width + 0.5));
+	for (i = 0; i < width; i++)
+		line[n++] = (i < pos) ? '-' : ' ';
+	line[n++] = (pos == width) ? '|' : spinner[s->spin++ & 0x03];
+	snprintf (line + n, sizeof (line) - n, "%s\r", right);
+
+	fputs (line, stdout);
+	fflush (stdout);
+}
+
+static void
+progress_write (GPProgress *g, const char *line, int len)
+{
+	if ((len > 0) && (write (g->fd, line, MIN (len, 4095)) < 0))
+		gp_log (GP_LOG_DEBUG, "progress", "Cannot write to fd %d.", g->fd);
+}
+
+static const char *
+progress_name (GPProgress *g, ProgressState *s)
+{
+	return g->file ? g->file : s->message;
+}
+
+static void
+progress_report (GPProgress *g, ProgressState *s)
+{
+	char	line[4096];
+	double	fraction = MIN (s->current / s->target, 1.), left = -1, rate = -1;
+
+	if (s->rate > 0)
+		left = MAX (0, s->target - s->current) / s->rate;
+	if (s->size && (s->rate > 0))
+		rate = s->rate / s->target * s->size;
+	progress_write (g, line, snprintf (line, sizeof (line),
+		"progress\t%.4f\t%.0f\t%.0f\t%.0f\t%.1f\t%u\t%u\t%s\n",
+		fraction, s->size ? fraction * s->size : -1.,
+		s->size ? (double) s->size : -1., rate, left,
+		g->index, g->files, progress_name (g, s)));
+}
+
+static unsigned int
+progress_start_func (GPContext *context, float target, const char *str,
+		     void *data)
+{
+	GPParams	*p = data;
+	GPProgress	*g = p->progress;
+	ProgressState	*s;
+	unsigned int	id, len;
+
+	if (!g)
+		return 0;
+
+	/*
+	 * If the message is too long, we will shorten it. If we have less
+	 * than 4 cols available, we won't display any message.
+	 */
+	len = (p->cols * 0.5 < 4) ? 0 : MIN (p->cols * 0.5, PROGRESS_MAX_MSG_LEN);
+
+	for (id = 0; id < PROGRESS_MAX_STATES; id++)
+		if (!g->state[id].target)
+			break;
+	if (id == PROGRESS_MAX_STATES)
+		id--;
+	s = &g->state[id];
+	s->target = target;
+	s->message[0] = '\0';
+	if (len) {
+		strncpy (s->message, str, len);
+		s->message[len] = '\0';
+		if (strlen (str) > len)
+			strcpy (s->message + len - 3, "...");
+	}
+	s->size = g->file ? g->size : 0;
+	s->spin = 0;
+	s->start = s->last = progress_now ();
+	s->current = 0.;
+	s->rate = -1.;
+	return id;
+}
+
+static void
+progress_update_func (GPContext *context, unsigned int id, float current,
+		      void *data)
+{
+	GPParams	*p = data;
+	ProgressState	*s;
+	double		now, dt, rate;
+
+	/* Guard against buggy camera drivers */
+	if (!p->progress || (id >= PROGRESS_MAX_STATES))
+		return;
+	s = &p->progress->state[id];
+	if (!s->target)
+		return;
+
+	/* Fast transfers report far more often than anybody can read. */
+	now = progress_now ();
+	dt = now - s->last;
+	if ((current < s->target) && (dt < PROGRESS_INTERVAL))
+		return;
+
+	if (dt > 0.001) {
+		rate = (current - s->current) / dt;
+		if (s->rate < 0)
+			s->rate = rate;
+		else
+			s->rate += (1. - exp (-dt / PROGRESS_RATE_TAU)) * (rate - s->rate);
+	}
+	s->last = now;
+	s->current = current;
+
+	if (progress_draws (p))
+		progress_draw (p, s);
+	if (p->progress->fd >= 0)
+		progress_report (p->progress, s);
+}
+
+static void
+progress_stop_func (GPContext *context, unsigned int id, void *data)
+{
+	GPParams	*p = data;
+	GPProgress	*g = p->progress;
+	ProgressState	*s;
+	char		line[4096];
+	double		sec;
+
+	/* Guard against buggy camera drivers */
+	if (!g || (id >= PROGRESS_MAX_STATES))
+		return;
+	s = &g->state[id];
+
+	/* Clear the progress bar. */
+	if (progress_draws (p)) {
+		printf ("%*s\r", (int) p->cols, "");
+		fflush (stdout);
+	}
+	if ((g->fd >= 0) && s->target) {
+		sec = progress_now () - s->start;
+		progress_write (g, line, snprintf (line, sizeof (line),
+			"done\t%.0f\t%.3f\t%.0f\t%u\t%u\t%s\n",
+			s->size ? (double) s->size : -1., sec,
+			(s->size && (sec > 0)) ? s->size / sec : -1.,
+			g->index, g->files, progress_name (g, s)));
+	}
+	s->target = 0.;
+}
+
+static void
+progress_install (GPParams *p)
+{
+	gp_context_set_progress_funcs (p->context, progress_start_func,
+		progress_update_func, progress_stop_func, p);
+}
+
+void
+progress_init (GPParams *p)
+{
+	/* Report progress only if users will see it. */
+	if (isatty (STDOUT_FILENO) && progress_get (p))
+		progress_install (p);
+}
+
+int
+progress_set_fd (GPParams *p, const char *fd)
+{
+	char	*end;
+	long	n;
+
+	n = strtol (fd, &end, 10);
+	if (*end || (n < 0) || (n > 65535)
+#ifdef HAVE_FCNTL_H
+	    || (fcntl (n, F_GETFD) < 0)
+#endif
+	    ) {
+		cli_error_print (_("Invalid progress file descriptor '%s'."), fd);
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	if (!progress_get (p))
+		return GP_ERROR_NO_MEMORY;
+	p->progress->fd = n;
+	progress_install (p);
+	return GP_OK;
+}
+
+int
+progress_wanted (GPParams *p)
+{
+	return p->progress && ((p->progress->fd >= 0) || progress_draws (p));
+}
+
+void
+progress_batch_add (GPParams *p, int count)
+{
+	if (p->progress)
+		p->progress->files += count;
+}
+
+void
+progress_batch_next (GPParams *p)
+{
+	if (p->progress)
+		p->progress->index++;
+}
+
+void
+progress_file_start (GPParams *p, const char *name, unsigned long size)
+{
+	GPProgress *g = p->progress;
+
+	if (!g)
+		return;
+	free (g->file);
+	g->file = strdup (name);
+	g->size = size;
+	g->file_start = progress_now ();
+}
+
+void
+progress_file_stop (GPParams *p, int result)
+{
+	GPProgress *g = p->progress;
+
+	if (!g || !g->file)
+		return;
+	if (result >= GP_OK) {
+		g->done++;
+		g->bytes += g->size;
+		if (g->size)
+			g->busy += progress_now () - g->file_start;
+	}
+	free (g->file);
+	g->file = NULL;
+}
+
+void
+progress_free (GPParams *p)
+{
+	GPProgress *g = p->progress;
+
+	if (!g)
+		return;
+	if (progress_draws (p) && (g->done > 1) && (g->busy > 0))
+		printf (_("Downloaded %u files, %.1f MB in %.1f seconds (%.1f MB/s).\n"),
+			g->done, g->bytes / 1e6, g->busy, g->bytes / 1e6 / g->busy);
+	free (g->file);
+	free (g);
+	p->progress = NULL;
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
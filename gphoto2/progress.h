@@ -0,0 +1,70 @@
+/* progress.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_PROGRESS_H
+#define GPHOTO2_PROGRESS_H
+
+#include <gp-params.h>
+
+/*
+ * Progress bars of the camera drivers, redrawn at most ten times a
+ * second. While a file is downloaded, its size turns the driver's
+ * units into bytes for the transfer rate (averaged over about two
+ * seconds) and the time left; in a batch the bar also shows the file
+ * number.
+ *
+ * --progress-fd FD gets the same on lines of tab separated fields,
+ * the name last:
+ *
+ *   progress FRACTION BYTES TOTAL BYTES/S SECONDS-LEFT FILE FILES NAME
+ *   done     BYTES SECONDS BYTES/S FILE FILES NAME
+ *
+ * Byte counts, rate and time left are -1 while unknown; FILE and FILES
+ * are 0 outside of a batch.
+ */
+
+/* Sets up the context's progress functions, from gp_params_init(). */
+void progress_init   (GPParams *p);
+/* --progress-fd FD */
+int  progress_set_fd (GPParams *p, const char *fd);
+
+/* Nonzero if anybody sees progress, so that it is worth asking the
+ * camera for file sizes. */
+int  progress_wanted (GPParams *p);
+
+/* count more files will be visited, one after the other. */
+void progress_batch_add  (GPParams *p, int count);
+void progress_batch_next (GPParams *p);
+
+/* A file of size bytes (0 if unknown) is being downloaded, stop gets
+ * the result of the download. */
+void progress_file_start (GPParams *p, const char *name, unsigned long size);
+void progress_file_stop  (GPParams *p, int result);
+
+/* Prints the totals of a batch. */
+void progress_free (GPParams *p);
+
+#endif /* !defined(GPHOTO2_PROGRESS_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,204 @@
+/* reconnect.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "actions.h"
+#include "globals.h"
+#include "gp-params.h"
+#include "i18n.h"
+#include "probes.h"
+#include "reconnect.h"
+#include "trace.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gphoto2/gphoto2-port-info-list.h>
+#include <gphoto2/gphoto2-port-log.h>
+
+#define CR(result) {int r = (result); if (r < 0) return (r);}
+
+/* Longest pause between two attempts, in seconds. */
+#define RECONNECT_MAX_DELAY 30
+
+int
+reconnect_is_io_error (int result)
+{
+	switch (result) {
+	case GP_ERROR_IO:
+	case GP_ERROR_IO_INIT:
+	case GP_ERROR_IO_READ:
+	case GP_ERROR_IO_WRITE:
+	case GP_ERROR_IO_UPDATE:
+	case GP_ERROR_IO_USB_CLEAR_HALT:
+	case GP_ERROR_IO_USB_FIND:
+	case GP_ERROR_TIMEOUT:
+		return 1;
+	default:
+		return 0;
+	}
+}
+
+/*
+ * Find the USB port our camera came back on. Prefer the same model on
+ * the old port, then the same model anywhere, then the same USB ID.
+ */
+static int
+reconnect_find_usb_port (GPParams *p, CameraAbilities *a, const char *oldpath,
+			 char *path, size_t size)
+{
+	CameraList *list;
+	const char *xmodel, *xport;
+	int i, count, found = -1;
+
+	CR (gp_list_new (&list));
+	gp_abilities_list_detect (gp_params_abilities_list (p),
+				  p->portinfo_list, list, p->context);
+	count = gp_list_count (list);
+	for (i = 0; i < count; i++) {
+		gp_list_get_name (list, i, &xmodel);
+		gp_list_get_value (list, i, &xport);
+		if (strcmp (xmodel, a->model))
+			continue;
+		if (found < 0 || !strcmp (xport, oldpath))
+			found = i;
+	}
+	for (i = 0; (found < 0) && (i < count); i++) {
+		CameraAbilities alt;
+		int m;
+
+		gp_list_get_name (list, i, &xmodel);
+		m = gp_abilities_list_lookup_model (gp_params_abilities_list (p), xmodel);
+		if (m < GP_OK)
+			continue;
+		if (gp_abilities_list_get_abilities (gp_params_abilities_list (p), m, &alt) < GP_OK)
+			continue;
+		if ((alt.usb_vendor == a->usb_vendor) &&
+		    (alt.usb_product == a->usb_product))
+			found = i;
+	}
+	if (found < 0) {
+		gp_list_free (list);
+		return GP_ERROR_MODEL_NOT_FOUND;
+	}
+	gp_list_get_value (list, found, &xport);
+	strncpy (path, xport, size - 1);
+	path[size - 1] = '\0';
+	gp_list_free (list);
+	return GP_OK;
+}
+
+int
+reconnect_camera (GPParams *p)
+{
+	CameraAbilities a;
+	GPPortInfo info;
+	GPPortType type;
+	char *xpath, oldpath[1024], path[1024];
+	unsigned int delay = 1;
+	int i, r = GP_ERROR_IO;
+
+	CR (gp_camera_get_abilities (p->camera, &a));
+	CR (gp_camera_get_port_info (p->camera, &info));
+	gp_port_info_get_type (info, &type);
+	gp_port_info_get_path (info, &xpath);
+	strncpy (oldpath, xpath, sizeof (oldpath) - 1);
+	oldpath[sizeof (oldpath) - 1] = '\0';
+
+	gp_camera_exit (p->camera, p->context);
+
+	for (i = 0; i < p->reconnect_tries; i++) {
+		if (glob_cancel)
+			return GP_ERROR_CANCEL;
+
+		/* Give the device time to come back on the bus. */
+		PROBE2 (backoff, i + 1, delay);
+		sleep (delay);
+		if (delay < RECONNECT_MAX_DELAY)
+			delay *= 2;
+
+		gp_log (GP_LOG_DEBUG, "reconnect", "Attempt %d to reconnect "
+			"'%s' on '%s'...", i + 1, a.model, oldpath);
+
+		/* The port list is stale after a reset, load it again. */
+		if (p->portinfo_list) {
+			gp_port_info_list_free (p->portinfo_list);
+			p->portinfo_list = NULL;
+		}
+		_get_portinfo_list (p);
+		if (!p->portinfo_list)
+			continue;
+
+		if (type == GP_PORT_USB)
+			r = reconnect_find_usb_port (p, &a, oldpath,
+						     path, sizeof (path));
+		else {
+			strcpy (path, oldpath);
+			r = GP_OK;
+		}
+		if (r == GP_OK)
+			r = action_camera_set_port (p, path);
+		if (r == GP_OK)
+			r = gp_camera_init (p->camera, p->context);
+		if (r == GP_OK) {
+			if (!(p->flags & FLAGS_QUIET))
+				printf (_("Reconnected to camera on port %s.\n"),
+					path);
+			return GP_OK;
+		}
+		gp_camera_exit (p->camera, p->context);
+	}
+	return r;
+}
+
+int
+reconnect_retry (GPParams *p, int result, int *attempt)
+{
+	double	start;
+	int	r;
+
+	if (!p->reconnect_tries || !reconnect_is_io_error (result))
+		return 0;
+	if (glob_cancel || (*attempt >= p->reconnect_tries)) {
+		PROBE3 (retry, result, *attempt, 0);
+		return 0;
+	}
+	(*attempt)++;
+	PROBE3 (retry, result, *attempt, 1);
+
+	fprintf (stderr, _("Lost connection to camera (%s), reconnecting...\n"),
+		 gp_result_as_string (result));
+	start = trace_begin ();
+	r = reconnect_camera (p);
+	PROBE1 (reconnect_done, r);
+	trace_end ("camera", "reconnect", start, gp_result_as_string (result));
+	if (r != GP_OK) {
+		fprintf (stderr, _("Could not reconnect to camera.\n"));
+		return 0;
+	}
+	return 1;
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
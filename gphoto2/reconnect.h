@@ -0,0 +1,48 @@
+/* reconnect.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_RECONNECT_H
+#define GPHOTO2_RECONNECT_H
+
+#include <gp-params.h>
+
+/* Errors that mean the connection is gone, rather than the request
+ * being refused. */
+int reconnect_is_io_error (int result);
+
+/* Close the camera, look it up again (USB devices get a new bus address
+ * after a reset) and reinitialize it. */
+int reconnect_camera (GPParams *p);
+
+/*
+ * Returns 1 if result is an I/O error, --reconnect is enabled, fewer
+ * than p->reconnect_tries attempts were made for this operation and
+ * the camera was successfully reconnected. The caller should then
+ * retry the failed operation. Reset *attempt when an operation succeeds.
+ */
+int reconnect_retry (GPParams *p, int result, int *attempt);
+
+#endif /* !defined(GPHOTO2_RECONNECT_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,379 @@
+/* schema.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "gp-params.h"
+#include "schema.h"
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <gphoto2/gphoto2-port-log.h>
+#include <gphoto2/gphoto2-port-portability.h>
+#include <gphoto2/gphoto2-version.h>
+
+#define CR(result) {int r = (result); if (r < 0) return (r);}
+
+/* First line of a cache file, bump when the format changes. */
+#define SCHEMA_MAGIC "gphoto2-config-schema 2"
+
+typedef struct {
+	char		*path;
+	char		*label;
+	const char	*name;	/* last part of path */
+	CameraWidgetType type;
+} SchemaEntry;
+
+struct _GPSchema {
+	char		*filename;	/* NULL if there is no cache directory */
+	char		*firmware;	/* "deviceversion" of the tree seen last */
+	int		loaded;		/* entries are valid */
+	int		count, size;
+	SchemaEntry	*entry;
+};
+
+static void
+schema_clear (GPSchema *s)
+{
+	int i;
+
+	for (i = 0; i < s->count; i++) {
+		free (s->entry[i].path);
+		free (s->entry[i].label);
+	}
+	free (s->entry);
+	free (s->firmware);
+	s->entry = NULL;
+	s->firmware = NULL;
+	s->count = s->size = 0;
+	s->loaded = 0;
+}
+
+static int
+schema_add (GPSchema *s, const char *path, const char *label,
+	    CameraWidgetType type)
+{
+	SchemaEntry *e;
+
+	if (s->count == s->size) {
+		int size = s->size ? 2 * s->size : 256;
+
+		e = realloc (s->entry, size * sizeof (SchemaEntry));
+		if (!e)
+			return GP_ERROR_NO_MEMORY;
+		s->entry = e;
+		s->size = size;
+	}
+	e = &s->entry[s->count];
+	e->path = strdup (path);
+	e->label = strdup (label);
+	if (!e->path || !e->label) {
+		free (e->path);
+		free (e->label);
+		return GP_ERROR_NO_MEMORY;
+	}
+	e->name = strrchr (e->path, '/') ? strrchr (e->path, '/') + 1 : e->path;
+	e->type = type;
+	s->count++;
+	return GP_OK;
+}
+
+/* Replace anything that could upset a file system with '_'. */
+static void
+schema_sanitize (char *s)
+{
+	for (; *s; s++)
+		if (!isalnum ((unsigned char) *s) && (*s != '.') && (*s != '-'))
+			*s = '_';
+}
+
+/*
+ * The cache file is named after model, driver and library version, so a
+ * libgphoto2 update starts a fresh cache. Asking for the firmware here
+ * could cost a whole tree fetch, it is kept in the file instead.
+ */
+static char *
+schema_filename (GPParams *p)
+{
+	CameraAbilities	a;
+	const char	*dir, *sub;
+	char		*filename;
+	char		key[sizeof (a.model) + sizeof (a.id) + 64];
+
+	if (gp_camera_get_abilities (p->camera, &a) != GP_OK)
+		return NULL;
+	snprintf (key, sizeof (key), "%s-%s-%s", a.model, a.id,
+		  gp_library_version (GP_VERSION_SHORT)[0]);
+	schema_sanitize (key);
+
+	dir = getenv ("XDG_CACHE_HOME");
+	sub = "gphoto2";
+	if (!dir || !*dir) {
+		dir = getenv ("HOME");
+		sub = ".cache/gphoto2";
+	}
+	if (!dir || !*dir)
+		return NULL;
+
+	filename = malloc (strlen (dir) + 1 + strlen (sub) + 1 + strlen (key) + 1);
+	if (!filename)
+		return NULL;
+	sprintf (filename, "%s/%s/%s", dir, sub, key);
+	return filename;
+}
+
+static int
+schema_init (GPParams *p)
+{
+	if (p->schema)
+		return GP_OK;
+	p->schema = calloc (1, sizeof (GPSchema));
+	if (!p->schema)
+		return GP_ERROR_NO_MEMORY;
+	p->schema->filename = schema_filename (p);
+	return GP_OK;
+}
+
+int
+schema_load (GPParams *p)
+{
+	GPSchema	*s;
+	FILE		*f;
+	char		buf[4096], *path, *label, *end;
+	int		type, ret = GP_OK;
+
+	if (p->schema)
+		return p->schema->loaded ? GP_OK : GP_ERROR;
+	CR (schema_init (p));
+	s = p->schema;
+	if (!s->filename)
+		return GP_ERROR;
+	f = fopen (s->filename, "r");
+	if (!f)
+		return GP_ERROR;
+
+	if (!fgets (buf, sizeof (buf), f) || strcmp (buf, SCHEMA_MAGIC "\n"))
+		ret = GP_ERROR_CORRUPTED_DATA;
+	/* firmware <TAB> version */
+	if ((ret == GP_OK) && (!fgets (buf, sizeof (buf), f) ||
+			       strncmp (buf, "firmware\t", 9) ||
+			       !(end = strchr (buf, '\n'))))
+		ret = GP_ERROR_CORRUPTED_DATA;
+	if (ret == GP_OK) {
+		*end = '\0';
+		s->firmware = strdup (buf + 9);
+		if (!s->firmware)
+			ret = GP_ERROR_NO_MEMORY;
+	}
+	/* type <TAB> path <TAB> label */
+	while ((ret == GP_OK) && fgets (buf, sizeof (buf), f)) {
+		type = strtol (buf, &path, 10);
+		if (*path++ != '\t') {
+			ret = GP_ERROR_CORRUPTED_DATA;
+			break;
+		}
+		label = strchr (path, '\t');
+		end = strchr (path, '\n');
+		if (!label || !end) {
+			ret = GP_ERROR_CORRUPTED_DATA;
+			break;
+		}
+		*label++ = '\0';
+		*end = '\0';
+		ret = schema_add (s, path, label, type);
+	}
+	fclose (f);
+	if (ret != GP_OK) {
+		gp_log (GP_LOG_DEBUG, "schema", "Ignoring '%s': %s",
+			s->filename, gp_result_as_string (ret));
+		schema_clear (s);
+		return ret;
+	}
+	gp_log (GP_LOG_DEBUG, "schema", "Loaded %d entries from '%s'.",
+		s->count, s->filename);
+	s->loaded = 1;
+	return GP_OK;
+}
+
+static int
+schema_collect (GPSchema *s, CameraWidget *widget, const char *prefix)
+{
+	const char	*name, *label;
+	char		*newprefix;
+	CameraWidgetType type;
+	CameraWidget	*child;
+	int		i, n, ret = GP_OK;
+
+	gp_widget_get_name (widget, &name);
+	gp_widget_get_label (widget, &label);
+	gp_widget_get_type (widget, &type);
+
+	/* Same path as display_widgets() prints. */
+	newprefix = malloc (strlen (prefix) + 1 + strlen (strlen (name) ? name : label) + 1);
+	if (!newprefix)
+		return GP_ERROR_NO_MEMORY;
+	sprintf (newprefix, "%s/%s", prefix, strlen (name) ? name : label);
+
+	if ((type != GP_WIDGET_WINDOW) && (type != GP_WIDGET_SECTION))
+		ret = schema_add (s, newprefix, label, type);
+
+	n = gp_widget_count_children (widget);
+	for (i = 0; (i < n) && (ret == GP_OK); i++)
+		if (gp_widget_get_child (widget, i, &child) == GP_OK)
+			ret = schema_collect (s, child, newprefix);
+	free (newprefix);
+	return ret;
+}
+
+static void
+schema_write (GPSchema *s)
+{
+	char	*tmpname, *delim;
+	FILE	*f;
+	int	i;
+
+	tmpname = malloc (strlen (s->filename) + 5);
+	if (!tmpname)
+		return;
+	/* Create the cache directory, and its parent for ~/.cache. */
+	strcpy (tmpname, s->filename);
+	delim = strrchr (tmpname, gp_system_dir_delim);
+	*delim = '\0';
+	if (!gp_system_is_dir (tmpname)) {
+		char *parent = strrchr (tmpname, gp_system_dir_delim);
+
+		*parent = '\0';
+		if (!gp_system_is_dir (tmpname))
+			gp_system_mkdir (tmpname);
+		*parent = gp_system_dir_delim;
+		gp_system_mkdir (tmpname);
+	}
+
+	/* Write a new file and rename it, readers never see half of it. */
+	sprintf (tmpname, "%s.tmp", s->filename);
+	f = fopen (tmpname, "w");
+	if (!f) {
+		gp_log (GP_LOG_DEBUG, "schema", "Cannot write '%s'.", tmpname);
+		free (tmpname);
+		return;
+	}
+	fprintf (f, "%s\n", SCHEMA_MAGIC);
+	fprintf (f, "firmware\t%s\n", s->firmware);
+	for (i = 0; i < s->count; i++)
+		fprintf (f, "%d\t%s\t%s\n", s->entry[i].type,
+			 s->entry[i].path, s->entry[i].label);
+	if (ferror (f) | fclose (f) || rename (tmpname, s->filename))
+		unlink (tmpname);
+	free (tmpname);
+}
+
+int
+schema_update (GPParams *p, CameraWidget *rootconfig)
+{
+	CameraWidget *widget;
+	GPSchema *s;
+	char *fw = NULL;
+	int ret;
+
+	CR (schema_init (p));
+	s = p->schema;
+	if ((gp_widget_get_child_by_name (rootconfig, "deviceversion", &widget) != GP_OK) ||
+	    (gp_widget_get_value (widget, &fw) != GP_OK) || !fw)
+		fw = "";
+	/* The same firmware has the same layout. */
+	if (s->loaded && !strcmp (s->firmware, fw))
+		return GP_OK;
+	schema_clear (s);
+	s->firmware = strdup (fw);
+	if (!s->firmware)
+		return GP_ERROR_NO_MEMORY;
+	ret = schema_collect (s, rootconfig, "");
+	if (ret != GP_OK) {
+		schema_clear (s);
+		return ret;
+	}
+	s->loaded = 1;
+	if (s->filename)
+		schema_write (s);
+	return GP_OK;
+}
+
+void
+schema_free (GPParams *p)
+{
+	if (!p->schema)
+		return;
+	schema_clear (p->schema);
+	free (p->schema->filename);
+	free (p->schema);
+	p->schema = NULL;
+}
+
+int
+schema_list (GPParams *p)
+{
+	int i;
+
+	if (!p->schema || !p->schema->loaded)
+		return GP_ERROR;
+	for (i = 0; i < p->schema->count; i++)
+		printf ("%s\n", p->schema->entry[i].path);
+	return GP_OK;
+}
+
+int
+schema_lookup (GPParams *p, const char *name, const char **realname,
+	       CameraWidgetType *type)
+{
+	GPSchema	*s = p->schema;
+	SchemaEntry	*e = NULL;
+	const char	*path = name;
+	int		i;
+
+	if (!s || !s->loaded)
+		return GP_ERROR;
+	while (*path == '/')
+		path++;
+	for (i = 0; !e && (i < s->count); i++)
+		if (!strcmp (s->entry[i].name, name))
+			e = &s->entry[i];
+	for (i = 0; !e && (i < s->count); i++)
+		if (!strcmp (s->entry[i].label, name))
+			e = &s->entry[i];
+	for (i = 0; !e && (i < s->count); i++)
+		if (!strcmp (s->entry[i].path + 1, path))
+			e = &s->entry[i];
+	if (!e)
+		return GP_ERROR;
+	if (realname)
+		*realname = e->name;
+	if (type)
+		*type = e->type;
+	return GP_OK;
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,55 @@
+/* schema.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_SCHEMA_H
+#define GPHOTO2_SCHEMA_H
+
+#include <gp-params.h>
+
+/*
+ * The layout of the configuration tree (paths, labels, types) does not
+ * change for a given model, firmware and driver. It is kept on disk in
+ * the user's cache directory, so that it can be used without fetching
+ * the whole tree from the camera. New firmware is noticed, and the
+ * layout replaced, the next time the tree is fetched.
+ */
+
+/* Load the cached layout for the current camera, if there is one. */
+int  schema_load   (GPParams *p);
+/* Remember the layout of rootconfig, in memory and on disk, unless it
+ * is already known for this firmware. */
+int  schema_update (GPParams *p, CameraWidget *rootconfig);
+void schema_free   (GPParams *p);
+
+/* Print the paths of all entries, like --list-config does. */
+int  schema_list   (GPParams *p);
+
+/* Look up an entry by name, label or path. Returns its name and type,
+ * or GP_ERROR if it is not in the layout. */
+int  schema_lookup (GPParams *p, const char *name, const char **realname,
+		    CameraWidgetType *type);
+
+#endif /* !defined(GPHOTO2_SCHEMA_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,342 @@
+/* serve.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "globals.h"
+#include "gp-params.h"
+#include "i18n.h"
+#include "main.h"
+#include "preview.h"
+#include "serve.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined (HAVE_PTHREAD) && defined (HAVE_SYS_SOCKET_H)
+# include <netdb.h>
+# include <pthread.h>
+# include <signal.h>
+# include <unistd.h>
+# include <sys/select.h>
+# include <sys/socket.h>
+# include <sys/uio.h>
+#endif
+
+#include <gphoto2/gphoto2-port-log.h>
+
+#if defined (HAVE_PTHREAD) && defined (HAVE_SYS_SOCKET_H)
+
+#define SERVE_MAX_CLIENTS 32
+#define SERVE_BOUNDARY "gphoto2frame"
+
+typedef struct _Server Server;
+
+typedef struct {
+	Server		*server;
+	int		fd;	/* -1 if the slot is free */
+} Client;
+
+struct _Server {
+	PreviewSource	*source;
+	pthread_mutex_t	lock;
+	pthread_cond_t	done;	/* a client went away */
+	Client		client[SERVE_MAX_CLIENTS];
+	int		clients;
+	unsigned int	served;
+};
+
+/* Write all of iov, picking up after short writes. */
+static int
+serve_writev (int fd, struct iovec *iov, int n)
+{
+	ssize_t written;
+
+	while (n) {
+		written = writev (fd, iov, n);
+		if (written < 0) {
+			if (errno == EINTR)
+				continue;
+			return -1;
+		}
+		while (n && ((size_t) written >= iov->iov_len)) {
+			written -= iov->iov_len;
+			iov++;
+			n--;
+		}
+		if (n) {
+			iov->iov_base = (char *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return 0;
+}
+
+static int
+serve_write (int fd, const char *s)
+{
+	struct iovec iov;
+
+	iov.iov_base = (char *) s;
+	iov.iov_len = strlen (s);
+	return serve_writev (fd, &iov, 1);
+}
+
+/* Read the request head, we serve the same stream for every path. */
+static int
+serve_read_request (int fd)
+{
+	char	buf[4096];
+	size_t	len = 0;
+	ssize_t	r;
+
+	while (len < sizeof (buf) - 1) {
+		r = read (fd, buf + len, sizeof (buf) - 1 - len);
+		if (r <= 0)
+			return -1;
+		len += r;
+		buf[len] = '\0';
+		if (strstr (buf, "\r\n\r\n") || strstr (buf, "\n\n"))
+			return strncmp (buf, "GET ", 4) ? -1 : 0;
+	}
+	return -1;
+}
+
+static void *
+serve_client (void *data)
+{
+	Client		*c = data;
+	Server		*s = c->server;
+	PreviewFrame	*frame;
+	unsigned long	seq = 0;
+	struct iovec	iov[3];
+	char		head[128];
+
+	if (serve_read_request (c->fd)) {
+		serve_write (c->fd, "HTTP/1.0 400 Bad Request\r\n\r\n");
+		goto out;
+	}
+	if (serve_write (c->fd, "HTTP/1.0 200 OK\r\n"
+			 "Content-Type: multipart/x-mixed-replace; boundary=" SERVE_BOUNDARY "\r\n"
+			 "Cache-Control: no-cache\r\n"
+			 "Connection: close\r\n\r\n"))
+		goto out;
+
+	/* Whatever is newest when we are ready, frames in between are skipped. */
+	while ((frame = preview_source_next (s->source, seq))) {
+		seq = frame->seq;
+		snprintf (head, sizeof (head), "--" SERVE_BOUNDARY "\r\n"
+			  "Content-Type: image/jpeg\r\n"
+			  "Content-Length: %lu\r\n\r\n", frame->size);
+		iov[0].iov_base = head;
+		iov[0].iov_len = strlen (head);
+		iov[1].iov_base = (char *) frame->data;
+		iov[1].iov_len = frame->size;
+		iov[2].iov_base = "\r\n";
+		iov[2].iov_len = 2;
+		if (serve_writev (c->fd, iov, 3)) {
+			preview_frame_unref (s->source, frame);
+			break;
+		}
+		preview_frame_unref (s->source, frame);
+	}
+out:
+	pthread_mutex_lock (&s->lock);
+	close (c->fd);
+	c->fd = -1;
+	s->clients--;
+	pthread_cond_signal (&s->done);
+	pthread_mutex_unlock (&s->lock);
+	return NULL;
+}
+
+static void
+serve_accept (Server *s, int listenfd)
+{
+	pthread_attr_t	attr;
+	pthread_t	thread;
+	Client		*c = NULL;
+	int		fd, i;
+
+	fd = accept (listenfd, NULL, NULL);
+	if (fd < 0)
+		return;
+
+	pthread_mutex_lock (&s->lock);
+	for (i = 0; !c && (i < SERVE_MAX_CLIENTS); i++)
+		if (s->client[i].fd < 0)
+			c = &s->client[i];
+	if (c) {
+		c->fd = fd;
+		s->clients++;
+		s->served++;
+	}
+	pthread_mutex_unlock (&s->lock);
+	if (!c) {
+		serve_write (fd, "HTTP/1.0 503 Service Unavailable\r\n\r\n");
+		close (fd);
+		return;
+	}
+
+	pthread_attr_init (&attr);
+	pthread_attr_setdetachstate (&attr, PTHREAD_CREATE_DETACHED);
+	if (pthread_create (&thread, &attr, serve_client, c)) {
+		pthread_mutex_lock (&s->lock);
+		close (fd);
+		c->fd = -1;
+		s->clients--;
+		pthread_mutex_unlock (&s->lock);
+	}
+	pthread_attr_destroy (&attr);
+}
+
+static int
+serve_listen (const char *address)
+{
+	struct addrinfo	hints, *res, *ai;
+	char		*buf, *host = "localhost", *port;
+	int		fd = -1, on = 1, r;
+
+	buf = strdup (address);
+	if (!buf)
+		return -1;
+	port = strrchr (buf, ':');
+	if (port) {
+		*port++ = '\0';
+		host = buf;
+		/* [::1]:8080 */
+		if ((host[0] == '[') && (host[strlen (host) - 1] == ']')) {
+			host[strlen (host) - 1] = '\0';
+			host++;
+		}
+	} else
+		port = buf;
+
+	memset (&hints, 0, sizeof (hints));
+	hints.ai_family = AF_UNSPEC;
+	hints.ai_socktype = SOCK_STREAM;
+	r = getaddrinfo (host, port, &hints, &res);
+	if (r) {
+		cli_error_print (_("Could not resolve '%s': %s"), address, gai_strerror (r));
+		free (buf);
+		return -1;
+	}
+	for (ai = res; ai && (fd < 0); ai = ai->ai_next) {
+		fd = socket (ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+		if (fd < 0)
+			continue;
+		setsockopt (fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof (on));
+		if (bind (fd, ai->ai_addr, ai->ai_addrlen) || listen (fd, 8)) {
+			close (fd);
+			fd = -1;
+		}
+	}
+	freeaddrinfo (res);
+	if (fd < 0)
+		cli_error_print (_("Could not listen on '%s': %s"), address, strerror (errno));
+	free (buf);
+	return fd;
+}
+
+int
+serve_preview (GPParams *p, const char *address)
+{
+	Server		s;
+	struct timeval	tv;
+	fd_set		fds;
+	void		(*oldpipe) (int);
+	int		fd, i, r;
+
+	fd = serve_listen (address);
+	if (fd < 0)
+		return GP_ERROR_OS_FAILURE;
+
+	memset (&s, 0, sizeof (s));
+	for (i = 0; i < SERVE_MAX_CLIENTS; i++) {
+		s.client[i].server = &s;
+		s.client[i].fd = -1;
+	}
+	pthread_mutex_init (&s.lock, NULL);
+	pthread_cond_init (&s.done, NULL);
+	r = preview_source_start (p, &s.source);
+	if (r != GP_OK) {
+		pthread_cond_destroy (&s.done);
+		pthread_mutex_destroy (&s.lock);
+		close (fd);
+		return r;
+	}
+
+	/* A viewer closing its window must not take us down. */
+	oldpipe = signal (SIGPIPE, SIG_IGN);
+	end_next = 0;
+	fprintf (stderr, _("Serving live view on '%s'. Press Ctrl-C to stop.\n"), address);
+
+	while (!glob_cancel && !end_next && preview_source_running (s.source)) {
+		FD_ZERO (&fds);
+		FD_SET (fd, &fds);
+		tv.tv_sec = 0;
+		tv.tv_usec = 250000;
+		if (select (fd + 1, &fds, NULL, NULL, &tv) > 0)
+			serve_accept (&s, fd);
+	}
+	if (end_next) {
+		fprintf (stderr, _("SIGUSR2 signal received, stopping live view!\n"));
+		end_next = 0;
+	}
+	close (fd);
+
+	/* Wake up clients waiting for a frame, unblock those stuck in write. */
+	r = preview_source_halt (s.source);
+	pthread_mutex_lock (&s.lock);
+	for (i = 0; i < SERVE_MAX_CLIENTS; i++)
+		if (s.client[i].fd >= 0)
+			shutdown (s.client[i].fd, SHUT_RDWR);
+	while (s.clients)
+		pthread_cond_wait (&s.done, &s.lock);
+	pthread_mutex_unlock (&s.lock);
+
+	fprintf (stderr, _("Live view finished (%lu frames, %u clients).\n"),
+		 preview_source_frames (s.source), s.served);
+	preview_source_free (s.source);
+	pthread_cond_destroy (&s.done);
+	pthread_mutex_destroy (&s.lock);
+	signal (SIGPIPE, oldpipe);
+	if (r != GP_OK)
+		cli_error_print (_("Movie capture error... Exiting."));
+	return r;
+}
+
+#else /* !HAVE_PTHREAD || !HAVE_SYS_SOCKET_H */
+
+int
+serve_preview (GPParams *p, const char *address)
+{
+	cli_error_print (_("gphoto2 was built without pthread or socket support."));
+	return GP_ERROR_NOT_SUPPORTED;
+}
+
+#endif
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
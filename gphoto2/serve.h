@@ -0,0 +1,39 @@
+/* serve.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_SERVE_H
+#define GPHOTO2_SERVE_H
+
+#include <gp-params.h>
+
+/*
+ * --serve-preview [HOST:]PORT: stream the live view as MJPEG over HTTP
+ * to any number of clients. HOST defaults to localhost. Runs until
+ * Ctrl-C, SIGUSR2 or a capture error.
+ */
+int serve_preview (GPParams *p, const char *address);
+
+#endif /* !defined(GPHOTO2_SERVE_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
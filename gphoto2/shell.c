@@ -25,6 +25,7 @@
 #include "globals.h"
 #include "i18n.h"
 #include "main.h"
+#include "metrics.h"
 #include "shell.h"
 
 #include <ctype.h>
@@ -177,6 +178,48 @@ static const struct _ShellFunctionTable {
 #define SHELL_PROMPT "gphoto2: {%s} %s> "
 static int 	shell_done		= 0;
 
+/*
+ * Folder listings for tab completion. Readline calls the generator once
+ * per match, so every folder is listed once per session and kept until
+ * a command may have changed it.
+ */
+typedef struct _ShellListing ShellListing;
+struct _ShellListing {
+	char		*folder;
+	CameraList	*files, *folders;
+	ShellListing	*next;
+};
+static ShellListing	*listings	= NULL;
+
+static void
+shell_listing_free (ShellListing *l)
+{
+	if (l->files)
+		gp_list_free (l->files);
+	if (l->folders)
+		gp_list_free (l->folders);
+	free (l->folder);
+	free (l);
+}
+
+/* Drops the listing of folder and those below it, all of them for NULL. */
+static void
+shell_listing_forget (const char *folder)
+{
+	ShellListing **prev = &listings, *l;
+	size_t len = folder ? strlen (folder) : 0;
+
+	while ((l = *prev)) {
+		if (!folder || !strcmp (l->folder, folder) ||
+		    (!strncmp (l->folder, folder, len) &&
+		     ((l->folder[len] == '/') || !strcmp (folder, "/")))) {
+			*prev = l->next;
+			shell_listing_free (l);
+		} else
+			prev = &l->next;
+	}
+}
+
 static unsigned int
 shell_arg_count (const char *args)
 {
@@ -272,6 +315,43 @@ shell_arg (const char *args, unsigned int arg_num, char *arg)
 
 #ifdef HAVE_RL
 
+static int
+shell_listing_get (const char *folder, ShellListing **listing)
+{
+	ShellListing *l;
+	int r;
+
+	for (l = listings; l; l = l->next)
+		if (!strcmp (l->folder, folder)) {
+			*listing = l;
+			return (GP_OK);
+		}
+
+	l = calloc (1, sizeof (ShellListing));
+	if (!l)
+		return (GP_ERROR_NO_MEMORY);
+	l->folder = strdup (folder);
+	r = l->folder ? GP_OK : GP_ERROR_NO_MEMORY;
+	if (r == GP_OK)
+		r = gp_list_new (&l->files);
+	if (r == GP_OK)
+		r = gp_list_new (&l->folders);
+	if (r == GP_OK)
+		r = metered_camera_folder_list_files (p->camera, folder,
+						      l->files, p->context);
+	if (r == GP_OK)
+		r = metered_camera_folder_list_folders (p->camera, folder,
+							l->folders, p->context);
+	if (r < 0) {
+		shell_listing_free (l);
+		return (r);
+	}
+	l->next = listings;
+	listings = l;
+	*listing = l;
+	return (GP_OK);
+}
+
 static char *
 shell_command_generator (const char *text, int state)
 {
@@ -298,7 +378,7 @@ shell_path_generator (const char *text, int state)
 {
 	static int x;
 	const char *slash, *name;
-	CameraList *list;
+	ShellListing *listing;
 	int file_count, folder_count, r, len;
 	char folder[MAX_FOLDER_LEN], basename[MAX_FILE_LEN], *path;
 
@@ -319,23 +399,16 @@ shell_path_generator (const char *text, int state)
 	if (!state)
 		x = 0;
 
-	r = gp_list_new (&list);
+	r = shell_listing_get (folder, &listing);
 	if (r < 0)
 		return (NULL);
 	/* First search for matching file */
-	r = gp_camera_folder_list_files (p->camera, folder, list, p->context);
-	if (r < 0) {
-		gp_list_free (list);
+	file_count = gp_list_count (listing->files);
+	if (file_count < 0)
 		return (NULL);
-	}
-	file_count = gp_list_count (list);
-	if (file_count < 0) {
-		gp_list_free (list);
-		return (NULL);
-	}
 	if (x < file_count) {
 		for (; x < file_count; x++) {
-			r = gp_list_get_name (list, x, &name);
+			r = gp_list_get_name (listing->files, x, &name);
 			if (r < 0)
 				return (NULL);
 			if (!strncmp (name, basename, len)) {
@@ -363,24 +436,15 @@ shell_path_generator (const char *text, int state)
 	}
 
 	/* Ok, we listed all matching files. Now, list matching folders. */
-	r = gp_camera_folder_list_folders (p->camera, folder, list,
-					   p->context);
-	if (r < 0) {
-		gp_list_free (list);
-		return (NULL);
-	}
-	folder_count = gp_list_count (list);
-	if (folder_count < 0) {
-		gp_list_free (list);
+	folder_count = gp_list_count (listing->folders);
+	if (folder_count < 0)
 		return (NULL);
-	}
 	if (x - file_count < folder_count) {
 		for (; x - file_count < folder_count; x++) {
-			r = gp_list_get_name (list, x - file_count, &name);
-			if (r < 0) {
-				gp_list_free (list);
+			r = gp_list_get_name (listing->folders, x - file_count,
+					      &name);
+			if (r < 0)
 				return (NULL);
-			}
 			if (!strncmp (name, basename, len)) {
 				x++;
 				slash = strrchr (text, '/');
@@ -400,15 +464,11 @@ shell_path_generator (const char *text, int state)
 					strcat (path, name);
 					strcat (path, "/");
 				}
-				gp_list_free (list);
 				return (path);
 			}
 		}
-		gp_list_free (list);
-		return (NULL);
 	}
 
-	gp_list_free (list);
 	return (NULL);
 }
 
@@ -510,6 +570,7 @@ shell_prompt (GPParams *params)
 		CHECK_CONT (func[x].function (p->camera, arg));
 	}
 
+	shell_listing_forget (NULL);
 	return (GP_OK);
 }
 
@@ -641,8 +702,8 @@ shell_cd (Camera __unused__ *camera, const char *arg)
 
 	CHECK (gp_list_new (&list));
 
-	CL (gp_camera_folder_list_folders (p->camera, folder, list,
-					      p->context), list);
+	CL (metered_camera_folder_list_folders (p->camera, folder, list,
+						   p->context), list);
 	gp_list_free (list);
 	free (p->folder);
 	p->folder = malloc (sizeof (char) * (strlen (folder) + 1));
@@ -669,9 +730,12 @@ shell_ls (Camera __unused__ *camera, const char *arg)
 		strcpy (folder, p->folder);
 	}
 
+	/* Whatever changed on the camera, complete what ls shows. */
+	shell_listing_forget (folder);
+
 	CHECK (gp_list_new (&list));
-	CL (gp_camera_folder_list_folders (p->camera, folder, list,
-					      p->context), list);
+	CL (metered_camera_folder_list_folders (p->camera, folder, list,
+						   p->context), list);
 
 	if (p->flags & FLAGS_QUIET)
 		printf ("%i\n", gp_list_count (list));
@@ -688,8 +752,8 @@ shell_ls (Camera __unused__ *camera, const char *arg)
 		}
 	}
 
-	CL (gp_camera_folder_list_files (p->camera, folder, list,
-					    p->context), list);
+	CL (metered_camera_folder_list_files (p->camera, folder, list,
+						 p->context), list);
 
 	if (p->flags & FLAGS_QUIET)
 		printf("%i\n", gp_list_count(list));
@@ -763,8 +827,8 @@ shell_mget (Camera __unused__ *camera, const char *arg)
 
 	/* Get file list of current directory */
 	CHECK (gp_list_new (&list));
-	CL (gp_camera_folder_list_files (p->camera, folder, list,
-					    p->context), list);
+	CL (metered_camera_folder_list_files (p->camera, folder, list,
+						 p->context), list);
 
 	/* Get all matching files */
 	for (x = 1; x <= gp_list_count (list); x++) {
@@ -807,6 +871,8 @@ shell_get_exif (Camera __unused__ *camera, const char *arg)
 static int
 shell_del (Camera __unused__ *camera, const char *arg)
 {
+	/* The files may be in any folder. */
+	shell_listing_forget (NULL);
 	CHECK (shell_file_action (p->camera, p->context, p->folder, arg,
 				  delete_file_action));
 
@@ -842,6 +908,7 @@ shell_put (Camera __unused__ *camera, const char *args) {
 	for (x = 0; x < shell_arg_count (args); x++) {
 		CHECK (shell_arg (args, x, arg));
 		CHECK (shell_construct_path ("/", arg, dest_folder, dest_filename));
+		shell_listing_forget (dest_folder);
 		CHECK (action_camera_upload_file (p, dest_folder, dest_filename));
 	}
 
@@ -852,6 +919,7 @@ static int
 shell_mkdir (Camera *camera, const char *args) {
 	if (*args == ' ')
 		args++;
+	shell_listing_forget (p->folder);
 	return gp_camera_folder_make_dir (camera, p->folder, args, p->context);
 }
 
@@ -872,6 +940,7 @@ shell_rmdir (Camera *camera, const char *args) {
 		xarg[xlen-1] = '\0';
 		xlen--;
 	}
+	shell_listing_forget (p->folder);
 	ret = gp_camera_folder_remove_dir (camera, p->folder, xarg, p->context);
 	free (xarg);
 	return ret;
@@ -973,16 +1042,20 @@ shell_set_config_index (Camera __unused__ *camera, const char *args) {
 
 static int
 shell_trigger_capture (Camera __unused__ *camera, const char __unused__ *args) {
+	/* The new files may be in any folder, even in new ones. */
+	shell_listing_forget (NULL);
 	return trigger_capture ();
 }
 
 static int
 shell_capture_image (Camera __unused__ *camera, const char __unused__ *args) {
+	shell_listing_forget (NULL);
 	return capture_generic (GP_CAPTURE_IMAGE, NULL, 0);
 }
 
 static int
 shell_capture_image_and_download (Camera __unused__ *camera, const char __unused__ *args) {
+	shell_listing_forget (NULL);
 	return capture_generic (GP_CAPTURE_IMAGE, NULL, 1);
 }
 
@@ -997,6 +1070,7 @@ shell_wait_event (Camera *camera, const char *args) {
 	char argument[1024];
 
 	shell_arg (args, 0, argument);
+	shell_listing_forget (NULL);
 	return action_camera_wait_event (p, DT_NO_DOWNLOAD, argument);
 }
 
@@ -1005,6 +1079,7 @@ shell_capture_tethered (Camera *camera, const char *args) {
 	char argument[1024];
 
 	shell_arg (args, 0, argument);
+	shell_listing_forget (NULL);
 	return action_camera_wait_event (p, DT_DOWNLOAD, argument);
 }
 
@@ -0,0 +1,178 @@
+/* shmring.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "globals.h"
+#include "gp-params.h"
+#include "i18n.h"
+#include "main.h"
+#include "preview.h"
+#include "shmring.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef HAVE_SHM_OPEN
+# include <fcntl.h>
+# include <limits.h>
+# include <unistd.h>
+# include <sys/mman.h>
+# ifdef __linux__
+#  include <linux/futex.h>
+#  include <sys/syscall.h>
+# endif
+#endif
+
+#ifdef HAVE_SHM_OPEN
+
+/* Preview JPEGs are well below a megabyte; slots are only backed by
+ * memory once a frame that big was written. */
+#define SHM_RING_SLOTS		8
+#define SHM_RING_SLOT_SIZE	(4 * 1024 * 1024)
+
+#define SHM_RING_STRIDE	(sizeof (ShmRingSlot) + SHM_RING_SLOT_SIZE)
+
+static void
+shm_ring_wake (ShmRingHeader *h)
+{
+#ifdef __linux__
+	syscall (SYS_futex, &h->futex, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+#endif
+}
+
+static void
+shm_ring_put (ShmRingHeader *h, PreviewFrame *frame, uint64_t seq)
+{
+	ShmRingSlot *slot;
+
+	slot = (ShmRingSlot *) ((char *) (h + 1) +
+				((seq - 1) % h->slots) * SHM_RING_STRIDE);
+	slot->seq = 0;
+	__sync_synchronize ();
+	slot->sec = frame->time.tv_sec;
+	slot->usec = frame->time.tv_usec;
+	slot->size = frame->size;
+	memcpy (slot + 1, frame->data, frame->size);
+	__sync_synchronize ();
+	slot->seq = seq;
+	h->seq = seq;
+	h->futex = (uint32_t) seq;
+	__sync_synchronize ();
+	shm_ring_wake (h);
+}
+
+int
+shm_ring_publish (GPParams *p, const char *name)
+{
+	PreviewSource	*source;
+	PreviewFrame	*frame;
+	ShmRingHeader	*h;
+	char		*shmname;
+	size_t		size;
+	unsigned long	seq = 0, published = 0, dropped = 0;
+	int		fd, r;
+
+	shmname = malloc (strlen (name) + 2);
+	if (!shmname)
+		return GP_ERROR_NO_MEMORY;
+	sprintf (shmname, "/%s", name);
+
+	size = sizeof (ShmRingHeader) + SHM_RING_SLOTS * SHM_RING_STRIDE;
+	fd = shm_open (shmname, O_RDWR | O_CREAT | O_TRUNC, 0644);
+	if ((fd < 0) || ftruncate (fd, size)) {
+		cli_error_print (_("Could not create shared memory '%s': %s"),
+				 shmname, strerror (errno));
+		if (fd >= 0) {
+			close (fd);
+			shm_unlink (shmname);
+		}
+		free (shmname);
+		return GP_ERROR_OS_FAILURE;
+	}
+	h = mmap (NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close (fd);
+	if (h == MAP_FAILED) {
+		cli_error_print (_("Could not create shared memory '%s': %s"),
+				 shmname, strerror (errno));
+		shm_unlink (shmname);
+		free (shmname);
+		return GP_ERROR_OS_FAILURE;
+	}
+	h->slots = SHM_RING_SLOTS;
+	h->slot_size = SHM_RING_SLOT_SIZE;
+	h->version = SHM_RING_VERSION;
+	__sync_synchronize ();
+	h->magic = SHM_RING_MAGIC;
+
+	r = preview_source_start (p, &source);
+	if (r == GP_OK) {
+		end_next = 0;
+		fprintf (stderr, _("Publishing preview frames to '%s'. Press Ctrl-C to stop.\n"),
+			 shmname);
+		while ((frame = preview_source_next (source, seq))) {
+			dropped += frame->seq - seq - 1;
+			seq = frame->seq;
+			if (frame->size <= SHM_RING_SLOT_SIZE)
+				shm_ring_put (h, frame, ++published);
+			else
+				dropped++;
+			preview_frame_unref (source, frame);
+		}
+		r = preview_source_halt (source);
+		preview_source_free (source);
+		if (end_next) {
+			fprintf (stderr, _("SIGUSR2 signal received, stopping!\n"));
+			end_next = 0;
+		}
+		fprintf (stderr, _("Published %lu frames, dropped %lu.\n"),
+			 published, dropped);
+		if (r != GP_OK)
+			cli_error_print (_("Movie capture error... Exiting."));
+	}
+
+	/* Readers that have it mapped keep it, new ones will not find it. */
+	h->closed = 1;
+	h->futex++;
+	__sync_synchronize ();
+	shm_ring_wake (h);
+	munmap (h, size);
+	shm_unlink (shmname);
+	free (shmname);
+	return r;
+}
+
+#else /* !HAVE_SHM_OPEN */
+
+int
+shm_ring_publish (GPParams *p, const char *name)
+{
+	cli_error_print (_("gphoto2 was built without shared memory support."));
+	return GP_ERROR_NOT_SUPPORTED;
+}
+
+#endif
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
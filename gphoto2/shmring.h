@@ -0,0 +1,75 @@
+/* shmring.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_SHMRING_H
+#define GPHOTO2_SHMRING_H
+
+#include <stdint.h>
+
+#include <gp-params.h>
+
+/*
+ * Layout of the POSIX shared memory object written by
+ * --publish-preview NAME (shm_open ("/NAME")). Readers map it read-only:
+ *
+ *   ShmRingHeader, then slots times (ShmRingSlot + slot_size bytes).
+ *
+ * Frame n (counting from 1) goes to slot (n - 1) % slots. The writer
+ * never waits for readers: it sets the slot's seq to 0, writes the JPEG
+ * data, sets seq to n and then the header's seq to n. A reader takes
+ * header seq, copies or decodes the slot and uses the frame only if the
+ * slot's seq still is n afterwards; otherwise the writer lapped it and
+ * the frame is dropped for that reader. Gaps in seq are frames the reader
+ * missed.
+ *
+ * On Linux the low 32 bits of seq are also kept in futex; readers can
+ * FUTEX_WAIT on it (not FUTEX_PRIVATE_FLAG), the writer wakes all of
+ * them after each frame. closed is set when the writer went away.
+ */
+#define SHM_RING_MAGIC		0x52506770	/* "gpPR" */
+#define SHM_RING_VERSION	1
+
+typedef struct {
+	uint32_t		magic;
+	uint32_t		version;
+	uint32_t		slots;
+	uint32_t		slot_size;	/* JPEG bytes per slot */
+	volatile uint32_t	futex;
+	volatile uint32_t	closed;
+	volatile uint64_t	seq;		/* newest complete frame */
+} ShmRingHeader;
+
+typedef struct {
+	volatile uint64_t	seq;		/* 0 while being written */
+	uint64_t		sec, usec;	/* capture time */
+	uint32_t		size;
+	uint32_t		reserved;
+} ShmRingSlot;
+
+/* --publish-preview NAME: runs until Ctrl-C, SIGUSR2 or an error. */
+int shm_ring_publish (GPParams *p, const char *name);
+
+#endif /* !defined(GPHOTO2_SHMRING_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
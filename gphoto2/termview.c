@@ -0,0 +1,607 @@
+/* termview.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#include "config.h"
+#include "globals.h"
+#include "gp-params.h"
+#include "i18n.h"
+#include "main.h"
+#include "preview.h"
+#include "termview.h"
+
+#include <errno.h>
+#include <setjmp.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <termios.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/select.h>
+
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+
+#include <jpeglib.h>
+
+#include <gphoto2/gphoto2-port-log.h>
+
+#define CR(result) {int r = (result); if (r < 0) return (r);}
+
+#ifdef HAVE_PTHREAD
+# define TV_LOCK(tv)	pthread_mutex_lock (&(tv)->lock)
+# define TV_UNLOCK(tv)	pthread_mutex_unlock (&(tv)->lock)
+#else
+# define TV_LOCK(tv)
+# define TV_UNLOCK(tv)
+#endif
+
+typedef enum {
+	TERM_TRUECOLOR,
+	TERM_256,
+	TERM_ASCII,
+	TERM_MODES
+} TermMode;
+
+/* A frame scaled to the terminal, RGB, two pixel rows per text row. */
+typedef struct {
+	unsigned char	*rgb;
+	size_t		alloc;
+	int		width, height;
+	PreviewFrame	*frame;		/* what it shows, referenced */
+} TermImage;
+
+typedef struct {
+	GPParams	*p;
+	PreviewSource	*source;
+	TermMode	mode;
+
+	/*
+	 * The decoder fills back and swaps it with ready, the screen swaps
+	 * ready with front when fresh is set. Neither waits for the other,
+	 * a frame the screen had no time for is simply replaced.
+	 */
+	TermImage	image[3];
+	int		front, ready, back, fresh;
+	int		cols, rows;	/* image area the screen has */
+	unsigned long	decoded;
+
+#ifdef HAVE_PTHREAD
+	pthread_t	thread;
+	pthread_mutex_t	lock;
+	int		running;
+#endif
+
+	char		*out;
+	size_t		out_alloc, out_len;
+} TermView;
+
+struct termview_jpeg_error {
+	struct jpeg_error_mgr	pub;
+	jmp_buf			jmp;
+};
+
+static void
+termview_jpeg_exit (j_common_ptr cinfo)
+{
+	longjmp (((struct termview_jpeg_error *) cinfo->err)->jmp, 1);
+}
+
+static void
+termview_jpeg_message (j_common_ptr cinfo)
+{
+	/* Corrupt preview frames happen, don't scribble over the view. */
+}
+
+/* Plain loop over bytes, the compiler turns it into vector adds. */
+static void
+termview_accumulate (uint32_t *acc, const unsigned char *line, int n)
+{
+	int i;
+
+	for (i = 0; i < n; i++)
+		acc[i] += line[i];
+}
+
+/*
+ * Decode frame into img, at most cols x 2 * rows pixels with the aspect
+ * ratio kept. libjpeg scales by 1/2, 1/4 or 1/8 in the IDCT, which is
+ * where most of the time would go otherwise; a box filter does the rest.
+ */
+static int
+termview_scale (TermImage *img, PreviewFrame *frame, int cols, int rows)
+{
+	struct jpeg_decompress_struct	cinfo;
+	struct termview_jpeg_error	jerr;
+	uint32_t * volatile		acc = NULL;
+	unsigned char * volatile	line = NULL;
+	int * volatile			xs = NULL;
+	JSAMPROW			row;
+	unsigned int			ow, oh, denom;
+	int				tw, th, x, y, sy, i;
+	size_t				size;
+
+	cinfo.err = jpeg_std_error (&jerr.pub);
+	jerr.pub.error_exit = termview_jpeg_exit;
+	jerr.pub.output_message = termview_jpeg_message;
+	if (setjmp (jerr.jmp)) {
+		jpeg_destroy_decompress (&cinfo);
+		free (acc);
+		free (line);
+		free (xs);
+		return GP_ERROR_CORRUPTED_DATA;
+	}
+	jpeg_create_decompress (&cinfo);
+	jpeg_mem_src (&cinfo, (unsigned char *) frame->data, frame->size);
+	jpeg_read_header (&cinfo, TRUE);
+
+	tw = cols;
+	th = (long) cinfo.image_height * cols / cinfo.image_width;
+	if (th > 2 * rows) {
+		th = 2 * rows;
+		tw = (long) cinfo.image_width * th / cinfo.image_height;
+	}
+	tw = (tw < 1) ? 1 : tw;
+	th = (th < 1) ? 1 : th;
+
+	for (denom = 1; denom < 8; denom *= 2)
+		if ((cinfo.image_width / (denom * 2) < (unsigned int) tw) ||
+		    (cinfo.image_height / (denom * 2) < (unsigned int) th))
+			break;
+	cinfo.scale_num = 1;
+	cinfo.scale_denom = denom;
+	cinfo.out_color_space = JCS_RGB;
+	cinfo.dct_method = JDCT_IFAST;
+	cinfo.do_fancy_upsampling = FALSE;
+	cinfo.do_block_smoothing = FALSE;
+	jpeg_start_decompress (&cinfo);
+	ow = cinfo.output_width;
+	oh = cinfo.output_height;
+	tw = ((unsigned int) tw > ow) ? (int) ow : tw;
+	th = ((unsigned int) th > oh) ? (int) oh : th;
+
+	size = (size_t) tw * th * 3;
+	if (img->alloc < size) {
+		unsigned char *rgb = realloc (img->rgb, size);
+
+		if (!rgb)
+			longjmp (jerr.jmp, 1);
+		img->rgb = rgb;
+		img->alloc = size;
+	}
+	acc = malloc (ow * 3 * sizeof (uint32_t));
+	line = malloc (ow * 3);
+	xs = malloc ((tw + 1) * sizeof (int));
+	if (!acc || !line || !xs)
+		longjmp (jerr.jmp, 1);
+	for (x = 0; x <= tw; x++)
+		xs[x] = (long) x * ow / tw;
+
+	for (y = 0, sy = 0; y < th; y++) {
+		int y1 = (long) (y + 1) * oh / th, n = y1 - sy;
+		unsigned char *d = img->rgb + (size_t) y * tw * 3;
+
+		memset (acc, 0, ow * 3 * sizeof (uint32_t));
+		for (; sy < y1; sy++) {
+			row = line;
+			jpeg_read_scanlines (&cinfo, &row, 1);
+			termview_accumulate (acc, line, ow * 3);
+		}
+		for (x = 0; x < tw; x++) {
+			uint32_t r = 0, g = 0, b = 0, count;
+
+			for (i = xs[x]; i < xs[x + 1]; i++) {
+				r += acc[3 * i];
+				g += acc[3 * i + 1];
+				b += acc[3 * i + 2];
+			}
+			count = (xs[x + 1] - xs[x]) * n;
+			*d++ = r / count;
+			*d++ = g / count;
+			*d++ = b / count;
+		}
+	}
+	jpeg_finish_decompress (&cinfo);
+	jpeg_destroy_decompress (&cinfo);
+	free (acc);
+	free (line);
+	free (xs);
+	img->width = tw;
+	img->height = th;
+	return GP_OK;
+}
+
+/* Takes over the reference to frame. */
+static void
+termview_decode (TermView *tv, PreviewFrame *frame)
+{
+	TermImage	*img = &tv->image[tv->back];
+	PreviewFrame	*old;
+	int		cols, rows, t;
+
+	TV_LOCK (tv);
+	cols = tv->cols;
+	rows = tv->rows;
+	TV_UNLOCK (tv);
+
+	if (termview_scale (img, frame, cols, rows) != GP_OK) {
+		preview_frame_unref (tv->source, frame);
+		return;
+	}
+	old = img->frame;
+	img->frame = frame;
+	if (old)
+		preview_frame_unref (tv->source, old);
+
+	TV_LOCK (tv);
+	t = tv->back;
+	tv->back = tv->ready;
+	tv->ready = t;
+	tv->fresh = 1;
+	tv->decoded++;
+	TV_UNLOCK (tv);
+}
+
+#ifdef HAVE_PTHREAD
+static void *
+termview_thread (void *data)
+{
+	TermView	*tv = data;
+	PreviewFrame	*frame;
+	unsigned long	seq = 0;
+
+	/* Always the newest frame, whatever came in while decoding is dropped. */
+	while ((frame = preview_source_next (tv->source, seq))) {
+		seq = frame->seq;
+		termview_decode (tv, frame);
+	}
+	TV_LOCK (tv);
+	tv->running = 0;
+	TV_UNLOCK (tv);
+	return NULL;
+}
+#endif
+
+static void
+termview_put (TermView *tv, const char *s, size_t n)
+{
+	if (tv->out_len + n > tv->out_alloc) {
+		size_t size = 2 * (tv->out_len + n);
+		char *out = realloc (tv->out, size);
+
+		if (!out)
+			return;
+		tv->out = out;
+		tv->out_alloc = size;
+	}
+	memcpy (tv->out + tv->out_len, s, n);
+	tv->out_len += n;
+}
+
+static void
+termview_puts (TermView *tv, const char *s)
+{
+	termview_put (tv, s, strlen (s));
+}
+
+static void
+termview_printf (TermView *tv, const char *format, ...)
+{
+	char	buf[64];
+	va_list	args;
+	int	n;
+
+	va_start (args, format);
+	n = vsnprintf (buf, sizeof (buf), format, args);
+	va_end (args);
+	if (n > 0)
+		termview_put (tv, buf, ((size_t) n < sizeof (buf)) ? (size_t) n : sizeof (buf) - 1);
+}
+
+static void
+termview_flush (TermView *tv)
+{
+	size_t	done = 0;
+	ssize_t	r;
+
+	while (done < tv->out_len) {
+		r = write (STDOUT_FILENO, tv->out + done, tv->out_len - done);
+		if (r < 0) {
+			if (errno == EINTR)
+				continue;
+			break;
+		}
+		done += r;
+	}
+	tv->out_len = 0;
+}
+
+static int
+termview_256 (const unsigned char *c)
+{
+	return 16 + 36 * ((c[0] * 5 + 127) / 255) +
+		6 * ((c[1] * 5 + 127) / 255) + (c[2] * 5 + 127) / 255;
+}
+
+static void
+termview_color (TermView *tv, int background, const unsigned char *c, long *last)
+{
+	long color = (tv->mode == TERM_256) ? termview_256 (c) :
+		((long) c[0] << 16) | (c[1] << 8) | c[2];
+
+	if (color == *last)
+		return;
+	*last = color;
+	if (tv->mode == TERM_256)
+		termview_printf (tv, "\033[%d;5;%ldm", background ? 48 : 38, color);
+	else
+		termview_printf (tv, "\033[%d;2;%d;%d;%dm", background ? 48 : 38,
+				 c[0], c[1], c[2]);
+}
+
+static void
+termview_render (TermView *tv, TermImage *img, const char *status)
+{
+	static const char ramp[] = " .:-=+*#%@";
+	const unsigned char *top, *bottom;
+	int x, y, xoff, yoff;
+	long fg, bg;
+
+	xoff = (tv->cols - img->width) / 2;
+	yoff = (tv->rows - (img->height + 1) / 2) / 2;
+	for (y = 0; y < (img->height + 1) / 2; y++) {
+		termview_printf (tv, "\033[%d;%dH", yoff + y + 1, xoff + 1);
+		fg = bg = -1;
+		for (x = 0; x < img->width; x++) {
+			top = img->rgb + ((size_t) 2 * y * img->width + x) * 3;
+			bottom = (2 * y + 1 < img->height) ? top + img->width * 3 : NULL;
+			if (tv->mode == TERM_ASCII) {
+				int l = (2 * top[0] + 5 * top[1] + top[2]) / 8;
+
+				if (bottom)
+					l = (l + (2 * bottom[0] + 5 * bottom[1] + bottom[2]) / 8) / 2;
+				termview_put (tv, &ramp[l * (sizeof (ramp) - 2) / 255], 1);
+				continue;
+			}
+			/* Upper half block: foreground on top, background below. */
+			termview_color (tv, 0, top, &fg);
+			if (bottom)
+				termview_color (tv, 1, bottom, &bg);
+			else if (bg != -2) {
+				termview_puts (tv, "\033[49m");
+				bg = -2;
+			}
+			termview_puts (tv, "\342\226\200");
+		}
+		termview_puts (tv, "\033[0m");
+	}
+	termview_printf (tv, "\033[%d;1H\033[0m\033[K", tv->rows + 1);
+	termview_puts (tv, status);
+	termview_flush (tv);
+}
+
+/* Returns the key pressed, 27 for a lone Esc, 0 if nothing was pressed
+ * within timeout microseconds. */
+static int
+termview_key (long timeout)
+{
+	struct timeval	tv;
+	fd_set		fds;
+	unsigned char	buf[16];
+	ssize_t		n;
+
+	FD_ZERO (&fds);
+	FD_SET (STDIN_FILENO, &fds);
+	tv.tv_sec = 0;
+	tv.tv_usec = timeout;
+	if (select (STDIN_FILENO + 1, &fds, NULL, NULL, &tv) <= 0)
+		return 0;
+	n = read (STDIN_FILENO, buf, sizeof (buf));
+	if (n <= 0)
+		return 0;
+	/* Escape sequences of cursor keys and the like are ignored. */
+	if ((buf[0] == 27) && (n > 1))
+		return 0;
+	return buf[0];
+}
+
+static TermMode
+termview_mode (const char *mode)
+{
+	const char *env;
+
+	if (mode && !strcmp (mode, "truecolor"))
+		return TERM_TRUECOLOR;
+	if (mode && !strcmp (mode, "256"))
+		return TERM_256;
+	if (mode && !strcmp (mode, "ascii"))
+		return TERM_ASCII;
+	env = getenv ("COLORTERM");
+	if (env && (!strcmp (env, "truecolor") || !strcmp (env, "24bit")))
+		return TERM_TRUECOLOR;
+	env = getenv ("TERM");
+	if (env && strstr (env, "256color"))
+		return TERM_256;
+	if (!env || !strcmp (env, "dumb") || !strncmp (env, "vt", 2))
+		return TERM_ASCII;
+	return TERM_256;
+}
+
+int
+termview_show (GPParams *p, const char *mode, CameraFile *file)
+{
+	TermView	tv;
+	TermImage	*img;
+	struct termios	saved, raw;
+	struct winsize	ws;
+	struct timeval	start, last;
+	char		status[256];
+	unsigned long	shown = 0;
+#ifndef HAVE_PTHREAD
+	unsigned long	seq = 0;
+#endif
+	int		i, t, key = 0, keys, cols = 0, rows = 0, r;
+	double		fps = 0;
+
+	memset (&tv, 0, sizeof (tv));
+	tv.p = p;
+	tv.mode = termview_mode (mode);
+	tv.front = 0;
+	tv.ready = 1;
+	tv.back = 2;
+	tv.cols = 80;
+	tv.rows = 23;
+	if (!ioctl (STDOUT_FILENO, TIOCGWINSZ, &ws) && ws.ws_col && (ws.ws_row > 1)) {
+		tv.cols = ws.ws_col;
+		tv.rows = ws.ws_row - 1;
+	}
+
+	CR (preview_source_start (p, &tv.source));
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init (&tv.lock, NULL);
+	tv.running = 1;
+	if (pthread_create (&tv.thread, NULL, termview_thread, &tv)) {
+		preview_source_halt (tv.source);
+		preview_source_free (tv.source);
+		pthread_mutex_destroy (&tv.lock);
+		return GP_ERROR_OS_FAILURE;
+	}
+#endif
+
+	/* Keys without Enter, Ctrl-C still works. */
+	keys = isatty (STDIN_FILENO) && !tcgetattr (STDIN_FILENO, &saved);
+	if (keys) {
+		raw = saved;
+		raw.c_lflag &= ~(ICANON | ECHO);
+		raw.c_cc[VMIN] = 0;
+		raw.c_cc[VTIME] = 0;
+		tcsetattr (STDIN_FILENO, TCSANOW, &raw);
+	}
+	/* Alternate screen, hide the cursor. */
+	termview_puts (&tv, "\033[?1049h\033[?25l\033[2J");
+	termview_flush (&tv);
+
+	gettimeofday (&start, NULL);
+	last = start;
+	while (!glob_cancel && !end_next) {
+		if (!ioctl (STDOUT_FILENO, TIOCGWINSZ, &ws) && ws.ws_col && (ws.ws_row > 1)) {
+			TV_LOCK (&tv);
+			tv.cols = ws.ws_col;
+			tv.rows = ws.ws_row - 1;
+			TV_UNLOCK (&tv);
+		}
+#ifdef HAVE_PTHREAD
+		TV_LOCK (&tv);
+		r = tv.running;
+		TV_UNLOCK (&tv);
+		if (!r)
+			break;
+#else
+		{
+			PreviewFrame *frame = preview_source_next (tv.source, seq);
+
+			if (!frame)
+				break;
+			seq = frame->seq;
+			termview_decode (&tv, frame);
+		}
+#endif
+		TV_LOCK (&tv);
+		r = tv.fresh;
+		if (r) {
+			t = tv.front;
+			tv.front = tv.ready;
+			tv.ready = t;
+			tv.fresh = 0;
+		}
+		TV_UNLOCK (&tv);
+
+		if (r) {
+			struct timeval now;
+
+			img = &tv.image[tv.front];
+			if ((cols != tv.cols) || (rows != tv.rows)) {
+				termview_puts (&tv, "\033[0m\033[2J");
+				cols = tv.cols;
+				rows = tv.rows;
+			}
+			gettimeofday (&now, NULL);
+			t = (now.tv_sec - last.tv_sec) * 1000000 + now.tv_usec - last.tv_usec;
+			if (t > 0)
+				fps = fps ? 0.9 * fps + 0.1 * 1000000.0 / t : 1000000.0 / t;
+			last = now;
+			snprintf (status, sizeof (status),
+				  _(" %.1f fps  q: keep this frame  Esc: cancel  m: colors"), fps);
+			status[(cols < (int) sizeof (status)) ? cols : (int) sizeof (status) - 1] = '\0';
+			termview_render (&tv, img, status);
+			shown++;
+		}
+
+		key = keys ? termview_key (r ? 0 : 5000) : 0;
+		if (!keys && !r)
+			usleep (5000);
+		if (key == 'm') {
+			tv.mode = (tv.mode + 1) % TERM_MODES;
+			cols = 0;
+			key = 0;
+		} else if (key)
+			break;
+	}
+
+	r = preview_source_halt (tv.source);
+#ifdef HAVE_PTHREAD
+	pthread_join (tv.thread, NULL);
+	pthread_mutex_destroy (&tv.lock);
+#endif
+	termview_puts (&tv, "\033[0m\033[?25h\033[?1049l");
+	termview_flush (&tv);
+	if (keys)
+		tcsetattr (STDIN_FILENO, TCSANOW, &saved);
+
+	if (!(p->flags & FLAGS_QUIET) && shown)
+		fprintf (stderr, _("Live view: %lu frames captured, %lu decoded, %lu shown in %.1f seconds.\n"),
+			 preview_source_frames (tv.source), tv.decoded, shown,
+			 (last.tv_sec - start.tv_sec) + (last.tv_usec - start.tv_usec) / 1000000.0);
+
+	img = &tv.image[tv.front];
+	if ((r == GP_OK) && (key == 27)) {
+		gp_context_error (p->context, _("Operation cancelled"));
+		r = GP_ERROR_CANCEL;
+	} else if ((r == GP_OK) && img->frame)
+		r = gp_file_copy (file, img->frame->file);
+
+	for (i = 0; i < 3; i++) {
+		if (tv.image[i].frame)
+			preview_frame_unref (tv.source, tv.image[i].frame);
+		free (tv.image[i].rgb);
+	}
+	preview_source_free (tv.source);
+	free (tv.out);
+	return r;
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,40 @@
+/* termview.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_TERMVIEW_H
+#define GPHOTO2_TERMVIEW_H
+
+#include <gp-params.h>
+
+/*
+ * Live view in the terminal for --show-preview. mode is "truecolor"
+ * (half blocks, two pixels per cell), "256" or "ascii"; NULL picks one
+ * from $COLORTERM and $TERM. Runs until a key is pressed and puts the
+ * last frame shown into file, Esc cancels.
+ */
+int termview_show (GPParams *p, const char *mode, CameraFile *file);
+
+#endif /* !defined(GPHOTO2_TERMVIEW_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
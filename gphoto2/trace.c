@@ -0,0 +1,247 @@
+/* trace.c
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#define _GNU_SOURCE	/* syscall() */
+
+#include "config.h"
+#include "i18n.h"
+#include "main.h"
+#include "trace.h"
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_TIME_H
+# include <sys/time.h>
+#endif
+#ifdef HAVE_PTHREAD
+# include <pthread.h>
+#endif
+#ifdef __linux__
+# include <sys/syscall.h>
+#endif
+
+#include <gphoto2/gphoto2-port-log.h>
+
+#define TRACE_MAX_ARG	1024	/* escaped */
+#define TRACE_FLUSH	1.0	/* seconds between flushes */
+
+/* One file for the whole process, like the metrics. */
+static struct {
+	FILE		*f;		/* NULL if not tracing */
+	double		start, flushed;
+	unsigned long	pid;
+#ifdef HAVE_PTHREAD
+	pthread_mutex_t	lock;
+#endif
+} trace;
+
+static void
+trace_lock (void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_lock (&trace.lock);
+#endif
+}
+
+static void
+trace_unlock (void)
+{
+#ifdef HAVE_PTHREAD
+	pthread_mutex_unlock (&trace.lock);
+#endif
+}
+
+static double
+trace_now (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+	struct timespec ts;
+
+	clock_gettime (CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+#else
+	struct timeval tv;
+
+	gettimeofday (&tv, NULL);
+	return tv.tv_sec + tv.tv_usec / 1e6;
+#endif
+}
+
+/* The kernel's thread id where there is one, so that it matches top
+ * and perf. */
+static unsigned long
+trace_tid (void)
+{
+#if defined (__linux__) && defined (SYS_gettid)
+	return (unsigned long) syscall (SYS_gettid);
+#elif defined (HAVE_PTHREAD)
+	return (unsigned long) pthread_self ();
+#else
+	return trace.pid;
+#endif
+}
+
+/* ,"args":{"arg":"..."} with arg as a JSON string, or nothing. */
+static void
+trace_args (char *buf, size_t size, const char *arg)
+{
+	size_t n;
+
+	buf[0] = '\0';
+	if (!arg)
+		return;
+	n = snprintf (buf, size, ",\"args\":{\"arg\":\"");
+	for (; *arg && (n + 8 < size); arg++) {
+		if ((*arg == '"') || (*arg == '\\')) {
+			buf[n++] = '\\';
+			buf[n++] = *arg;
+		} else if ((unsigned char) *arg < 0x20)
+			n += sprintf (buf + n, "\\u%04x", (unsigned char) *arg);
+		else
+			buf[n++] = *arg;
+	}
+	strcpy (buf + n, "\"}");
+}
+
+/* One event, called with the lock held. */
+static void
+trace_put (double now, const char *fmt, ...)
+{
+	va_list args;
+
+	if (!trace.f)
+		return;
+	va_start (args, fmt);
+	fputs (",\n", trace.f);
+	vfprintf (trace.f, fmt, args);
+	va_end (args);
+	if (now - trace.flushed >= TRACE_FLUSH) {
+		fflush (trace.f);
+		trace.flushed = now;
+	}
+}
+
+static void
+trace_exit (void)
+{
+	trace_lock ();
+	fputs ("\n]\n", trace.f);
+	if (ferror (trace.f) | fclose (trace.f))
+		fprintf (stderr, _("Could not write the trace file.\n"));
+	trace.f = NULL;
+	trace_unlock ();
+}
+
+int
+trace_open (const char *filename)
+{
+	if (trace.f) {
+		cli_error_print (_("Only one trace file can be written."));
+		return GP_ERROR_BAD_PARAMETERS;
+	}
+	trace.f = fopen (filename, "w");
+	if (!trace.f) {
+		cli_error_print (_("Could not open trace file '%s': %s"),
+				 filename, strerror (errno));
+		return GP_ERROR_FILE_NOT_FOUND;
+	}
+#ifdef HAVE_PTHREAD
+	pthread_mutex_init (&trace.lock, NULL);
+#endif
+	trace.pid = (unsigned long) getpid ();
+	trace.start = trace.flushed = trace_now ();
+	fprintf (trace.f, "[\n{\"ph\":\"M\",\"name\":\"process_name\","
+		 "\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"gphoto2\"}}",
+		 trace.pid, trace_tid ());
+	trace_thread_name ("main");
+	atexit (trace_exit);
+	return GP_OK;
+}
+
+double
+trace_begin (void)
+{
+	return trace.f ? trace_now () : 0.;
+}
+
+void
+trace_end (const char *cat, const char *name, double start, const char *arg)
+{
+	char	args[TRACE_MAX_ARG];
+	double	now;
+
+	if (!trace.f || !start)
+		return;
+	now = trace_now ();
+	trace_args (args, sizeof (args), arg);
+	trace_lock ();
+	trace_put (now, "{\"ph\":\"X\",\"cat\":\"%s\",\"name\":\"%s\","
+		   "\"pid\":%lu,\"tid\":%lu,\"ts\":%.3f,\"dur\":%.3f%s}",
+		   cat, name, trace.pid, trace_tid (),
+		   (start - trace.start) * 1e6, (now - start) * 1e6, args);
+	trace_unlock ();
+}
+
+void
+trace_async (const char *cat, const char *name, unsigned long id,
+	     double start, const char *arg)
+{
+	char	args[TRACE_MAX_ARG];
+	double	now;
+
+	if (!trace.f || !start)
+		return;
+	now = trace_now ();
+	trace_args (args, sizeof (args), arg);
+	trace_lock ();
+	trace_put (now, "{\"ph\":\"b\",\"cat\":\"%s\",\"name\":\"%s\",\"id\":%lu,"
+		   "\"pid\":%lu,\"tid\":%lu,\"ts\":%.3f%s}",
+		   cat, name, id, trace.pid, trace_tid (),
+		   (start - trace.start) * 1e6, args);
+	trace_put (now, "{\"ph\":\"e\",\"cat\":\"%s\",\"name\":\"%s\",\"id\":%lu,"
+		   "\"pid\":%lu,\"tid\":%lu,\"ts\":%.3f}",
+		   cat, name, id, trace.pid, trace_tid (),
+		   (now - trace.start) * 1e6);
+	trace_unlock ();
+}
+
+void
+trace_thread_name (const char *name)
+{
+	if (!trace.f)
+		return;
+	trace_lock ();
+	trace_put (trace.flushed, "{\"ph\":\"M\",\"name\":\"thread_name\","
+		   "\"pid\":%lu,\"tid\":%lu,\"args\":{\"name\":\"%s\"}}",
+		   trace.pid, trace_tid (), name);
+	trace_unlock ();
+}
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */
@@ -0,0 +1,61 @@
+/* trace.h
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the
+ * Free Software Foundation, Inc., 51 Franklin Street, Fifth Floor,
+ * Boston, MA  02110-1301  USA
+ */
+
+#ifndef GPHOTO2_TRACE_H
+#define GPHOTO2_TRACE_H
+
+/*
+ * --trace FILE writes a timeline of the command line actions, file
+ * actions, downloads, camera calls, hook runs, event waits and config
+ * lookups in the Chrome trace event format, for ui.perfetto.dev or
+ * chrome://tracing. Every span is written when it ends, with its
+ * thread; hook runs of --hook-jobs overlap, so they get their own
+ * tracks.
+ *
+ * The file is flushed every second or so. If gphoto2 does not get to
+ * exit, the closing bracket is missing, which the viewers accept.
+ */
+
+/* --trace FILE */
+int    trace_open (const char *filename);
+
+/* Start of a span, 0 if not tracing. Same clock as the metrics. */
+double trace_begin (void);
+
+/* A span of category cat from start to now, in this thread. arg is
+ * shown with it, may be NULL. */
+void   trace_end   (const char *cat, const char *name, double start,
+		    const char *arg);
+
+/* Same for spans that overlap others of this thread, each distinct id
+ * gets a track. */
+void   trace_async (const char *cat, const char *name, unsigned long id,
+		    double start, const char *arg);
+
+/* Names the calling thread in the viewers. */
+void   trace_thread_name (const char *name);
+
+#endif /* !defined(GPHOTO2_TRACE_H) */
+
+
+/*
+ * Local Variables:
+ * c-file-style:"linux"
+ * indent-tabs-mode:t
+ * End:
+ */